@@ -52,6 +52,7 @@ public class EntityTotalWar : ModuleRules
 				"StateTreeModule",
 				"MassLOD",
 				"NavigationSystem",
+				"Navmesh",
 				//todo: maybe do thee editor only stuff on another module?
 				
 			}
@@ -0,0 +1,362 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ETW_MassFormation.h"
+
+#include "Algo/Sort.h"
+
+namespace UE::Mass::Formation
+{
+	// refinement passes over unit pairs, each pass is O(Num * SwapWindow)
+	constexpr int32 SwapIterations = 2;
+	constexpr int32 MinSwapWindow = 8;
+	constexpr int32 MaxSwapWindow = 32;
+
+	// slots which front projection differs less than that belong to same rank
+	constexpr float RankTolerance = 1.f;
+
+	// exact rank key of slot, comparing keys keeps sort predicates strict weak ordering
+	static int64 GetRankKey(const FVector2D& Offset)
+	{
+		return FMath::RoundToInt64(Offset.X / RankTolerance);
+	}
+
+	static void GenerateRanks(const int32 MaxRankWidth, const bool bWedge, const float Spacing, const int32 NumSlots, TArray<FVector2D>& OutOffsets)
+	{
+		int32 Placed = 0;
+		for (int32 Rank = 0; Placed < NumSlots; Rank++)
+		{
+			const int32 RankWidth = bWedge ? FMath::Min(2 * Rank + 1, MaxRankWidth) : MaxRankWidth;
+			const int32 NumInRank = FMath::Min(RankWidth, NumSlots - Placed);
+			for (int32 Column = 0; Column < NumInRank; Column++)
+			{
+				OutOffsets.Emplace(-Rank * Spacing, (Column - (NumInRank - 1) * 0.5f) * Spacing);
+			}
+			Placed += NumInRank;
+		}
+	}
+
+	static int32 GetBoxRingCapacity(const int32 Side)
+	{
+		return Side <= 0 ? 0 : Side == 1 ? 1 : 4 * (Side - 1);
+	}
+
+	static void GenerateBox(const int32 Length, const float Spacing, const int32 NumSlots, TArray<FVector2D>& OutOffsets)
+	{
+		// grow side until nested rings fit all slots
+		int32 Side = FMath::Max(Length, 2);
+		for (;;)
+		{
+			int32 Capacity = 0;
+			for (int32 RingSide = Side; RingSide > 0; RingSide -= 2)
+			{
+				Capacity += GetBoxRingCapacity(RingSide);
+			}
+			if (Capacity >= NumSlots)
+			{
+				break;
+			}
+			Side++;
+		}
+
+		// outer ring first, walk perimeter clockwise starting from front left corner
+		for (int32 RingSide = Side; RingSide > 0 && OutOffsets.Num() < NumSlots; RingSide -= 2)
+		{
+			const float HalfSize = (RingSide - 1) * 0.5f * Spacing;
+			if (RingSide == 1)
+			{
+				OutOffsets.Emplace(0.f, 0.f);
+				break;
+			}
+
+			for (int32 Step = 0; Step < RingSide - 1 && OutOffsets.Num() < NumSlots; Step++)
+			{
+				OutOffsets.Emplace(HalfSize, -HalfSize + Step * Spacing);
+			}
+			for (int32 Step = 0; Step < RingSide - 1 && OutOffsets.Num() < NumSlots; Step++)
+			{
+				OutOffsets.Emplace(HalfSize - Step * Spacing, HalfSize);
+			}
+			for (int32 Step = 0; Step < RingSide - 1 && OutOffsets.Num() < NumSlots; Step++)
+			{
+				OutOffsets.Emplace(-HalfSize, HalfSize - Step * Spacing);
+			}
+			for (int32 Step = 0; Step < RingSide - 1 && OutOffsets.Num() < NumSlots; Step++)
+			{
+				OutOffsets.Emplace(-HalfSize + Step * Spacing, -HalfSize);
+			}
+		}
+	}
+
+	static void GenerateConcentric(const float StartRadius, const float Spacing, const int32 NumSlots, TArray<FVector2D>& OutOffsets)
+	{
+		float Radius = StartRadius;
+		while (OutOffsets.Num() < NumSlots)
+		{
+			const int32 RingCapacity = Radius < KINDA_SMALL_NUMBER ? 1 : FMath::Max(1, FMath::FloorToInt(UE_TWO_PI * Radius / Spacing));
+			// last ring is partially filled, spread its slots evenly
+			const int32 NumInRing = FMath::Min(RingCapacity, NumSlots - OutOffsets.Num());
+			const float AngleStep = UE_TWO_PI / NumInRing;
+			for (int32 Idx = 0; Idx < NumInRing; Idx++)
+			{
+				float Sin, Cos;
+				FMath::SinCos(&Sin, &Cos, Idx * AngleStep);
+				OutOffsets.Emplace(Cos * Radius, Sin * Radius);
+			}
+			Radius += Spacing;
+		}
+	}
+}
+
+float FETW_MassFormationSolver::GetSlotSpacing(const FETW_MassFormation& Formation, const FETW_MassSquadParams& Params)
+{
+	switch (Formation.FormationDensity)
+	{
+	case EETW_FormationDensity::Loose:
+		return Params.LooseDensity;
+	case EETW_FormationDensity::Normal:
+		return Params.NormalDensity;
+	case EETW_FormationDensity::Tight:
+		return Params.TightDensity;
+	default:
+		return Formation.DencityInterval.Get();
+	}
+}
+
+float FETW_MassFormationSolver::GetFormationSpeed(const FETW_MassFormation& Formation, const FETW_MassSquadParams& Params)
+{
+	switch (Formation.FormationMovementMode)
+	{
+	case EETW_FormationMovementMode::March:
+		return Params.MarchSpeed;
+	case EETW_FormationMovementMode::Advance:
+		return Params.AdvanceSpeed;
+	case EETW_FormationMovementMode::Sneak:
+		return Params.SneakSpeed;
+	default:
+		return Formation.Speed.Get();
+	}
+}
+
+TSharedRef<const FETW_MassFormationSlots> FETW_MassFormationSolver::GetSlots(const FETW_MassFormation& Formation, const float Spacing, const int32 NumSlots)
+{
+	FETW_MassFormationSlotsKey Key;
+	Key.FormationType = Formation.FormationType;
+	Key.Length = Formation.Length;
+	Key.Spacing = FMath::RoundToInt(Spacing);
+	Key.NumSlots = NumSlots;
+
+	{
+		FReadScopeLock ReadLock(SlotsCacheLock);
+		if (const TSharedRef<const FETW_MassFormationSlots>* Found = SlotsCache.Find(Key))
+		{
+			return *Found;
+		}
+	}
+
+	// generate outside of lock, another thread may have been faster, then its result wins
+	TSharedRef<FETW_MassFormationSlots> NewSlots = MakeShared<FETW_MassFormationSlots>();
+	GenerateSlots(Key.FormationType, Key.Length, Key.Spacing, Key.NumSlots, NewSlots->Offsets);
+
+	FWriteScopeLock WriteLock(SlotsCacheLock);
+	if (const TSharedRef<const FETW_MassFormationSlots>* Found = SlotsCache.Find(Key))
+	{
+		return *Found;
+	}
+	return SlotsCache.Add(Key, NewSlots);
+}
+
+void FETW_MassFormationSolver::GenerateSlots(const EETW_FormationType FormationType, const int32 Length, const float Spacing, const int32 NumSlots, TArray<FVector2D>& OutOffsets)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(FETW_MassFormationSolver_GenerateSlots);
+
+	OutOffsets.Reset(NumSlots);
+	if (NumSlots <= 0)
+	{
+		return;
+	}
+
+	const int32 RankLength = FMath::Max<int32>(Length, 1);
+	switch (FormationType)
+	{
+	case EETW_FormationType::Box:
+		UE::Mass::Formation::GenerateBox(RankLength, Spacing, NumSlots, OutOffsets);
+		break;
+	case EETW_FormationType::Circle:
+		UE::Mass::Formation::GenerateConcentric(0.f, Spacing, NumSlots, OutOffsets);
+		break;
+	case EETW_FormationType::Ring:
+		// length is a number of units in the inner ring, it sets the hole size
+		UE::Mass::Formation::GenerateConcentric(FMath::Max(Spacing, RankLength * Spacing / UE_TWO_PI), Spacing, NumSlots, OutOffsets);
+		break;
+	case EETW_FormationType::Wedge:
+		UE::Mass::Formation::GenerateRanks(RankLength, /*bWedge=*/true, Spacing, NumSlots, OutOffsets);
+		break;
+	case EETW_FormationType::Rectangle:
+	default:
+		// custom formations don't have a layout source yet, use rectangle for them
+		UE::Mass::Formation::GenerateRanks(RankLength, /*bWedge=*/false, Spacing, NumSlots, OutOffsets);
+		break;
+	}
+
+	// center around origin
+	FVector2D Center = FVector2D::ZeroVector;
+	for (const FVector2D& Offset : OutOffsets)
+	{
+		Center += Offset;
+	}
+	Center /= OutOffsets.Num();
+	for (FVector2D& Offset : OutOffsets)
+	{
+		Offset -= Center;
+	}
+
+	// front rank first, left to right
+	Algo::Sort(OutOffsets, [](const FVector2D& A, const FVector2D& B)
+	{
+		const int64 RankA = UE::Mass::Formation::GetRankKey(A);
+		const int64 RankB = UE::Mass::Formation::GetRankKey(B);
+		if (RankA != RankB)
+		{
+			return RankA > RankB;
+		}
+		return A.Y < B.Y;
+	});
+}
+
+void FETW_MassFormationSolver::AssignSlots(TConstArrayView<FVector2D> UnitLocations, TConstArrayView<FVector2D> SlotOffsets, const int32 RankLength, TArray<int32>& OutUnitSlots)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(FETW_MassFormationSolver_AssignSlots);
+
+	const int32 NumUnits = UnitLocations.Num();
+	OutUnitSlots.Init(INDEX_NONE, NumUnits);
+
+	const int32 NumAssigned = FMath::Min(NumUnits, SlotOffsets.Num());
+	ensureMsgf(NumAssigned == NumUnits, TEXT("Not enough formation slots: %d slots for %d units"), SlotOffsets.Num(), NumUnits);
+	if (NumAssigned == 0)
+	{
+		return;
+	}
+
+	// units front to back
+	TArray<int32, TInlineAllocator<256>> SortedUnits;
+	SortedUnits.SetNumUninitialized(NumUnits);
+	for (int32 Idx = 0; Idx < NumUnits; Idx++)
+	{
+		SortedUnits[Idx] = Idx;
+	}
+	Algo::Sort(SortedUnits, [&UnitLocations](const int32 A, const int32 B)
+	{
+		if (UnitLocations[A].X != UnitLocations[B].X)
+		{
+			return UnitLocations[A].X > UnitLocations[B].X;
+		}
+		return A < B;
+	});
+
+	// slots are ordered by rank already, give each rank the same number of frontmost units and match them left to right
+	int32 RankStart = 0;
+	while (RankStart < NumAssigned)
+	{
+		int32 RankEnd = RankStart + 1;
+		while (RankEnd < NumAssigned && UE::Mass::Formation::GetRankKey(SlotOffsets[RankEnd]) == UE::Mass::Formation::GetRankKey(SlotOffsets[RankStart]))
+		{
+			RankEnd++;
+		}
+
+		TArrayView<int32> RankUnits = MakeArrayView(&SortedUnits[RankStart], RankEnd - RankStart);
+		Algo::Sort(RankUnits, [&UnitLocations](const int32 A, const int32 B)
+		{
+			if (UnitLocations[A].Y != UnitLocations[B].Y)
+			{
+				return UnitLocations[A].Y < UnitLocations[B].Y;
+			}
+			return A < B;
+		});
+
+		for (int32 SlotIdx = RankStart; SlotIdx < RankEnd; SlotIdx++)
+		{
+			OutUnitSlots[SortedUnits[SlotIdx]] = SlotIdx;
+		}
+		RankStart = RankEnd;
+	}
+
+	// local refinement, swap slots of units that are close in slot order if it shortens their summed squared travel
+	const int32 SwapWindow = FMath::Clamp(RankLength + 1, UE::Mass::Formation::MinSwapWindow, UE::Mass::Formation::MaxSwapWindow);
+	for (int32 Iteration = 0; Iteration < UE::Mass::Formation::SwapIterations; Iteration++)
+	{
+		bool bSwapped = false;
+		for (int32 I = 0; I < NumAssigned; I++)
+		{
+			const int32 UnitA = SortedUnits[I];
+			const int32 LastJ = FMath::Min(I + SwapWindow, NumAssigned - 1);
+			for (int32 J = I + 1; J <= LastJ; J++)
+			{
+				const int32 UnitB = SortedUnits[J];
+				const FVector2D& SlotA = SlotOffsets[OutUnitSlots[UnitA]];
+				const FVector2D& SlotB = SlotOffsets[OutUnitSlots[UnitB]];
+
+				const double CurrentCost = FVector2D::DistSquared(UnitLocations[UnitA], SlotA) + FVector2D::DistSquared(UnitLocations[UnitB], SlotB);
+				const double SwappedCost = FVector2D::DistSquared(UnitLocations[UnitA], SlotB) + FVector2D::DistSquared(UnitLocations[UnitB], SlotA);
+				if (SwappedCost < CurrentCost)
+				{
+					Swap(OutUnitSlots[UnitA], OutUnitSlots[UnitB]);
+					bSwapped = true;
+				}
+			}
+		}
+
+		if (!bSwapped)
+		{
+			break;
+		}
+	}
+}
+
+int32 FETW_MassFormationSolver::FindRankDonorSlot(TConstArrayView<FVector2D> SlotOffsets, TConstArrayView<FMassEntityHandle> SlotOccupants, const int32 VacantSlot)
+{
+	check(SlotOffsets.Num() >= SlotOccupants.Num());
+	if (!SlotOccupants.IsValidIndex(VacantSlot))
+	{
+		return INDEX_NONE;
+	}
+
+	const FVector2D& VacantOffset = SlotOffsets[VacantSlot];
+	int32 DonorSlot = INDEX_NONE;
+	float BestDistSq = MAX_flt;
+
+	// slots are sorted front first, so everything behind the vacant slot comes after it
+	for (int32 Slot = VacantSlot + 1; Slot < SlotOccupants.Num(); Slot++)
+	{
+		const float Behind = VacantOffset.X - SlotOffsets[Slot].X;
+		if (Behind <= UE::Mass::Formation::RankTolerance)
+		{
+			// same rank
+			continue;
+		}
+		if (FMath::Square(Behind) >= BestDistSq)
+		{
+			// further ranks can't be closer
+			break;
+		}
+		if (!SlotOccupants[Slot].IsSet())
+		{
+			continue;
+		}
+
+		const float DistSq = FVector2D::DistSquared(VacantOffset, SlotOffsets[Slot]);
+		if (DistSq < BestDistSq)
+		{
+			BestDistSq = DistSq;
+			DonorSlot = Slot;
+		}
+	}
+
+	return DonorSlot;
+}
+
+void FETW_MassFormationSolver::Reset()
+{
+	FWriteScopeLock WriteLock(SlotsCacheLock);
+	SlotsCache.Reset();
+}
@@ -0,0 +1,71 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "ETW_MassSquadFragments.h"
+
+/** Cache key of formation slot layout, spacing is quantized to centimeters */
+struct FETW_MassFormationSlotsKey
+{
+	EETW_FormationType FormationType = EETW_FormationType::Rectangle;
+	int16 Length = 0;
+	int32 Spacing = 0;
+	int32 NumSlots = 0;
+
+	bool operator==(const FETW_MassFormationSlotsKey& Other) const
+	{
+		return FormationType == Other.FormationType && Length == Other.Length && Spacing == Other.Spacing && NumSlots == Other.NumSlots;
+	}
+
+	friend uint32 GetTypeHash(const FETW_MassFormationSlotsKey& Key)
+	{
+		uint32 Hash = HashCombine(GetTypeHash(Key.FormationType), GetTypeHash(Key.Length));
+		Hash = HashCombine(Hash, GetTypeHash(Key.Spacing));
+		return HashCombine(Hash, GetTypeHash(Key.NumSlots));
+	}
+};
+
+/**
+ * Formation slot offsets, local squad space: X - forward, Y - right, centered around origin.
+ * Slots are ordered front rank first, left to right inside a rank.
+ */
+struct ENTITYTOTALWAR_API FETW_MassFormationSlots
+{
+	TArray<FVector2D> Offsets;
+};
+
+/**
+ * Generates slot layouts per formation type and assigns units to slots.
+ * Layouts are cached, cache is thread safe so solver can be used from parallel processors.
+ */
+struct ENTITYTOTALWAR_API FETW_MassFormationSolver
+{
+	// slot spacing from squad density presets, formation own interval when density isn't set
+	static float GetSlotSpacing(const FETW_MassFormation& Formation, const FETW_MassSquadParams& Params);
+
+	// formation speed from squad movement mode presets, formation own speed when mode isn't set
+	static float GetFormationSpeed(const FETW_MassFormation& Formation, const FETW_MassSquadParams& Params);
+
+	TSharedRef<const FETW_MassFormationSlots> GetSlots(const FETW_MassFormation& Formation, const float Spacing, const int32 NumSlots);
+
+	/**
+	 * Min-cost-like matching of units to slots, both in same (formation local) space.
+	 * Rank-major sort of units and slots gives initial matching, then pairwise swaps of nearby units reduce total travel.
+	 * @param OutUnitSlots slot index per unit, Num of slots should be >= Num of units
+	 */
+	static void AssignSlots(TConstArrayView<FVector2D> UnitLocations, TConstArrayView<FVector2D> SlotOffsets, const int32 RankLength, TArray<int32>& OutUnitSlots);
+
+	/**
+	 * Rank closing: occupied slot which should fill the vacant one, INDEX_NONE if there is nobody behind it.
+	 * Nearest occupied slot from the ranks behind wins, so the same column of the next rank steps forward first.
+	 */
+	static int32 FindRankDonorSlot(TConstArrayView<FVector2D> SlotOffsets, TConstArrayView<FMassEntityHandle> SlotOccupants, const int32 VacantSlot);
+
+	static void GenerateSlots(const EETW_FormationType FormationType, const int32 Length, const float Spacing, const int32 NumSlots, TArray<FVector2D>& OutOffsets);
+
+	void Reset();
+
+private:
+	TMap<FETW_MassFormationSlotsKey, TSharedRef<const FETW_MassFormationSlots>> SlotsCache;
+	FRWLock SlotsCacheLock;
+};
@@ -0,0 +1,151 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ETW_MassFormationSpawnGenerator.h"
+#include "ETW_MassFormation.h"
+#include "ETW_MassSquadSubsystem.h"
+
+#include "MassEntityConfigAsset.h"
+#include "MassSpawnLocationProcessor.h"
+#include "NavigationSystem.h"
+#include "VisualLogger/VisualLogger.h"
+
+void UETW_MassFormationSpawnGenerator::Generate(UObject& QueryOwner, TConstArrayView<FMassSpawnedEntityType> EntityTypes, int32 Count, FFinishedGeneratingSpawnDataSignature& FinishedGeneratingSpawnPointsDelegate) const
+{
+	QUICK_SCOPE_CYCLE_COUNTER(UETW_MassFormationSpawnGenerator_Generate);
+
+	TArray<FMassEntitySpawnDataGeneratorResult> Results;
+	BuildResultsFromEntityTypes(Count, EntityTypes, Results);
+
+	UWorld* World = QueryOwner.GetWorld();
+	const UETW_MassSquadSubsystem* SquadSubsystem = UWorld::GetSubsystem<UETW_MassSquadSubsystem>(World);
+	const AActor* OwnerActor = Cast<AActor>(&QueryOwner);
+	if (World == nullptr || SquadSubsystem == nullptr || OwnerActor == nullptr)
+	{
+		FinishedGeneratingSpawnPointsDelegate.Execute(Results);
+		return;
+	}
+
+	const FVector Origin = OwnerActor->GetActorLocation();
+	const FRotator Facing(0.f, OwnerActor->GetActorRotation().Yaw, 0.f);
+	const FVector Forward = Facing.Vector();
+	const FVector Right(-Forward.Y, Forward.X, 0.f);
+	FETW_MassFormationSolver& FormationSolver = SquadSubsystem->GetFormationSolver();
+
+	// slot layout per result, lateral extent decides where next squad starts
+	TArray<TSharedPtr<const FETW_MassFormationSlots>> ResultSlots;
+	TArray<FVector2D> ResultLateralExtents;
+	ResultSlots.SetNum(Results.Num());
+	ResultLateralExtents.Init(FVector2D::ZeroVector, Results.Num());
+	float LineWidth = 0.f;
+	int32 NumPoints = 0;
+
+	for (int32 ResultIdx = 0; ResultIdx < Results.Num(); ResultIdx++)
+	{
+		const FMassEntitySpawnDataGeneratorResult& Result = Results[ResultIdx];
+		// already loaded when generated for commander, other spawners may still need the load
+		const UMassEntityConfigAsset* EntityConfig = EntityTypes[Result.EntityConfigIndex].EntityConfig.LoadSynchronous();
+		if (Result.NumEntities <= 0 || EntityConfig == nullptr)
+		{
+			continue;
+		}
+
+		const FMassEntityTemplate& EntityTemplate = EntityConfig->GetOrCreateEntityTemplate(*World);
+		const FMassArchetypeSharedFragmentValues& SharedValues = EntityTemplate.GetSharedFragmentValues();
+
+		const FETW_MassSquadSharedFragment* SquadSharedFragment = nullptr;
+		for (const FSharedStruct& SharedStruct : SharedValues.GetSharedFragments())
+		{
+			if ((SquadSharedFragment = SharedStruct.GetPtr<FETW_MassSquadSharedFragment>()) != nullptr)
+			{
+				break;
+			}
+		}
+
+		const FETW_MassSquadParams* SquadParams = nullptr;
+		for (const FConstSharedStruct& ConstSharedStruct : SharedValues.GetConstSharedFragments())
+		{
+			if ((SquadParams = ConstSharedStruct.GetPtr<FETW_MassSquadParams>()) != nullptr)
+			{
+				break;
+			}
+		}
+
+		if (SquadSharedFragment == nullptr || SquadParams == nullptr)
+		{
+			UE_VLOG_UELOG(&QueryOwner, ETW_Mass, Warning, TEXT("%s has no squad unit trait, formation spawn points can't be generated"), *EntityConfig->GetName());
+			continue;
+		}
+
+		const float SlotSpacing = FETW_MassFormationSolver::GetSlotSpacing(SquadSharedFragment->Formation, *SquadParams);
+		const TSharedRef<const FETW_MassFormationSlots> Slots = FormationSolver.GetSlots(SquadSharedFragment->Formation, SlotSpacing, Result.NumEntities);
+
+		FVector2D LateralExtent(MAX_flt, -MAX_flt);
+		for (const FVector2D& Offset : Slots->Offsets)
+		{
+			LateralExtent.X = FMath::Min(LateralExtent.X, Offset.Y);
+			LateralExtent.Y = FMath::Max(LateralExtent.Y, Offset.Y);
+		}
+		ResultSlots[ResultIdx] = Slots;
+		ResultLateralExtents[ResultIdx] = LateralExtent;
+		LineWidth += (LateralExtent.Y - LateralExtent.X) + (NumPoints > 0 ? SquadGap : 0.f);
+		NumPoints += Result.NumEntities;
+	}
+
+	// squads line up left to right centered on owner, every unit starts on its slot
+	TArray<FNavigationProjectionWork> Workload;
+	Workload.Reserve(NumPoints);
+	float LineCursor = -LineWidth * 0.5f;
+	for (int32 ResultIdx = 0; ResultIdx < Results.Num(); ResultIdx++)
+	{
+		if (!ResultSlots[ResultIdx].IsValid())
+		{
+			continue;
+		}
+
+		const FETW_MassFormationSlots& Slots = *ResultSlots[ResultIdx];
+		const FVector SquadOrigin = Origin + Right * (LineCursor - ResultLateralExtents[ResultIdx].X);
+		LineCursor += (ResultLateralExtents[ResultIdx].Y - ResultLateralExtents[ResultIdx].X) + SquadGap;
+
+		for (int32 UnitIdx = 0; UnitIdx < Results[ResultIdx].NumEntities; UnitIdx++)
+		{
+			const FVector2D& Offset = Slots.Offsets[UnitIdx];
+			Workload.Emplace(SquadOrigin + Forward * Offset.X + Right * Offset.Y);
+		}
+	}
+
+	if (bProjectToNavMesh)
+	{
+		const UNavigationSystemV1* NavSystem = FNavigationSystem::GetCurrent<UNavigationSystemV1>(World);
+		if (const ANavigationData* NavData = NavSystem ? NavSystem->GetDefaultNavDataInstance() : nullptr)
+		{
+			NavData->BatchProjectPoints(Workload, ProjectionExtent);
+		}
+	}
+
+	int32 PointIdx = 0;
+	for (int32 ResultIdx = 0; ResultIdx < Results.Num(); ResultIdx++)
+	{
+		FMassEntitySpawnDataGeneratorResult& Result = Results[ResultIdx];
+		Result.SpawnDataProcessor = UMassSpawnLocationProcessor::StaticClass();
+		Result.SpawnData.InitializeAs<FMassTransformsSpawnData>();
+		FMassTransformsSpawnData& Transforms = Result.SpawnData.GetMutable<FMassTransformsSpawnData>();
+
+		if (!ResultSlots[ResultIdx].IsValid())
+		{
+			// nothing to place, squad is skipped by spawner
+			Result.NumEntities = 0;
+			continue;
+		}
+
+		Transforms.Transforms.Reserve(Result.NumEntities);
+		for (int32 UnitIdx = 0; UnitIdx < Result.NumEntities; UnitIdx++, PointIdx++)
+		{
+			const FNavigationProjectionWork& Work = Workload[PointIdx];
+			const FVector Location = Work.bResult ? Work.OutLocation.Location : Work.Point;
+			Transforms.Transforms.Emplace(Facing.Quaternion(), Location);
+		}
+	}
+
+	FinishedGeneratingSpawnPointsDelegate.Execute(Results);
+}
@@ -0,0 +1,33 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "MassEntitySpawnDataGeneratorBase.h"
+#include "ETW_MassFormationSpawnGenerator.generated.h"
+
+/**
+ * Native squad spawn points generator, no EQS query involved.
+ * Every entity type result becomes one squad, its units are placed directly on the formation slots of the squad,
+ * squads are lined up side by side facing query owner forward. All points are projected on navmesh in single batch.
+ * Spawner doesn't keep point order, squad units initializer assigns slots again from the locations units got.
+ */
+UCLASS(meta = (DisplayName = "ETW Formation Spawn Points Generator"))
+class ENTITYTOTALWAR_API UETW_MassFormationSpawnGenerator : public UMassEntitySpawnDataGeneratorBase
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Generate(UObject& QueryOwner, TConstArrayView<FMassSpawnedEntityType> EntityTypes, int32 Count, FFinishedGeneratingSpawnDataSignature& FinishedGeneratingSpawnPointsDelegate) const override;
+
+protected:
+	// gap between neighbour squads
+	UPROPERTY(EditAnywhere, meta = (Units = "Centimeters"))
+	float SquadGap = 400.f;
+
+	UPROPERTY(EditAnywhere)
+	bool bProjectToNavMesh = true;
+
+	// points which fail projection keep their generated location
+	UPROPERTY(EditAnywhere, meta = (EditCondition = "bProjectToNavMesh"))
+	FVector ProjectionExtent = FVector(100.f, 100.f, 1000.f);
+};
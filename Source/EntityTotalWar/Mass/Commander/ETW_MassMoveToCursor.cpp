@@ -171,7 +171,6 @@ void UETW_MassMoveToCursorProcessor::Execute(FMassEntityManager& EntityManager,
 					MoveToCursor.Target = CommanderFragment.CommanderComp->GetCommandLocation();
 					//// deferred:
 					//Context.Defer().PushCommand<FMassDeferredChangeCompositionCommand>([&MoveToCursor, CommanderComp](FMassEntityManager& Manager){
-					//	//NavigationSubsystem->EntityRequestNewPath(EntityHandle, PathFollowParams, InitialLocation, NewMoveToLocation, PathFragment);
 					//	MoveToCursor.Target = CommanderComp->GetCommandLocation();
 					//});
 
@@ -0,0 +1,180 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ETW_MassSquadEngagement.h"
+#include "ETW_MassSquadProcessors.h"
+#include "ETW_MassSquadSubsystem.h"
+
+#include "MassExecutionContext.h"
+
+TConstArrayView<uint32> FETW_MassSquadEngagements::GetEngagedSquads(const uint32 SquadIndex) const
+{
+	if (!SquadRangeStart.IsValidIndex(SquadIndex + 1))
+	{
+		return TConstArrayView<uint32>();
+	}
+	const int32 Start = SquadRangeStart[SquadIndex];
+	return MakeArrayView(EngagedSquads.GetData() + Start, SquadRangeStart[SquadIndex + 1] - Start);
+}
+
+void FETW_MassSquadEngagements::Build(TConstArrayView<FETW_MassSquadEngagementPair> InPairs)
+{
+	Pairs = InPairs;
+	SquadRangeStart.Reset();
+	EngagedSquads.Reset();
+
+	if (Pairs.IsEmpty())
+	{
+		return;
+	}
+
+	uint32 MaxSquadIndex = 0;
+	for (const FETW_MassSquadEngagementPair& Pair : Pairs)
+	{
+		MaxSquadIndex = FMath::Max(MaxSquadIndex, FMath::Max(Pair.SquadA, Pair.SquadB));
+	}
+
+	// count, prefix sum, fill
+	SquadRangeStart.SetNumZeroed(MaxSquadIndex + 2);
+	for (const FETW_MassSquadEngagementPair& Pair : Pairs)
+	{
+		SquadRangeStart[Pair.SquadA + 1]++;
+		SquadRangeStart[Pair.SquadB + 1]++;
+	}
+	for (int32 Idx = 1; Idx < SquadRangeStart.Num(); Idx++)
+	{
+		SquadRangeStart[Idx] += SquadRangeStart[Idx - 1];
+	}
+
+	EngagedSquads.SetNumUninitialized(Pairs.Num() * 2);
+	TArray<int32, TInlineAllocator<256>> FillCursor(SquadRangeStart);
+	for (const FETW_MassSquadEngagementPair& Pair : Pairs)
+	{
+		EngagedSquads[FillCursor[Pair.SquadA]++] = Pair.SquadB;
+		EngagedSquads[FillCursor[Pair.SquadB]++] = Pair.SquadA;
+	}
+}
+
+void FETW_MassSquadEngagements::Reset()
+{
+	Pairs.Reset();
+	SquadRangeStart.Reset();
+	EngagedSquads.Reset();
+}
+
+
+UETW_MassSquadEngagementProcessor::UETW_MassSquadEngagementProcessor()
+	: EntityQuery_Squad(*this)
+{
+	bAutoRegisterWithProcessingPhases = true;
+	ExecutionFlags = (int32)(EProcessorExecutionFlags::Server | EProcessorExecutionFlags::Standalone);
+	ExecutionOrder.ExecuteInGroup = UE::Mass::ProcessorGroupNames::Tasks;
+	ExecutionOrder.ExecuteAfter.Add(UETW_MassSquadProcessor::StaticClass()->GetFName());
+}
+
+void UETW_MassSquadEngagementProcessor::ConfigureQueries()
+{
+	EntityQuery_Squad.AddRequirement<FETW_MassSquadAggregateFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Squad.AddRequirement<FETW_MassTeamFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Squad.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Squad.AddConstSharedRequirement<FETW_MassSquadParams>();
+
+	// engagement pairs are rebuilt in squad subsystem
+	EntityQuery_Squad.AddSubsystemRequirement<UETW_MassSquadSubsystem>(EMassFragmentAccess::ReadWrite);
+}
+
+void UETW_MassSquadEngagementProcessor::Initialize(UObject& Owner)
+{
+	Super::Initialize(Owner);
+
+	SquadSubsystem = UWorld::GetSubsystem<UETW_MassSquadSubsystem>(Owner.GetWorld());
+	check(SquadSubsystem);
+}
+
+bool UETW_MassSquadEngagementProcessor::TestOverlap(const UE::Mass::Squad::FSquadBroadphaseEntry& A, const UE::Mass::Squad::FSquadBroadphaseEntry& B)
+{
+	const FVector2D RightA(-A.Forward.Y, A.Forward.X);
+	const FVector2D RightB(-B.Forward.Y, B.Forward.X);
+	const FVector2D Delta = B.Center - A.Center;
+
+	// separating axis theorem, in 2D face normals of both boxes are the only candidate axes
+	const FVector2D Axes[] = { A.Forward, RightA, B.Forward, RightB };
+	for (const FVector2D& Axis : Axes)
+	{
+		const float RadiusA = A.Extent.X * FMath::Abs(A.Forward | Axis) + A.Extent.Y * FMath::Abs(RightA | Axis);
+		const float RadiusB = B.Extent.X * FMath::Abs(B.Forward | Axis) + B.Extent.Y * FMath::Abs(RightB | Axis);
+		if (FMath::Abs(Delta | Axis) > RadiusA + RadiusB)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void UETW_MassSquadEngagementProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	check(SquadSubsystem);
+	QUICK_SCOPE_CYCLE_COUNTER(UETW_MassSquadEngagementProcessor_Execute);
+
+	Entries.Reset();
+	Pairs.Reset();
+
+	EntityQuery_Squad.ForEachEntityChunk(EntityManager, Context, [this](FMassExecutionContext& Context)
+	{
+		const FETW_MassSquadSharedFragment& SquadSharedFragment = Context.GetSharedFragment<FETW_MassSquadSharedFragment>();
+		const FETW_MassSquadParams& SquadParams = Context.GetConstSharedFragment<FETW_MassSquadParams>();
+		const TConstArrayView<FETW_MassSquadAggregateFragment> AggregateFragments = Context.GetFragmentView<FETW_MassSquadAggregateFragment>();
+		const TConstArrayView<FETW_MassTeamFragment> TeamFragments = Context.GetFragmentView<FETW_MassTeamFragment>();
+
+		const float Margin = SquadParams.EngageRange * 0.5f;
+
+		for (int32 EntityIdx = 0; EntityIdx < Context.GetNumEntities(); EntityIdx++)
+		{
+			const FETW_MassSquadAggregateFragment& Aggregate = AggregateFragments[EntityIdx];
+			if (Aggregate.AliveCount == 0 || SquadSharedFragment.SquadIndex == UE::Mass::Squad::InvalidSquadIndex)
+			{
+				continue;
+			}
+
+			UE::Mass::Squad::FSquadBroadphaseEntry& Entry = Entries.AddDefaulted_GetRef();
+			Entry.SquadIndex = SquadSharedFragment.SquadIndex;
+			Entry.TeamIndex = TeamFragments[EntityIdx].TeamIndex;
+			Entry.Center = FVector2D(Aggregate.BoundsCenter);
+			Entry.Forward = FVector2D(Aggregate.Forward).GetSafeNormal();
+			Entry.Extent = Aggregate.BoundsExtent + FVector2D(Margin);
+
+			const FVector2D Right(-Entry.Forward.Y, Entry.Forward.X);
+			const FVector2D HalfSize(
+				Entry.Extent.X * FMath::Abs(Entry.Forward.X) + Entry.Extent.Y * FMath::Abs(Right.X),
+				Entry.Extent.X * FMath::Abs(Entry.Forward.Y) + Entry.Extent.Y * FMath::Abs(Right.Y));
+			Entry.Min = Entry.Center - HalfSize;
+			Entry.Max = Entry.Center + HalfSize;
+		}
+	});
+
+	// sweep and prune along X, only squads which X intervals overlap reach the OBB test
+	Entries.Sort([](const UE::Mass::Squad::FSquadBroadphaseEntry& A, const UE::Mass::Squad::FSquadBroadphaseEntry& B)
+	{
+		return A.Min.X < B.Min.X;
+	});
+
+	for (int32 I = 0; I < Entries.Num(); I++)
+	{
+		const UE::Mass::Squad::FSquadBroadphaseEntry& A = Entries[I];
+		for (int32 J = I + 1; J < Entries.Num() && Entries[J].Min.X <= A.Max.X; J++)
+		{
+			const UE::Mass::Squad::FSquadBroadphaseEntry& B = Entries[J];
+			if (A.TeamIndex == B.TeamIndex || A.Min.Y > B.Max.Y || B.Min.Y > A.Max.Y)
+			{
+				continue;
+			}
+
+			if (TestOverlap(A, B))
+			{
+				Pairs.Add({ FMath::Min(A.SquadIndex, B.SquadIndex), FMath::Max(A.SquadIndex, B.SquadIndex) });
+			}
+		}
+	}
+
+	SquadSubsystem->GetMutableEngagements().Build(Pairs);
+}
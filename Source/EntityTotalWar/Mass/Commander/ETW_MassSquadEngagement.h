@@ -0,0 +1,83 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "ETW_MassSquadFragments.h"
+#include "MassProcessor.h"
+#include "ETW_MassSquadEngagement.generated.h"
+
+/** Pair of enemy squads in contact, SquadA < SquadB */
+struct FETW_MassSquadEngagementPair
+{
+	uint32 SquadA = UE::Mass::Squad::InvalidSquadIndex;
+	uint32 SquadB = UE::Mass::Squad::InvalidSquadIndex;
+};
+
+/**
+ * Engaged squads of current frame, rebuilt by UETW_MassSquadEngagementProcessor.
+ * Unit level targeting should only look at units of engaged squads, read it from processors ordered after the broadphase.
+ */
+struct ENTITYTOTALWAR_API FETW_MassSquadEngagements
+{
+	// enemy squads in contact with squad, empty if squad is not engaged
+	TConstArrayView<uint32> GetEngagedSquads(const uint32 SquadIndex) const;
+	bool IsEngaged(const uint32 SquadIndex) const { return !GetEngagedSquads(SquadIndex).IsEmpty(); }
+	TConstArrayView<FETW_MassSquadEngagementPair> GetPairs() const { return Pairs; }
+
+	void Build(TConstArrayView<FETW_MassSquadEngagementPair> InPairs);
+	void Reset();
+
+private:
+	TArray<FETW_MassSquadEngagementPair> Pairs;
+
+	// flat adjacency: engaged squads of squad index are EngagedSquads[SquadRangeStart[Index], SquadRangeStart[Index + 1])
+	TArray<int32> SquadRangeStart;
+	TArray<uint32> EngagedSquads;
+};
+
+namespace UE::Mass::Squad
+{
+	/** Squad bounds prepared for sweep and prune, OBB half extents already include half of engage range */
+	struct FSquadBroadphaseEntry
+	{
+		uint32 SquadIndex = InvalidSquadIndex;
+		int8 TeamIndex = 0;
+		FVector2D Center = FVector2D::ZeroVector;
+		FVector2D Forward = FVector2D(1.f, 0.f);
+		FVector2D Extent = FVector2D::ZeroVector;
+
+		// world AABB of the OBB
+		FVector2D Min = FVector2D::ZeroVector;
+		FVector2D Max = FVector2D::ZeroVector;
+	};
+}
+
+/**
+ * Squad vs squad broadphase.
+ * Sweep and prune over squad bounds along X, then separating axis test on squad OBBs for enemy pairs.
+ * Keeps unit targeting from going over every unit of every enemy squad.
+ */
+UCLASS()
+class ENTITYTOTALWAR_API UETW_MassSquadEngagementProcessor : public UMassProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UETW_MassSquadEngagementProcessor();
+
+	static bool TestOverlap(const UE::Mass::Squad::FSquadBroadphaseEntry& A, const UE::Mass::Squad::FSquadBroadphaseEntry& B);
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Initialize(UObject& Owner) override;
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+
+	FMassEntityQuery EntityQuery_Squad;
+
+	UPROPERTY(Transient)
+	TObjectPtr<class UETW_MassSquadSubsystem> SquadSubsystem = nullptr;
+
+	// kept between frames to avoid allocations
+	TArray<UE::Mass::Squad::FSquadBroadphaseEntry> Entries;
+	TArray<FETW_MassSquadEngagementPair> Pairs;
+};
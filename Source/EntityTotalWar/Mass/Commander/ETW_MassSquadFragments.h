@@ -4,8 +4,14 @@
 
 #include "ETW_MassTypes.h"
 #include "MassEntityConfigAsset.h"
+#include "Mass/Navigation/ETW_MassNavigationTypes.h"
 #include "ETW_MassSquadFragments.generated.h"
 
+namespace UE::Mass::Squad
+{
+	// squad ids are generated starting from 1, zero means "no squad" (also default TargetSquadIndex)
+	constexpr uint32 InvalidSquadIndex = 0;
+}
 
 USTRUCT()
 struct FMassSquadUnitsSpawnAuxData
@@ -15,6 +21,9 @@ struct FMassSquadUnitsSpawnAuxData
 	TWeakObjectPtr<class UMassCommanderComponent> CommanderComp;
 	int8 TeamIndex;
 	FTransform SquadInitialTransform;
+
+	// placement of every spawned squad by squad index, centered on its generated units. SquadInitialTransform if missing
+	TMap<uint32, FTransform> SquadTransforms;
 };
 
 USTRUCT()
@@ -23,6 +32,12 @@ struct ENTITYTOTALWAR_API FETW_MassUnitFragment : public FMassFragment
 	GENERATED_BODY()
 
 	uint32 UnitIndex;
+
+	// slot in squad formation layout, see FETW_MassFormationSolver
+	int32 SlotIndex = INDEX_NONE;
+
+	// slot position in squad local space, X - forward, Y - right
+	FVector2D FormationOffset = FVector2D::ZeroVector;
 };
 
 USTRUCT()
@@ -123,21 +138,125 @@ struct FETW_MassSquadCommanderFragment : public FObjectWrapperFragment
 	}
 };
 
+/** Squad identity shared by squad entity and its units, changes only on squad orders (formation change), never per frame */
 USTRUCT()
 struct ENTITYTOTALWAR_API FETW_MassSquadSharedFragment : public FMassSharedFragment
 {
 	GENERATED_BODY()
 
 	uint32 SquadIndex = 0;
-	uint32 TargetSquadIndex = 0;
-
-	uint32 CentralUnitId = 0;
-	FVector CentralUnitLocation = FVector::ZeroVector;
-	FVector CentralUnitTargetLocation = FVector::ZeroVector;
 
 	FETW_MassFormation Formation;
 };
 
+/** Dynamic squad state, lives on squad entity so it can be written per frame without shared fragment contention */
+USTRUCT()
+struct ENTITYTOTALWAR_API FETW_MassSquadStateFragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	uint32 TargetSquadIndex = UE::Mass::Squad::InvalidSquadIndex;
+};
+
+
+/** Per squad values reduced from all squad units each frame by UETW_MassSquadProcessor, read it instead of iterating units */
+USTRUCT()
+struct ENTITYTOTALWAR_API FETW_MassSquadAggregateFragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	FVector Centroid = FVector::ZeroVector;
+	FVector AverageVelocity = FVector::ZeroVector;
+	FVector AverageTargetLocation = FVector::ZeroVector;
+
+	// oriented bounding box in XY plane, X axis is squad facing
+	FVector Forward = FVector::ForwardVector;
+	FVector BoundsCenter = FVector::ZeroVector;
+	FVector2D BoundsExtent = FVector2D::ZeroVector;
+
+	// lateral extents of the first rank relative to BoundsCenter along right axis, X - left (negative), Y - right
+	FVector2D FrontLineExtents = FVector2D::ZeroVector;
+
+	int32 AliveCount = 0;
+
+	// max speed of the slowest unit, formation should not move faster than that
+	float MaxSpeed = MAX_flt;
+
+	FVector GetRight() const { return FVector(-Forward.Y, Forward.X, 0.f); }
+	FQuat GetFacingQuat() const { return FRotationMatrix::MakeFromX(Forward).ToQuat(); }
+};
+
+
+UENUM()
+enum class EETW_MassSquadMoveState : uint8
+{
+	Idle,		// no move order, units are not driven by squad
+	Moving,		// anchor travels along squad path
+	Holding,	// path finished, units keep formation around anchor
+	WaitingForPath	// async path requested, anchor waits in place until path is committed
+};
+
+/** Squad level movement: one navmesh path for whole squad, units follow formation slots around moving anchor */
+USTRUCT()
+struct ENTITYTOTALWAR_API FETW_MassSquadMoveFragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	FVector Destination = FVector::ZeroVector;
+	FVector AnchorLocation = FVector::ZeroVector;
+	FVector AnchorForward = FVector::ForwardVector;
+	EETW_MassSquadMoveState State = EETW_MassSquadMoveState::Idle;
+	bool bMoveRequested = false;
+
+	// idle squad walks units to slots reassigned after casualties, anchor keeps squad placement and facing until next order
+	bool bReformRanks = false;
+};
+
+/** Per unit formation following state */
+USTRUCT()
+struct ENTITYTOTALWAR_API FETW_MassFormationFollowFragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	// last slot location checked against navmesh, slot is revalidated when it moves further than slot spacing
+	FVector ValidatedSlotLocation = FVector(MAX_flt);
+	bool bSlotBlocked = false;
+};
+
+/** Squad LOD state, statistical simulation values used while squad is dormant */
+USTRUCT()
+struct ENTITYTOTALWAR_API FETW_MassSquadLODFragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	// fractional alive count, casualties are taken from it and materialized as whole units
+	float Strength = 0.f;
+
+	// unit entities still alive, Strength rounded up never exceeds it
+	int32 UnitCount = 0;
+};
+
+/** Squad is far from every viewer, squad entity is simulated alone and its units are parked */
+USTRUCT()
+struct FETW_MassSquadDormantTag : public FMassTag
+{
+	GENERATED_BODY()
+};
+
+/** Unit of dormant squad, skipped by squad unit processors until squad is rehydrated */
+USTRUCT()
+struct FETW_MassSquadUnitDormantTag : public FMassTag
+{
+	GENERATED_BODY()
+};
+
+/** Unit's formation slot is blocked, unit follows its own path until slot is reachable again */
+USTRUCT()
+struct FETW_MassSquadUnitDetachedTag : public FMassTag
+{
+	GENERATED_BODY()
+};
+
 
 USTRUCT(BlueprintType)
 struct ENTITYTOTALWAR_API FETW_MassSquadParams : public FMassSharedFragment
@@ -179,4 +298,24 @@ struct ENTITYTOTALWAR_API FETW_MassSquadParams : public FMassSharedFragment
 	UPROPERTY(EditAnywhere)
 	float CatchupSpeedFactor = 1.1f;
 
+	// squads which bounds are closer than that are engaged
+	UPROPERTY(EditAnywhere, meta=(Units="Centimeters"))
+	float EngageRange = 150.f;
+
+	// squad further than that from every viewer goes dormant
+	UPROPERTY(EditAnywhere, meta=(Units="Centimeters"))
+	float DormantDistance = 20000.f;
+
+	// dormant squad closer than that to any viewer is rehydrated, smaller than DormantDistance for hysteresis
+	UPROPERTY(EditAnywhere, meta=(Units="Centimeters"))
+	float WakeDistance = 16000.f;
+
+	// casualties per second one unit of this squad inflicts on engaged dormant squad (Lanchester square law)
+	UPROPERTY(EditAnywhere)
+	float Lethality = 0.02f;
+
+	// used for squad path request and slot navmesh checks
+	UPROPERTY(EditAnywhere)
+	FMassPathFollowParams PathParams;
+
 };
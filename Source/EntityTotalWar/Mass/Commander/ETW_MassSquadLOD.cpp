@@ -0,0 +1,311 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ETW_MassSquadLOD.h"
+#include "ETW_MassSquadEngagement.h"
+#include "ETW_MassSquadMovement.h"
+#include "ETW_MassSquadSubsystem.h"
+
+#include "MassCommandBuffer.h"
+#include "MassEntityView.h"
+#include "MassExecutionContext.h"
+#include "MassLODSubsystem.h"
+#include "MassRepresentationFragments.h"
+#include "MassRepresentationTypes.h"
+#include "MassSimulationLOD.h"
+
+UETW_MassSquadLODProcessor::UETW_MassSquadLODProcessor()
+	: EntityQuery_Squad(*this)
+{
+	bAutoRegisterWithProcessingPhases = true;
+	ExecutionFlags = (int32)(EProcessorExecutionFlags::Server | EProcessorExecutionFlags::Standalone);
+	ExecutionOrder.ExecuteInGroup = UE::Mass::ProcessorGroupNames::Tasks;
+	ExecutionOrder.ExecuteAfter.Add(UETW_MassSquadFormationMoveProcessor::StaticClass()->GetFName());
+	ExecutionOrder.ExecuteAfter.Add(UETW_MassSquadEngagementProcessor::StaticClass()->GetFName());
+}
+
+void UETW_MassSquadLODProcessor::ConfigureQueries()
+{
+	EntityQuery_Squad.AddRequirement<FETW_MassSquadLODFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Squad.AddRequirement<FETW_MassSquadAggregateFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Squad.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Squad.AddRequirement<FETW_MassSquadMoveFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Squad.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Squad.AddConstSharedRequirement<FETW_MassSquadParams>();
+}
+
+void UETW_MassSquadLODProcessor::Initialize(UObject& Owner)
+{
+	Super::Initialize(Owner);
+
+	SquadSubsystem = UWorld::GetSubsystem<UETW_MassSquadSubsystem>(Owner.GetWorld());
+	LODSubsystem = UWorld::GetSubsystem<UMassLODSubsystem>(Owner.GetWorld());
+	check(SquadSubsystem);
+}
+
+void UETW_MassSquadLODProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	check(SquadSubsystem);
+	QUICK_SCOPE_CYCLE_COUNTER(UETW_MassSquadLODProcessor_Execute);
+
+	ViewerLocations.Reset();
+	if (LODSubsystem)
+	{
+		for (const FViewerInfo& Viewer : LODSubsystem->GetViewers())
+		{
+			if (Viewer.Handle.IsValid())
+			{
+				ViewerLocations.Add(Viewer.Location);
+			}
+		}
+	}
+
+	EntityQuery_Squad.ForEachEntityChunk(EntityManager, Context, [this, &EntityManager](FMassExecutionContext& Context)
+	{
+		const FETW_MassSquadSharedFragment& SquadSharedFragment = Context.GetSharedFragment<FETW_MassSquadSharedFragment>();
+		const FETW_MassSquadParams& SquadParams = Context.GetConstSharedFragment<FETW_MassSquadParams>();
+		const bool bDormantChunk = Context.DoesArchetypeHaveTag<FETW_MassSquadDormantTag>();
+
+		const TArrayView<FETW_MassSquadLODFragment> LODFragments = Context.GetMutableFragmentView<FETW_MassSquadLODFragment>();
+		const TArrayView<FETW_MassSquadAggregateFragment> AggregateFragments = Context.GetMutableFragmentView<FETW_MassSquadAggregateFragment>();
+		const TArrayView<FTransformFragment> TransformFragments = Context.GetMutableFragmentView<FTransformFragment>();
+		const TConstArrayView<FETW_MassSquadMoveFragment> MoveFragments = Context.GetFragmentView<FETW_MassSquadMoveFragment>();
+
+		const uint32 SquadIndex = SquadSharedFragment.SquadIndex;
+
+		for (int32 EntityIdx = 0; EntityIdx < Context.GetNumEntities(); EntityIdx++)
+		{
+			FETW_MassSquadLODFragment& LOD = LODFragments[EntityIdx];
+			FETW_MassSquadAggregateFragment& Aggregate = AggregateFragments[EntityIdx];
+			const FMassEntityHandle SquadEntity = Context.GetEntity(EntityIdx);
+
+			// no viewer at all, e.g. dedicated server without players, keeps every squad fully simulated
+			float MinViewerDistSq = ViewerLocations.IsEmpty() ? 0.f : MAX_flt;
+			for (const FVector& ViewerLocation : ViewerLocations)
+			{
+				MinViewerDistSq = FMath::Min(MinViewerDistSq, FVector::DistSquared2D(ViewerLocation, Aggregate.BoundsCenter));
+			}
+
+			if (!bDormantChunk)
+			{
+				// full simulation, squad processor keeps aggregate up to date, only losses dealt by dormant enemies are statistical
+				const float LossRate = GetLossRate(EntityManager, SquadIndex, true);
+				if (LossRate > 0.f)
+				{
+					// aggregate lags destroyed units by a frame, unit count doesn't
+					LOD.UnitCount = FMath::Min(LOD.UnitCount, Aggregate.AliveCount);
+					LOD.Strength = FMath::Max(FMath::Min(LOD.Strength, (float)LOD.UnitCount) - LossRate * Context.GetDeltaTimeSeconds(), 0.f);
+
+					const int32 AliveCount = FMath::CeilToInt(LOD.Strength);
+					if (AliveCount < LOD.UnitCount)
+					{
+						LOD.UnitCount -= MaterializeCasualties(Context, SquadIndex, LOD.UnitCount - AliveCount);
+					}
+				}
+				else
+				{
+					LOD.Strength = Aggregate.AliveCount;
+					LOD.UnitCount = Aggregate.AliveCount;
+				}
+
+				if (Aggregate.AliveCount > 0 && MinViewerDistSq > FMath::Square(SquadParams.DormantDistance))
+				{
+					Dehydrate(Context, SquadEntity, SquadIndex);
+				}
+				continue;
+			}
+
+			// statistical combat against every engaged enemy
+			const float LossRate = GetLossRate(EntityManager, SquadIndex, false);
+			LOD.Strength = FMath::Max(LOD.Strength - LossRate * Context.GetDeltaTimeSeconds(), 0.f);
+
+			const int32 AliveCount = FMath::Min(FMath::CeilToInt(LOD.Strength), LOD.UnitCount);
+			if (AliveCount < LOD.UnitCount)
+			{
+				LOD.UnitCount -= MaterializeCasualties(Context, SquadIndex, LOD.UnitCount - AliveCount);
+			}
+			Aggregate.AliveCount = AliveCount;
+			Aggregate.AverageVelocity = FVector::ZeroVector;
+
+			// squad entity alone follows squad path, units are not there to lag behind
+			const FETW_MassSquadMoveFragment& Move = MoveFragments[EntityIdx];
+			if (Move.State != EETW_MassSquadMoveState::Idle)
+			{
+				Aggregate.AverageVelocity = (Move.AnchorLocation - Aggregate.Centroid) / FMath::Max(Context.GetDeltaTimeSeconds(), KINDA_SMALL_NUMBER);
+				Aggregate.Centroid = Move.AnchorLocation;
+				Aggregate.BoundsCenter = Move.AnchorLocation;
+				Aggregate.Forward = Move.AnchorForward;
+				Aggregate.AverageTargetLocation = Move.Destination;
+			}
+
+			FTransform& Transform = TransformFragments[EntityIdx].GetMutableTransform();
+			Transform.SetLocation(Aggregate.Centroid);
+			Transform.SetRotation(Aggregate.GetFacingQuat());
+
+			if (AliveCount > 0 && MinViewerDistSq < FMath::Square(SquadParams.WakeDistance))
+			{
+				Rehydrate(Context, SquadEntity, SquadIndex, Aggregate.BoundsCenter, Aggregate.Forward);
+			}
+		}
+	});
+}
+
+float UETW_MassSquadLODProcessor::GetLossRate(const FMassEntityManager& EntityManager, const uint32 SquadIndex, const bool bDormantEnemiesOnly) const
+{
+	const FETW_MassSquadEngagements& Engagements = SquadSubsystem->GetEngagements();
+	const FETW_MassSquadRegistry& Registry = SquadSubsystem->GetSquadManager().GetRegistry();
+
+	// Lanchester square law: losses are proportional to engaged enemy strength
+	float LossRate = 0.f;
+	for (const uint32 EnemySquadIndex : Engagements.GetEngagedSquads(SquadIndex))
+	{
+		const FMassEntityHandle EnemySquadEntity = Registry.GetSquadEntity(EnemySquadIndex);
+		if (!EntityManager.IsEntityValid(EnemySquadEntity))
+		{
+			continue;
+		}
+
+		const FMassEntityView EnemyView(EntityManager, EnemySquadEntity);
+		if (bDormantEnemiesOnly && !EnemyView.HasTag<FETW_MassSquadDormantTag>())
+		{
+			// both sides have units, they fight for real
+			continue;
+		}
+
+		const FETW_MassSquadAggregateFragment* EnemyAggregate = EnemyView.GetFragmentDataPtr<FETW_MassSquadAggregateFragment>();
+		const FETW_MassSquadParams* EnemyParams = EnemyView.GetConstSharedFragmentDataPtr<FETW_MassSquadParams>();
+		if (EnemyAggregate && EnemyParams)
+		{
+			LossRate += EnemyAggregate->AliveCount * EnemyParams->Lethality;
+		}
+	}
+	return LossRate;
+}
+
+void UETW_MassSquadLODProcessor::Dehydrate(FMassExecutionContext& Context, const FMassEntityHandle SquadEntity, const uint32 SquadIndex) const
+{
+	const FMassEntityManager& EntityManager = Context.GetEntityManagerChecked();
+	const FETW_MassSquadRegistry& Registry = SquadSubsystem->GetSquadManager().GetRegistry();
+
+	// tags move units to their own archetype, chunks of it aren't touched by movement, avoidance and squad unit processors
+	TArray<FMassEntityHandle> VisualizedUnits;
+	for (const FMassEntityHandle Unit : Registry.GetSquadUnits(SquadIndex))
+	{
+		if (EntityManager.IsEntityValid(Unit))
+		{
+			Context.Defer().AddTag<FETW_MassSquadUnitDormantTag>(Unit);
+			Context.Defer().AddTag<FMassOffLODTag>(Unit);
+
+			// visualization processor doesn't look at off LOD tag, it has its own
+			if (FMassEntityView(EntityManager, Unit).HasTag<FMassVisualizationProcessorTag>())
+			{
+				Context.Defer().RemoveTag<FMassVisualizationProcessorTag>(Unit);
+				VisualizedUnits.Add(Unit);
+			}
+		}
+	}
+	Context.Defer().AddTag<FETW_MassSquadDormantTag>(SquadEntity);
+
+	// nothing updates representation of parked units anymore, drop their instances instead of leaving them frozen
+	Context.Defer().PushCommand<FMassDeferredSetCommand>([Units = MoveTemp(VisualizedUnits)](FMassEntityManager& Manager)
+	{
+		for (const FMassEntityHandle Unit : Units)
+		{
+			if (!Manager.IsEntityValid(Unit))
+			{
+				continue;
+			}
+
+			if (FMassRepresentationFragment* Representation = FMassEntityView(Manager, Unit).GetFragmentDataPtr<FMassRepresentationFragment>())
+			{
+				Representation->PrevRepresentation = Representation->CurrentRepresentation;
+				Representation->CurrentRepresentation = EMassRepresentationType::None;
+			}
+		}
+	});
+}
+
+void UETW_MassSquadLODProcessor::Rehydrate(FMassExecutionContext& Context, const FMassEntityHandle SquadEntity, const uint32 SquadIndex, const FVector& Origin, const FVector& Forward) const
+{
+	const FMassEntityManager& EntityManager = Context.GetEntityManagerChecked();
+	const FETW_MassSquadRegistry& Registry = SquadSubsystem->GetSquadManager().GetRegistry();
+
+	TArray<FMassEntityHandle> Units;
+	for (const FMassEntityHandle Unit : Registry.GetSquadUnits(SquadIndex))
+	{
+		if (EntityManager.IsEntityValid(Unit))
+		{
+			Context.Defer().RemoveTag<FETW_MassSquadUnitDormantTag>(Unit);
+			Context.Defer().RemoveTag<FMassOffLODTag>(Unit);
+			if (FMassEntityView(EntityManager, Unit).GetFragmentDataPtr<FMassRepresentationFragment>())
+			{
+				Context.Defer().AddTag<FMassVisualizationProcessorTag>(Unit);
+			}
+			Units.Add(Unit);
+		}
+	}
+	Context.Defer().RemoveTag<FETW_MassSquadDormantTag>(SquadEntity);
+
+	// units were parked where squad went dormant, put them to their slots around current squad location
+	Context.Defer().PushCommand<FMassDeferredSetCommand>([Units = MoveTemp(Units), Origin, Forward](FMassEntityManager& Manager)
+	{
+		const FVector Right(-Forward.Y, Forward.X, 0.f);
+		for (const FMassEntityHandle Unit : Units)
+		{
+			if (!Manager.IsEntityValid(Unit))
+			{
+				continue;
+			}
+
+			const FMassEntityView UnitView(Manager, Unit);
+			const FETW_MassUnitFragment* UnitFragment = UnitView.GetFragmentDataPtr<FETW_MassUnitFragment>();
+			FTransformFragment* TransformFragment = UnitView.GetFragmentDataPtr<FTransformFragment>();
+			FMassTargetLocationFragment* TargetLocation = UnitView.GetFragmentDataPtr<FMassTargetLocationFragment>();
+			if (!UnitFragment || !TransformFragment || !TargetLocation)
+			{
+				continue;
+			}
+
+			const FVector SlotLocation = Origin + Forward * UnitFragment->FormationOffset.X + Right * UnitFragment->FormationOffset.Y;
+			TransformFragment->GetMutableTransform().SetLocation(SlotLocation);
+			TargetLocation->Target = SlotLocation;
+			if (FETW_MassFormationFollowFragment* Follow = UnitView.GetFragmentDataPtr<FETW_MassFormationFollowFragment>())
+			{
+				// slot has to be checked against navmesh again
+				*Follow = FETW_MassFormationFollowFragment();
+			}
+		}
+	});
+}
+
+int32 UETW_MassSquadLODProcessor::MaterializeCasualties(FMassExecutionContext& Context, const uint32 SquadIndex, const int32 NumToRemove) const
+{
+	const FMassEntityManager& EntityManager = Context.GetEntityManagerChecked();
+	const FETW_MassSquadRegistry& Registry = SquadSubsystem->GetSquadManager().GetRegistry();
+
+	TArray<TPair<int32, FMassEntityHandle>, TInlineAllocator<64>> Candidates;
+	for (const FMassEntityHandle Unit : Registry.GetSquadUnits(SquadIndex))
+	{
+		if (EntityManager.IsEntityValid(Unit))
+		{
+			Candidates.Emplace(Registry.GetUnitFormationSlot(Unit), Unit);
+		}
+	}
+
+	// rear ranks fall first, removal observer closes ranks for the rest
+	const int32 NumRemoved = FMath::Min(NumToRemove, Candidates.Num());
+	Candidates.Sort([](const TPair<int32, FMassEntityHandle>& A, const TPair<int32, FMassEntityHandle>& B)
+	{
+		return A.Key > B.Key;
+	});
+
+	TArray<FMassEntityHandle> Casualties;
+	Casualties.Reserve(NumRemoved);
+	for (int32 Idx = 0; Idx < NumRemoved; Idx++)
+	{
+		Casualties.Add(Candidates[Idx].Value);
+	}
+	Context.Defer().DestroyEntities(Casualties);
+
+	return NumRemoved;
+}
@@ -0,0 +1,48 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "ETW_MassSquadFragments.h"
+#include "MassProcessor.h"
+#include "ETW_MassSquadLOD.generated.h"
+
+/**
+ * Hierarchical squad LOD.
+ * Squad far from every viewer goes dormant: its units are parked with dormant and off LOD tags and lose their visualization
+ * tag, so squad, movement, avoidance and representation processors skip them, and squad entity alone moves along squad
+ * path and takes statistical casualties. Without any viewer nothing goes dormant.
+ * Statistical losses are symmetric, squad engaged with dormant enemy takes them too, even when it is simulated in full.
+ * When a viewer comes close units are rehydrated into their formation slots around squad anchor.
+ */
+UCLASS()
+class ENTITYTOTALWAR_API UETW_MassSquadLODProcessor : public UMassProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UETW_MassSquadLODProcessor();
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Initialize(UObject& Owner) override;
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+
+	void Dehydrate(FMassExecutionContext& Context, const FMassEntityHandle SquadEntity, const uint32 SquadIndex) const;
+	void Rehydrate(FMassExecutionContext& Context, const FMassEntityHandle SquadEntity, const uint32 SquadIndex, const FVector& Origin, const FVector& Forward) const;
+
+	// Lanchester square law loss rate of squad from engaged enemies, dormant ones only when squad itself is simulated in full
+	float GetLossRate(const FMassEntityManager& EntityManager, const uint32 SquadIndex, const bool bDormantEnemiesOnly) const;
+
+	// destroys rear rank units until squad has NumToRemove less units, returns number of destroyed units
+	int32 MaterializeCasualties(FMassExecutionContext& Context, const uint32 SquadIndex, const int32 NumToRemove) const;
+
+	FMassEntityQuery EntityQuery_Squad;
+
+	UPROPERTY(Transient)
+	TObjectPtr<class UETW_MassSquadSubsystem> SquadSubsystem = nullptr;
+
+	UPROPERTY(Transient)
+	TObjectPtr<class UMassLODSubsystem> LODSubsystem = nullptr;
+
+	TArray<FVector> ViewerLocations;
+};
@@ -0,0 +1,514 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ETW_MassSquadMovement.h"
+#include "ETW_MassFormation.h"
+#include "ETW_MassSquadProcessors.h"
+#include "ETW_MassSquadSubsystem.h"
+
+#include "MassCommandBuffer.h"
+#include "MassExecutionContext.h"
+#include "MassMovementFragments.h"
+#include "MassNavigationFragments.h"
+#include "NavigationSystem.h"
+#include "Mass/Navigation/ETW_MassFlowField.h"
+#include "Mass/Navigation/ETW_MassNavigationSubsystem.h"
+#include "Mass/Navigation/ETW_MassPathFollowing.h"
+
+namespace UE::Mass::Squad
+{
+	// unit one slot spacing ahead of its slot slows down to that fraction of squad speed
+	constexpr float MinSpeedScale = 0.5f;
+
+	// unit moving by flow field falls in to its slot that many slot spacings away from it
+	constexpr float FlowFieldJoinSlots = 3.f;
+
+	// squad anchor and detached units follow their paths point by point, corridor portals would never be read
+	static FMassPathFollowParams GetPointByPointPathParams(const FETW_MassSquadParams& SquadParams)
+	{
+		FMassPathFollowParams PathParams = SquadParams.PathParams;
+		PathParams.bSteerAlongCorridor = false;
+		return PathParams;
+	}
+}
+
+UETW_MassSquadFormationMoveProcessor::UETW_MassSquadFormationMoveProcessor()
+	: EntityQuery_Squad(*this), EntityQuery_Unit(*this)
+{
+	bAutoRegisterWithProcessingPhases = true;
+	ExecutionFlags = (int32)(EProcessorExecutionFlags::Server | EProcessorExecutionFlags::Standalone);
+	ExecutionOrder.ExecuteInGroup = UE::Mass::ProcessorGroupNames::Tasks;
+	ExecutionOrder.ExecuteAfter.Add(UETW_MassSquadProcessor::StaticClass()->GetFName());
+	ExecutionOrder.ExecuteAfter.Add(UETW_MassPathRequestProcessor::StaticClass()->GetFName());
+	ExecutionOrder.ExecuteBefore.Add(UE::Mass::ProcessorGroupNames::Avoidance);
+
+	// slot navmesh checks
+	bRequiresGameThreadExecution = true;
+}
+
+void UETW_MassSquadFormationMoveProcessor::ConfigureQueries()
+{
+	EntityQuery_Squad.AddRequirement<FETW_MassSquadMoveFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Squad.AddRequirement<FMassPathFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Squad.AddRequirement<FMassTargetLocationFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Squad.AddRequirement<FETW_MassSquadAggregateFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Squad.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Squad.AddConstSharedRequirement<FETW_MassSquadParams>();
+	EntityQuery_Squad.AddSubsystemRequirement<UETW_MassNavigationSubsystem>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Squad.AddSubsystemRequirement<UETW_MassSquadSubsystem>(EMassFragmentAccess::ReadOnly);
+
+	EntityQuery_Unit.AddRequirement<FETW_MassUnitFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Unit.AddRequirement<FETW_MassFormationFollowFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Unit.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Unit.AddRequirement<FMassMoveTargetFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Unit.AddRequirement<FMassTargetLocationFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Unit.AddRequirement<FMassPathFragment>(EMassFragmentAccess::ReadWrite, EMassFragmentPresence::Optional);
+	EntityQuery_Unit.AddRequirement<FETW_MassFlowFieldFragment>(EMassFragmentAccess::ReadWrite, EMassFragmentPresence::Optional);
+	EntityQuery_Unit.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Unit.AddConstSharedRequirement<FETW_MassSquadParams>();
+	EntityQuery_Unit.AddTagRequirement<FETW_MassSquadUnitDormantTag>(EMassFragmentPresence::None);
+	EntityQuery_Unit.AddSubsystemRequirement<UETW_MassNavigationSubsystem>(EMassFragmentAccess::ReadWrite);
+}
+
+void UETW_MassSquadFormationMoveProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	UWorld* World = EntityManager.GetWorld();
+	check(World);
+
+	SquadAnchors.Reset();
+
+	// squad pass, path request and anchor advancement, few entities so sequential
+	{
+		QUICK_SCOPE_CYCLE_COUNTER(UETW_MassSquadFormationMoveProcessor_EntityQuery_Squad);
+		EntityQuery_Squad.ForEachEntityChunk(EntityManager, Context, [this, World, &EntityManager](FMassExecutionContext& Context)
+		{
+			const FETW_MassSquadSharedFragment& SquadSharedFragment = Context.GetSharedFragment<FETW_MassSquadSharedFragment>();
+			const FETW_MassSquadParams& SquadParams = Context.GetConstSharedFragment<FETW_MassSquadParams>();
+			UETW_MassNavigationSubsystem* NavigationSubsystem = Context.GetMutableSubsystem<UETW_MassNavigationSubsystem>();
+
+			// dormant squad has no units moving, it walks squad path alone
+			const bool bDormantChunk = Context.DoesArchetypeHaveTag<FETW_MassSquadDormantTag>();
+
+			const TArrayView<FETW_MassSquadMoveFragment> MoveFragments = Context.GetMutableFragmentView<FETW_MassSquadMoveFragment>();
+			const TArrayView<FMassPathFragment> PathFragments = Context.GetMutableFragmentView<FMassPathFragment>();
+			const TArrayView<FMassTargetLocationFragment> TargetLocationFragments = Context.GetMutableFragmentView<FMassTargetLocationFragment>();
+			const TConstArrayView<FETW_MassSquadAggregateFragment> AggregateFragments = Context.GetFragmentView<FETW_MassSquadAggregateFragment>();
+
+			const float SlotSpacing = FETW_MassFormationSolver::GetSlotSpacing(SquadSharedFragment.Formation, SquadParams);
+			const float FormationSpeed = FETW_MassFormationSolver::GetFormationSpeed(SquadSharedFragment.Formation, SquadParams);
+			const float SlackRadius = SquadParams.PathParams.SlackRadius;
+
+			for (int32 EntityIdx = 0; EntityIdx < Context.GetNumEntities(); EntityIdx++)
+			{
+				FETW_MassSquadMoveFragment& Move = MoveFragments[EntityIdx];
+				FMassPathFragment& PathFragment = PathFragments[EntityIdx];
+				const FETW_MassSquadAggregateFragment& Aggregate = AggregateFragments[EntityIdx];
+				const FMassEntityHandle SquadEntity = Context.GetEntity(EntityIdx);
+
+				if (Move.bMoveRequested)
+				{
+					Move.bMoveRequested = false;
+					Move.bReformRanks = false;
+					Move.AnchorLocation = Aggregate.AliveCount > 0 ? Aggregate.Centroid : Move.AnchorLocation;
+
+					if (!bDormantChunk && SetUnitsFlowFieldDestination(EntityManager, SquadSharedFragment.SquadIndex, SquadParams, Move.Destination))
+					{
+						// formation is formed at destination, units get there by shared flow field
+						const FVector ToDestination = Move.Destination - Move.AnchorLocation;
+						Move.AnchorForward = ToDestination.SizeSquared2D() > KINDA_SMALL_NUMBER ? ToDestination.GetSafeNormal2D() : Move.AnchorForward;
+						Move.AnchorLocation = Move.Destination;
+						NavigationSubsystem->FreePath(PathFragment);
+						Move.State = EETW_MassSquadMoveState::Holding;
+					}
+					else
+					{
+						// one path query for the whole squad, committed with its first point by UETW_MassPathRequestProcessor
+						NavigationSubsystem->EntityRequestNewPathAsync(SquadEntity, UE::Mass::Squad::GetPointByPointPathParams(SquadParams), Move.AnchorLocation, Move.Destination);
+						Move.State = EETW_MassSquadMoveState::WaitingForPath;
+					}
+				}
+
+				if (Move.State == EETW_MassSquadMoveState::WaitingForPath && !NavigationSubsystem->IsPathRequestPending(SquadEntity))
+				{
+					// failed query leaves no path
+					Move.State = NavigationSubsystem->HasPath(PathFragment) ? EETW_MassSquadMoveState::Moving : EETW_MassSquadMoveState::Idle;
+				}
+
+				if (Move.State == EETW_MassSquadMoveState::Idle && !Move.bReformRanks)
+				{
+					continue;
+				}
+
+				if (Move.State == EETW_MassSquadMoveState::Moving)
+				{
+					// don't run away from stragglers, slow down when units lag behind more than two ranks
+					const float Lag = Aggregate.AliveCount > 0 ? FVector::Dist2D(Aggregate.Centroid, Move.AnchorLocation) : 0.f;
+					const float LagScale = FMath::Clamp(1.f - (Lag - 2.f * SlotSpacing) / (2.f * SlotSpacing), 0.f, 1.f);
+					float StepLeft = FMath::Min(FormationSpeed, Aggregate.MaxSpeed) * LagScale * Context.GetDeltaTimeSeconds();
+
+					while (StepLeft > 0.f)
+					{
+						const FVector ToPathPoint = PathFragment.GetPathPoint() - Move.AnchorLocation;
+						const float DistToPathPoint = ToPathPoint.Size2D();
+						if (DistToPathPoint > KINDA_SMALL_NUMBER)
+						{
+							Move.AnchorForward = ToPathPoint.GetSafeNormal2D();
+						}
+
+						if (DistToPathPoint > StepLeft)
+						{
+							Move.AnchorLocation += ToPathPoint * (StepLeft / DistToPathPoint);
+							break;
+						}
+
+						Move.AnchorLocation = PathFragment.GetPathPoint();
+						StepLeft -= DistToPathPoint;
+						if (!NavigationSubsystem->ExtractNextPathPoint(PathFragment))
+						{
+							// hierarchical path continues with next segment, squad waits for it at segment end
+							const bool bNextSegment = NavigationSubsystem->RequestPathContinuation(SquadEntity, PathFragment) || NavigationSubsystem->IsPathRequestPending(SquadEntity);
+							Move.State = bNextSegment ? EETW_MassSquadMoveState::WaitingForPath : EETW_MassSquadMoveState::Holding;
+							break;
+						}
+
+						// next segment is requested on the last leg, so it's usually committed before anchor gets there
+						if (NavigationSubsystem->IsPathFinished(PathFragment))
+						{
+							NavigationSubsystem->RequestPathContinuation(SquadEntity, PathFragment);
+						}
+					}
+				}
+
+				if (Move.State != EETW_MassSquadMoveState::Idle)
+				{
+					TargetLocationFragments[EntityIdx].Target = Move.Destination;
+				}
+
+				UE::Mass::Squad::FSquadMoveAnchor& Anchor = SquadAnchors.Add(SquadSharedFragment.SquadIndex);
+				Anchor.Location = Move.AnchorLocation;
+				Anchor.Forward = Move.AnchorForward;
+				Anchor.Speed = FMath::Min(FormationSpeed, Aggregate.MaxSpeed);
+				Anchor.SlotSpacing = SlotSpacing;
+				Anchor.SlackRadius = SlackRadius;
+			}
+		});
+	}
+
+	if (SquadAnchors.IsEmpty())
+	{
+		return;
+	}
+
+	// unit pass, move to formation slots
+	{
+		QUICK_SCOPE_CYCLE_COUNTER(UETW_MassSquadFormationMoveProcessor_EntityQuery_Unit);
+		EntityQuery_Unit.ParallelForEachEntityChunk(EntityManager, Context, [this, World](FMassExecutionContext& Context)
+		{
+			const FETW_MassSquadSharedFragment& SquadSharedFragment = Context.GetSharedFragment<FETW_MassSquadSharedFragment>();
+			const UE::Mass::Squad::FSquadMoveAnchor* Anchor = SquadAnchors.Find(SquadSharedFragment.SquadIndex);
+			if (Anchor == nullptr)
+			{
+				return;
+			}
+
+			const FETW_MassSquadParams& SquadParams = Context.GetConstSharedFragment<FETW_MassSquadParams>();
+			UETW_MassNavigationSubsystem* NavigationSubsystem = Context.GetMutableSubsystem<UETW_MassNavigationSubsystem>();
+			const bool bDetachedChunk = Context.DoesArchetypeHaveTag<FETW_MassSquadUnitDetachedTag>();
+
+			const TConstArrayView<FETW_MassUnitFragment> UnitFragments = Context.GetFragmentView<FETW_MassUnitFragment>();
+			const TConstArrayView<FETW_MassFormationFollowFragment> FollowFragments = Context.GetFragmentView<FETW_MassFormationFollowFragment>();
+			const TConstArrayView<FTransformFragment> TransformFragments = Context.GetFragmentView<FTransformFragment>();
+			const TArrayView<FMassMoveTargetFragment> MoveTargetFragments = Context.GetMutableFragmentView<FMassMoveTargetFragment>();
+			const TArrayView<FMassTargetLocationFragment> TargetLocationFragments = Context.GetMutableFragmentView<FMassTargetLocationFragment>();
+			const TArrayView<FMassPathFragment> PathFragments = Context.GetMutableFragmentView<FMassPathFragment>();
+			const bool bHasPath = PathFragments.Num() > 0;
+			const TArrayView<FETW_MassFlowFieldFragment> FlowFieldFragments = Context.GetMutableFragmentView<FETW_MassFlowFieldFragment>();
+			const bool bHasFlowField = FlowFieldFragments.Num() > 0;
+			const float FlowFieldJoinDistSq = FMath::Square(UE::Mass::Squad::FlowFieldJoinSlots * Anchor->SlotSpacing);
+			TArray<uint32, TInlineAllocator<32>> ReleasedFieldIds;
+
+			const FVector Right(-Anchor->Forward.Y, Anchor->Forward.X, 0.f);
+
+			TArray<UE::Mass::Squad::FSlotValidationRequest, TInlineAllocator<32>> ChunkValidationRequests;
+
+			for (int32 EntityIdx = 0; EntityIdx < Context.GetNumEntities(); EntityIdx++)
+			{
+				const FMassEntityHandle Entity = Context.GetEntity(EntityIdx);
+				const FETW_MassFormationFollowFragment& Follow = FollowFragments[EntityIdx];
+				const FVector2D& Offset = UnitFragments[EntityIdx].FormationOffset;
+				const FVector CurrentLocation = TransformFragments[EntityIdx].GetTransform().GetLocation();
+
+				FVector SlotLocation = Anchor->Location + Anchor->Forward * Offset.X + Right * Offset.Y;
+				SlotLocation.Z = CurrentLocation.Z;
+
+				// far from slot UETW_MassFlowFieldFollowProcessor moves the unit, it releases the field itself on arrival
+				if (bHasFlowField && FlowFieldFragments[EntityIdx].FieldId != 0)
+				{
+					FETW_MassFlowFieldFragment& FlowField = FlowFieldFragments[EntityIdx];
+					if (FVector::DistSquared2D(SlotLocation, CurrentLocation) > FlowFieldJoinDistSq)
+					{
+						continue;
+					}
+					ReleasedFieldIds.Add(FlowField.FieldId);
+					FlowField.FieldId = 0;
+				}
+
+				// slot moved far enough from last checked spot, recheck it against navmesh on game thread
+				if (FVector::DistSquared2D(SlotLocation, Follow.ValidatedSlotLocation) > FMath::Square(Anchor->SlotSpacing))
+				{
+					ChunkValidationRequests.Add({ Entity, SlotLocation, SquadParams.PathParams.NavAgentProps, Anchor->SlackRadius });
+				}
+
+				FVector MoveToLocation = SlotLocation;
+				if (Follow.bSlotBlocked && bHasPath)
+				{
+					FMassPathFragment& PathFragment = PathFragments[EntityIdx];
+					if (!bDetachedChunk)
+					{
+						// detach and request individual path, slot itself is off navmesh so partial path brings unit as close as possible
+						Context.Defer().AddTag<FETW_MassSquadUnitDetachedTag>(Entity);
+						NavigationSubsystem->EntityRequestNewPathAsync(Entity, UE::Mass::Squad::GetPointByPointPathParams(SquadParams), CurrentLocation, SlotLocation);
+						MoveToLocation = CurrentLocation;
+					}
+					else if (NavigationSubsystem->IsPathRequestPending(Entity))
+					{
+						// wait for own path in place
+						MoveToLocation = CurrentLocation;
+					}
+					else
+					{
+						if (FVector::DistSquared2D(PathFragment.GetPathPoint(), CurrentLocation) <= FMath::Square(Anchor->SlackRadius))
+						{
+							// only reads nav subsystem path storage (it's modified at UETW_MassPathRequestProcessor sync point), safe from workers
+							NavigationSubsystem->ExtractNextPathPoint(PathFragment);
+						}
+						MoveToLocation = PathFragment.GetPathPoint();
+					}
+				}
+				else if (bDetachedChunk)
+				{
+					// slot reachable again, back to formation
+					Context.Defer().RemoveTag<FETW_MassSquadUnitDetachedTag>(Entity);
+				}
+
+				TargetLocationFragments[EntityIdx].Target = MoveToLocation;
+
+				FMassMoveTargetFragment& MoveTarget = MoveTargetFragments[EntityIdx];
+				const FVector ToTarget = MoveToLocation - CurrentLocation;
+				MoveTarget.Center = CurrentLocation;
+				MoveTarget.Forward = ToTarget.GetSafeNormal();
+				MoveTarget.DistanceToGoal = ToTarget.Size();
+
+				if (MoveTarget.DistanceToGoal > Anchor->SlackRadius)
+				{
+					if (MoveTarget.GetCurrentAction() != EMassMovementAction::Move)
+					{
+						MoveTarget.CreateNewAction(EMassMovementAction::Move, *World);
+						MoveTarget.IntentAtGoal = EMassMovementAction::Stand;
+					}
+					// nominal speed, slot error correction is done by UETW_MassFormationSpeedProcessor
+					MoveTarget.DesiredSpeed = FMassInt16Real(Anchor->Speed);
+				}
+				else if (MoveTarget.GetCurrentAction() != EMassMovementAction::Stand)
+				{
+					MoveTarget.CreateNewAction(EMassMovementAction::Stand, *World);
+				}
+			}
+
+			if (ChunkValidationRequests.Num() > 0)
+			{
+				FScopeLock Lock(&SlotValidationRequestsCS);
+				SlotValidationRequests.Append(ChunkValidationRequests);
+			}
+
+			if (ReleasedFieldIds.Num() > 0)
+			{
+				NavigationSubsystem->QueueFlowFieldReleases(ReleasedFieldIds);
+			}
+		});
+	}
+
+	ValidateSlots(EntityManager);
+}
+
+bool UETW_MassSquadFormationMoveProcessor::SetUnitsFlowFieldDestination(FMassEntityManager& EntityManager, const uint32 SquadIndex, const FETW_MassSquadParams& SquadParams, const FVector& Destination) const
+{
+	const UETW_MassSquadSubsystem* SquadSubsystem = UWorld::GetSubsystem<UETW_MassSquadSubsystem>(EntityManager.GetWorld());
+	UETW_MassNavigationSubsystem* NavigationSubsystem = UWorld::GetSubsystem<UETW_MassNavigationSubsystem>(EntityManager.GetWorld());
+	if (SquadSubsystem == nullptr || NavigationSubsystem == nullptr)
+	{
+		return false;
+	}
+
+	// units of a squad share archetype, first valid one tells whether the squad goes by flow field
+	const TConstArrayView<FMassEntityHandle> Units = SquadSubsystem->GetSquadManager().GetRegistry().GetSquadUnits(SquadIndex);
+	const FMassEntityHandle* FirstUnit = Units.FindByPredicate([&EntityManager](const FMassEntityHandle Unit) { return EntityManager.IsEntityValid(Unit); });
+	if (FirstUnit == nullptr || EntityManager.GetFragmentDataPtr<FETW_MassFlowFieldFragment>(*FirstUnit) == nullptr)
+	{
+		return false;
+	}
+
+	// game thread, orders to the same area end up with one ref counted field
+	for (const FMassEntityHandle Unit : Units)
+	{
+		NavigationSubsystem->EntitySetFlowFieldDestination(EntityManager, Unit, SquadParams.PathParams.NavAgentProps, Destination);
+	}
+	return true;
+}
+
+void UETW_MassSquadFormationMoveProcessor::ValidateSlots(FMassEntityManager& EntityManager)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(UETW_MassSquadFormationMoveProcessor_ValidateSlots);
+
+	const UNavigationSystemV1* NavigationSystem = FNavigationSystem::GetCurrent<UNavigationSystemV1>(EntityManager.GetWorld());
+	if (NavigationSystem == nullptr)
+	{
+		SlotValidationRequests.Reset();
+		return;
+	}
+
+	// point projection only, cheap enough for a whole squad per frame. Blocked line to slot is handled by steering/avoidance
+	for (const UE::Mass::Squad::FSlotValidationRequest& Request : SlotValidationRequests)
+	{
+		FETW_MassFormationFollowFragment* Follow = EntityManager.GetFragmentDataPtr<FETW_MassFormationFollowFragment>(Request.Entity);
+		const ANavigationData* NavData = NavigationSystem->GetNavDataForProps(Request.NavAgentProps);
+		if (Follow == nullptr || NavData == nullptr)
+		{
+			continue;
+		}
+
+		FNavLocation NavLocation;
+		const FVector Extent(Request.SlackRadius, Request.SlackRadius, NavData->GetConfig().AgentHeight);
+		const bool bOnNavmesh = NavData->ProjectPoint(Request.SlotLocation, NavLocation, Extent);
+
+		Follow->ValidatedSlotLocation = Request.SlotLocation;
+		Follow->bSlotBlocked = !bOnNavmesh;
+	}
+
+	SlotValidationRequests.Reset();
+}
+
+
+UETW_MassFormationSpeedProcessor::UETW_MassFormationSpeedProcessor()
+	: EntityQuery_Squad(*this), EntityQuery_Unit(*this)
+{
+	bAutoRegisterWithProcessingPhases = true;
+	ExecutionFlags = (int32)(EProcessorExecutionFlags::Server | EProcessorExecutionFlags::Standalone);
+	ExecutionOrder.ExecuteInGroup = UE::Mass::ProcessorGroupNames::Tasks;
+	ExecutionOrder.ExecuteAfter.Add(UETW_MassSquadFormationMoveProcessor::StaticClass()->GetFName());
+	ExecutionOrder.ExecuteBefore.Add(UE::Mass::ProcessorGroupNames::Avoidance);
+}
+
+void UETW_MassFormationSpeedProcessor::ConfigureQueries()
+{
+	EntityQuery_Squad.AddRequirement<FETW_MassSquadMoveFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Squad.AddRequirement<FETW_MassSquadAggregateFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Squad.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Squad.AddConstSharedRequirement<FETW_MassSquadParams>();
+
+	EntityQuery_Unit.AddRequirement<FETW_MassUnitFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Unit.AddRequirement<FETW_MassFormationFollowFragment>(EMassFragmentAccess::None);
+	EntityQuery_Unit.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Unit.AddRequirement<FMassMoveTargetFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Unit.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Unit.AddConstSharedRequirement<FMassMovementParameters>(EMassFragmentPresence::Optional);
+	EntityQuery_Unit.AddTagRequirement<FETW_MassSquadUnitDormantTag>(EMassFragmentPresence::None);
+}
+
+void UETW_MassFormationSpeedProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	SquadSpeedFrames.Reset();
+
+	// squad pass, few entities so sequential
+	EntityQuery_Squad.ForEachEntityChunk(EntityManager, Context, [this](FMassExecutionContext& Context)
+	{
+		const FETW_MassSquadSharedFragment& SquadSharedFragment = Context.GetSharedFragment<FETW_MassSquadSharedFragment>();
+		const FETW_MassSquadParams& SquadParams = Context.GetConstSharedFragment<FETW_MassSquadParams>();
+		const TConstArrayView<FETW_MassSquadMoveFragment> MoveFragments = Context.GetFragmentView<FETW_MassSquadMoveFragment>();
+		const TConstArrayView<FETW_MassSquadAggregateFragment> AggregateFragments = Context.GetFragmentView<FETW_MassSquadAggregateFragment>();
+
+		const float SlotSpacing = FETW_MassFormationSolver::GetSlotSpacing(SquadSharedFragment.Formation, SquadParams);
+		const float FormationSpeed = FETW_MassFormationSolver::GetFormationSpeed(SquadSharedFragment.Formation, SquadParams);
+
+		for (int32 EntityIdx = 0; EntityIdx < Context.GetNumEntities(); EntityIdx++)
+		{
+			// idle squad reforming ranks still walks its units to slots, same as formation move processor
+			const FETW_MassSquadMoveFragment& Move = MoveFragments[EntityIdx];
+			if (Move.State == EETW_MassSquadMoveState::Idle && !Move.bReformRanks)
+			{
+				continue;
+			}
+
+			UE::Mass::Squad::FSquadSpeedFrame& Frame = SquadSpeedFrames.Add(SquadSharedFragment.SquadIndex);
+			Frame.AnchorLocation = Move.AnchorLocation;
+			Frame.Forward = Move.AnchorForward;
+			Frame.BaseSpeed = FMath::Min(FormationSpeed, AggregateFragments[EntityIdx].MaxSpeed);
+			Frame.InvSlotSpacing = SlotSpacing > KINDA_SMALL_NUMBER ? 1.f / SlotSpacing : 0.f;
+			Frame.CatchupSpeedFactor = FMath::Max(SquadParams.CatchupSpeedFactor, 1.f);
+		}
+	});
+
+	if (SquadSpeedFrames.IsEmpty())
+	{
+		return;
+	}
+
+	// unit pass
+	QUICK_SCOPE_CYCLE_COUNTER(UETW_MassFormationSpeedProcessor_EntityQuery_Unit);
+	EntityQuery_Unit.ParallelForEachEntityChunk(EntityManager, Context, [this](FMassExecutionContext& Context)
+	{
+		const FETW_MassSquadSharedFragment& SquadSharedFragment = Context.GetSharedFragment<FETW_MassSquadSharedFragment>();
+		const UE::Mass::Squad::FSquadSpeedFrame* Frame = SquadSpeedFrames.Find(SquadSharedFragment.SquadIndex);
+		if (Frame == nullptr)
+		{
+			return;
+		}
+
+		const FMassMovementParameters* MovementParams = Context.GetConstSharedFragmentPtr<FMassMovementParameters>();
+		const float UnitMaxSpeed = MovementParams ? MovementParams->MaxSpeed : MAX_flt;
+
+		// detached units follow their own path and are behind the formation by definition
+		const bool bDetachedChunk = Context.DoesArchetypeHaveTag<FETW_MassSquadUnitDetachedTag>();
+		const float GainScale = bDetachedChunk ? 0.f : Frame->InvSlotSpacing * (Frame->CatchupSpeedFactor - 1.f);
+		const float BaseScale = bDetachedChunk ? Frame->CatchupSpeedFactor : 1.f;
+
+		const TConstArrayView<FETW_MassUnitFragment> UnitFragments = Context.GetFragmentView<FETW_MassUnitFragment>();
+		const TConstArrayView<FTransformFragment> TransformFragments = Context.GetFragmentView<FTransformFragment>();
+		const TArrayView<FMassMoveTargetFragment> MoveTargetFragments = Context.GetMutableFragmentView<FMassMoveTargetFragment>();
+
+		const int32 NumEntities = Context.GetNumEntities();
+		const FVector2D Forward(Frame->Forward);
+		const FVector2D Right(-Forward.Y, Forward.X);
+		const FVector2D Anchor(Frame->AnchorLocation);
+
+		// gather slot error along squad forward into flat array, positive when unit is behind its slot
+		TArray<float, TInlineAllocator<128>> Speeds;
+		Speeds.SetNumUninitialized(NumEntities);
+		for (int32 EntityIdx = 0; EntityIdx < NumEntities; EntityIdx++)
+		{
+			const FVector2D& Offset = UnitFragments[EntityIdx].FormationOffset;
+			const FVector2D Location(TransformFragments[EntityIdx].GetTransform().GetLocation());
+			const FVector2D Slot = Anchor + Forward * Offset.X + Right * Offset.Y;
+			Speeds[EntityIdx] = (Slot - Location) | Forward;
+		}
+
+		// branch free over floats, compiler vectorizes it
+		const float MinScale = UE::Mass::Squad::MinSpeedScale;
+		const float MaxScale = Frame->CatchupSpeedFactor;
+		const float BaseSpeed = Frame->BaseSpeed;
+		for (int32 EntityIdx = 0; EntityIdx < NumEntities; EntityIdx++)
+		{
+			const float Scale = FMath::Clamp(BaseScale + Speeds[EntityIdx] * GainScale, MinScale, MaxScale);
+			Speeds[EntityIdx] = FMath::Min(BaseSpeed * Scale, UnitMaxSpeed);
+		}
+
+		for (int32 EntityIdx = 0; EntityIdx < NumEntities; EntityIdx++)
+		{
+			FMassMoveTargetFragment& MoveTarget = MoveTargetFragments[EntityIdx];
+			if (MoveTarget.GetCurrentAction() == EMassMovementAction::Move)
+			{
+				MoveTarget.DesiredSpeed = FMassInt16Real(Speeds[EntityIdx]);
+			}
+		}
+	});
+}
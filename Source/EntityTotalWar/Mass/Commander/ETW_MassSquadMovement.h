@@ -0,0 +1,97 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "ETW_MassSquadFragments.h"
+#include "MassProcessor.h"
+#include "ETW_MassSquadMovement.generated.h"
+
+namespace UE::Mass::Squad
+{
+	/** Squad anchor published by squad pass for unit pass */
+	struct FSquadMoveAnchor
+	{
+		FVector Location = FVector::ZeroVector;
+		FVector Forward = FVector::ForwardVector;
+		float Speed = 0.f;
+		float SlotSpacing = 0.f;
+		float SlackRadius = 0.f;
+	};
+
+	/** Slot location waiting for navmesh check on game thread */
+	struct FSlotValidationRequest
+	{
+		FMassEntityHandle Entity;
+		FVector SlotLocation;
+		FNavAgentProperties NavAgentProps;
+		float SlackRadius = 0.f;
+	};
+
+	/** Squad values needed by speed controller */
+	struct FSquadSpeedFrame
+	{
+		FVector AnchorLocation = FVector::ZeroVector;
+		FVector Forward = FVector::ForwardVector;
+		float BaseSpeed = 0.f;
+		float InvSlotSpacing = 0.f;
+		float CatchupSpeedFactor = 1.f;
+	};
+}
+
+/**
+ * Squad movement as single path plus offsets.
+ * Squad entity requests one navmesh path and moves formation anchor along it, units move to their formation slots around the anchor.
+ * Units whose slot is off navmesh detach and follow own path until slot becomes reachable again.
+ * Squad whose units have flow field follow trait doesn't query a path: its anchor is placed at destination and units
+ * far from their slot move by flow field shared by all orders to that area, then fall in to their slots.
+ */
+UCLASS()
+class ENTITYTOTALWAR_API UETW_MassSquadFormationMoveProcessor : public UMassProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UETW_MassSquadFormationMoveProcessor();
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+
+	void ValidateSlots(FMassEntityManager& EntityManager);
+
+	// sets flow field destination of all squad units, false when units don't follow flow fields
+	bool SetUnitsFlowFieldDestination(FMassEntityManager& EntityManager, const uint32 SquadIndex, const FETW_MassSquadParams& SquadParams, const FVector& Destination) const;
+
+	FMassEntityQuery EntityQuery_Squad;
+	FMassEntityQuery EntityQuery_Unit;
+
+	// keyed by squad index, only squads with move order
+	TMap<uint32, UE::Mass::Squad::FSquadMoveAnchor> SquadAnchors;
+
+	TArray<UE::Mass::Squad::FSlotValidationRequest> SlotValidationRequests;
+	FCriticalSection SlotValidationRequestsCS;
+};
+
+/**
+ * Formation speed controller, runs after formation movement.
+ * Unit desired speed is squad move mode speed, limited by the slowest unit of the squad, scaled by unit's error
+ * along squad forward: units behind their slot speed up to CatchupSpeedFactor, units ahead of it slow down.
+ */
+UCLASS()
+class ENTITYTOTALWAR_API UETW_MassFormationSpeedProcessor : public UMassProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UETW_MassFormationSpeedProcessor();
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+
+	FMassEntityQuery EntityQuery_Squad;
+	FMassEntityQuery EntityQuery_Unit;
+
+	// keyed by squad index, only moving or holding squads
+	TMap<uint32, UE::Mass::Squad::FSquadSpeedFrame> SquadSpeedFrames;
+};
@@ -0,0 +1,277 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ETW_MassSquadOrders.h"
+#include "ETW_MassSquadMovement.h"
+#include "ETW_MassSquadProcessors.h"
+#include "ETW_MassSquadSubsystem.h"
+
+#include "Async/ParallelFor.h"
+#include "MassExecutionContext.h"
+
+namespace UE::Mass::Squad
+{
+	// preset bitmask of squad params, zero means every value is allowed
+	template<typename EnumType>
+	static bool IsOrderValueAllowed(const int32 Mask, const EnumType Value)
+	{
+		return Value != EnumType::NONE && (Mask == 0 || (Mask & static_cast<int32>(Value)) != 0);
+	}
+}
+
+void FETW_MassSquadPendingOrders::Merge(const FETW_MassSquadOrder& Order)
+{
+	switch (Order.Type)
+	{
+	case EETW_MassSquadOrderType::Move:
+	case EETW_MassSquadOrderType::AttackSquad:
+		MovementOrder = Order;
+		break;
+	case EETW_MassSquadOrderType::SetFormation:
+		FormationType = Order.FormationType;
+		break;
+	case EETW_MassSquadOrderType::SetDensity:
+		FormationDensity = Order.FormationDensity;
+		break;
+	case EETW_MassSquadOrderType::SetMoveMode:
+		FormationMovementMode = Order.FormationMovementMode;
+		break;
+	default:
+		checkNoEntry();
+		break;
+	}
+}
+
+
+UETW_MassSquadOrderProcessor::UETW_MassSquadOrderProcessor()
+	: EntityQuery_Squad(*this), EntityQuery_Unit(*this)
+{
+	bAutoRegisterWithProcessingPhases = true;
+	ExecutionFlags = (int32)(EProcessorExecutionFlags::Server | EProcessorExecutionFlags::Standalone);
+	ExecutionOrder.ExecuteInGroup = UE::Mass::ProcessorGroupNames::Tasks;
+	ExecutionOrder.ExecuteBefore.Add(UETW_MassSquadProcessor::StaticClass()->GetFName());
+	ExecutionOrder.ExecuteBefore.Add(UETW_MassSquadFormationMoveProcessor::StaticClass()->GetFName());
+}
+
+void UETW_MassSquadOrderProcessor::ConfigureQueries()
+{
+	EntityQuery_Squad.AddRequirement<FETW_MassSquadMoveFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Squad.AddRequirement<FETW_MassSquadStateFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Squad.AddRequirement<FETW_MassSquadAggregateFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Squad.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Squad.AddConstSharedRequirement<FETW_MassSquadParams>();
+
+	EntityQuery_Unit.AddRequirement<FETW_MassUnitFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Unit.AddRequirement<FMassTargetLocationFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Unit.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadOnly);
+}
+
+void UETW_MassSquadOrderProcessor::Initialize(UObject& Owner)
+{
+	Super::Initialize(Owner);
+
+	SquadSubsystem = UWorld::GetSubsystem<UETW_MassSquadSubsystem>(Owner.GetWorld());
+	check(SquadSubsystem);
+}
+
+void UETW_MassSquadOrderProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	check(SquadSubsystem);
+
+	// keep allocations between frames
+	PendingOrders.Reset();
+	Fanouts.Reset();
+	ReformRequests.Reset();
+
+	FMassSquadManager& SquadManager = SquadSubsystem->GetMutablSquadManager();
+	SquadManager.DrainOrders(PendingOrders);
+	if (PendingOrders.IsEmpty())
+	{
+		return;
+	}
+
+	QUICK_SCOPE_CYCLE_COUNTER(UETW_MassSquadOrderProcessor_Execute);
+
+	const FETW_MassSquadRegistry& Registry = SquadManager.GetRegistry();
+
+	// squad pass, one write per squad no matter how many orders were clicked
+	EntityQuery_Squad.ForEachEntityChunk(EntityManager, Context, [this, &EntityManager, &Registry](FMassExecutionContext& Context)
+	{
+		FETW_MassSquadSharedFragment& SquadSharedFragment = Context.GetMutableSharedFragment<FETW_MassSquadSharedFragment>();
+		const FETW_MassSquadPendingOrders* Orders = PendingOrders.Find(SquadSharedFragment.SquadIndex);
+		if (Orders == nullptr)
+		{
+			return;
+		}
+
+		const FETW_MassSquadParams& SquadParams = Context.GetConstSharedFragment<FETW_MassSquadParams>();
+		const TArrayView<FETW_MassSquadMoveFragment> MoveFragments = Context.GetMutableFragmentView<FETW_MassSquadMoveFragment>();
+		const TArrayView<FETW_MassSquadStateFragment> StateFragments = Context.GetMutableFragmentView<FETW_MassSquadStateFragment>();
+		const TConstArrayView<FETW_MassSquadAggregateFragment> AggregateFragments = Context.GetFragmentView<FETW_MassSquadAggregateFragment>();
+
+		// formation change, shared fragment is unique per squad so squad and its units see new formation at once
+		FETW_MassFormation& Formation = SquadSharedFragment.Formation;
+		const float OldSpacing = FETW_MassFormationSolver::GetSlotSpacing(Formation, SquadParams);
+		bool bReform = false;
+		if (Orders->FormationType.IsSet() && Formation.FormationType != *Orders->FormationType
+			&& UE::Mass::Squad::IsOrderValueAllowed(SquadParams.AvaliableFormations, *Orders->FormationType))
+		{
+			Formation.FormationType = *Orders->FormationType;
+			bReform = true;
+		}
+		if (Orders->FormationDensity.IsSet() && Formation.FormationDensity != *Orders->FormationDensity
+			&& UE::Mass::Squad::IsOrderValueAllowed(SquadParams.AvaliableDensity, *Orders->FormationDensity))
+		{
+			Formation.FormationDensity = *Orders->FormationDensity;
+			bReform = true;
+		}
+		if (Orders->FormationMovementMode.IsSet()
+			&& UE::Mass::Squad::IsOrderValueAllowed(SquadParams.AvaliableMoveMode, *Orders->FormationMovementMode))
+		{
+			// speed only, picked up by squad movement
+			Formation.FormationMovementMode = *Orders->FormationMovementMode;
+		}
+
+		UE::Mass::Squad::FSquadOrderFanout Fanout;
+		if (bReform)
+		{
+			UE::Mass::Squad::FSquadReformRequest& Reform = ReformRequests.AddDefaulted_GetRef();
+			Reform.SquadIndex = SquadSharedFragment.SquadIndex;
+			Reform.Formation = Formation;
+			Reform.Spacing = FETW_MassFormationSolver::GetSlotSpacing(Formation, SquadParams);
+			Reform.OffsetScale = OldSpacing > KINDA_SMALL_NUMBER ? Reform.Spacing / OldSpacing : 1.f;
+			Fanout.ReformIndex = ReformRequests.Num() - 1;
+		}
+
+		for (int32 EntityIdx = 0; Orders->MovementOrder.IsSet() && EntityIdx < Context.GetNumEntities(); EntityIdx++)
+		{
+			const FETW_MassSquadOrder& Order = *Orders->MovementOrder;
+			const FETW_MassSquadAggregateFragment& Aggregate = AggregateFragments[EntityIdx];
+			FETW_MassSquadStateFragment& State = StateFragments[EntityIdx];
+
+			FVector Destination = Order.Location;
+			if (Order.Type == EETW_MassSquadOrderType::AttackSquad)
+			{
+				const FMassEntityHandle TargetSquadEntity = Registry.GetSquadEntity(Order.TargetSquadIndex);
+				const FETW_MassSquadAggregateFragment* TargetAggregate = EntityManager.IsEntityValid(TargetSquadEntity)
+					? EntityManager.GetFragmentDataPtr<FETW_MassSquadAggregateFragment>(TargetSquadEntity)
+					: nullptr;
+				if (TargetAggregate == nullptr || TargetAggregate->AliveCount == 0)
+				{
+					continue;
+				}
+				State.TargetSquadIndex = Order.TargetSquadIndex;
+				Destination = TargetAggregate->Centroid;
+			}
+			else
+			{
+				State.TargetSquadIndex = UE::Mass::Squad::InvalidSquadIndex;
+			}
+
+			// picked up by UETW_MassSquadFormationMoveProcessor
+			FETW_MassSquadMoveFragment& Move = MoveFragments[EntityIdx];
+			Move.Destination = Destination;
+			Move.bMoveRequested = true;
+
+			const FVector ToDestination = Destination - Aggregate.Centroid;
+			Fanout.bHasDestination = true;
+			Fanout.Destination = Destination;
+			Fanout.Forward = ToDestination.SizeSquared2D() > KINDA_SMALL_NUMBER ? ToDestination.GetSafeNormal2D() : Aggregate.Forward;
+		}
+
+		if (Fanout.bHasDestination || Fanout.ReformIndex != INDEX_NONE)
+		{
+			Fanouts.Add(SquadSharedFragment.SquadIndex, Fanout);
+		}
+	});
+
+	// new slot layouts, each squad solved independently
+	if (ReformRequests.Num() > 0)
+	{
+		QUICK_SCOPE_CYCLE_COUNTER(UETW_MassSquadOrderProcessor_Reform);
+		FETW_MassFormationSolver& FormationSolver = SquadSubsystem->GetFormationSolver();
+
+		ParallelFor(ReformRequests.Num(), [this, &EntityManager, &Registry, &FormationSolver, &SquadManager](const int32 ReformIdx)
+		{
+			UE::Mass::Squad::FSquadReformRequest& Reform = ReformRequests[ReformIdx];
+			Reform.Units = Registry.GetSquadUnits(Reform.SquadIndex);
+			Reform.UnitSlots.Init(INDEX_NONE, Reform.Units.Num());
+
+			// unit fragment is owned by this processor (ReadWrite), reading it directly is safe here
+			TArray<FVector2D, TInlineAllocator<256>> UnitLocations;
+			TArray<int32, TInlineAllocator<256>> AliveUnits;
+			for (int32 UnitIdx = 0; UnitIdx < Reform.Units.Num(); UnitIdx++)
+			{
+				const FMassEntityHandle Unit = Reform.Units[UnitIdx];
+				if (const FETW_MassUnitFragment* UnitFragment = EntityManager.IsEntityValid(Unit) ? EntityManager.GetFragmentDataPtr<FETW_MassUnitFragment>(Unit) : nullptr)
+				{
+					UnitLocations.Add(UnitFragment->FormationOffset * Reform.OffsetScale);
+					AliveUnits.Add(UnitIdx);
+				}
+			}
+			if (AliveUnits.IsEmpty())
+			{
+				return;
+			}
+
+			const TSharedRef<const FETW_MassFormationSlots> Slots = FormationSolver.GetSlots(Reform.Formation, Reform.Spacing, AliveUnits.Num());
+			TArray<int32> AliveUnitSlots;
+			FETW_MassFormationSolver::AssignSlots(UnitLocations, Slots->Offsets, Reform.Formation.Length, AliveUnitSlots);
+
+			TArray<FMassEntityHandle> SlotUnits;
+			SlotUnits.Reserve(AliveUnits.Num());
+			for (int32 AliveIdx = 0; AliveIdx < AliveUnits.Num(); AliveIdx++)
+			{
+				Reform.UnitSlots[AliveUnits[AliveIdx]] = AliveUnitSlots[AliveIdx];
+				SlotUnits.Add(Reform.Units[AliveUnits[AliveIdx]]);
+			}
+			Reform.Slots = Slots;
+
+			// registry occupancy follows new layout from next sync point, rank closing works on it
+			SquadManager.EnqueueAssignSlots(Reform.SquadIndex, SlotUnits, AliveUnitSlots, Slots);
+		});
+	}
+
+	// unit pass, fan order results out to units
+	{
+		QUICK_SCOPE_CYCLE_COUNTER(UETW_MassSquadOrderProcessor_EntityQuery_Unit);
+		EntityQuery_Unit.ParallelForEachEntityChunk(EntityManager, Context, [this, &Registry](FMassExecutionContext& Context)
+		{
+			const FETW_MassSquadSharedFragment& SquadSharedFragment = Context.GetSharedFragment<FETW_MassSquadSharedFragment>();
+			const UE::Mass::Squad::FSquadOrderFanout* Fanout = Fanouts.Find(SquadSharedFragment.SquadIndex);
+			if (Fanout == nullptr)
+			{
+				return;
+			}
+
+			const UE::Mass::Squad::FSquadReformRequest* Reform = ReformRequests.IsValidIndex(Fanout->ReformIndex) ? &ReformRequests[Fanout->ReformIndex] : nullptr;
+			const FVector Right(-Fanout->Forward.Y, Fanout->Forward.X, 0.f);
+
+			const TArrayView<FETW_MassUnitFragment> UnitFragments = Context.GetMutableFragmentView<FETW_MassUnitFragment>();
+			const TArrayView<FMassTargetLocationFragment> TargetLocationFragments = Context.GetMutableFragmentView<FMassTargetLocationFragment>();
+
+			for (int32 EntityIdx = 0; EntityIdx < Context.GetNumEntities(); EntityIdx++)
+			{
+				FETW_MassUnitFragment& UnitFragment = UnitFragments[EntityIdx];
+
+				if (Reform && Reform->Slots.IsValid())
+				{
+					// units spawned after last sync point aren't in registry yet, they keep old slot until next reform
+					const int32 UnitIdx = Registry.GetUnitIndexInSquad(Context.GetEntity(EntityIdx));
+					const int32 SlotIndex = Reform->UnitSlots.IsValidIndex(UnitIdx) ? Reform->UnitSlots[UnitIdx] : INDEX_NONE;
+					if (Reform->Slots->Offsets.IsValidIndex(SlotIndex))
+					{
+						UnitFragment.SlotIndex = SlotIndex;
+						UnitFragment.FormationOffset = Reform->Slots->Offsets[SlotIndex];
+					}
+				}
+
+				if (Fanout->bHasDestination)
+				{
+					const FVector2D& Offset = UnitFragment.FormationOffset;
+					TargetLocationFragments[EntityIdx].Target = Fanout->Destination + Fanout->Forward * Offset.X + Right * Offset.Y;
+				}
+			}
+		});
+	}
+}
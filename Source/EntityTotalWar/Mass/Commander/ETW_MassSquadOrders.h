@@ -0,0 +1,122 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "ETW_MassFormation.h"
+#include "MassProcessor.h"
+#include "Engine/NetSerialization.h"
+#include "ETW_MassSquadOrders.generated.h"
+
+UENUM()
+enum class EETW_MassSquadOrderType : uint8
+{
+	Move,
+	AttackSquad,
+	SetFormation,
+	SetDensity,
+	SetMoveMode
+};
+
+/** Player order for one squad, sent by commander to server and queued until next UETW_MassSquadOrderProcessor run */
+USTRUCT()
+struct ENTITYTOTALWAR_API FETW_MassSquadOrder
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	EETW_MassSquadOrderType Type = EETW_MassSquadOrderType::Move;
+
+	UPROPERTY()
+	uint32 SquadIndex = UE::Mass::Squad::InvalidSquadIndex;
+
+	// Move
+	UPROPERTY()
+	FVector_NetQuantize Location = FVector::ZeroVector;
+
+	// AttackSquad
+	UPROPERTY()
+	uint32 TargetSquadIndex = UE::Mass::Squad::InvalidSquadIndex;
+
+	UPROPERTY()
+	EETW_FormationType FormationType = EETW_FormationType::NONE;
+
+	UPROPERTY()
+	EETW_FormationDensity FormationDensity = EETW_FormationDensity::NONE;
+
+	UPROPERTY()
+	EETW_FormationMovementMode FormationMovementMode = EETW_FormationMovementMode::NONE;
+};
+
+/**
+ * Orders of one squad received during a frame, de-duplicated: newer order of the same kind replaces older one.
+ * Move and attack exclude each other, formation changes are kept per field.
+ */
+struct ENTITYTOTALWAR_API FETW_MassSquadPendingOrders
+{
+	TOptional<FETW_MassSquadOrder> MovementOrder;
+	TOptional<EETW_FormationType> FormationType;
+	TOptional<EETW_FormationDensity> FormationDensity;
+	TOptional<EETW_FormationMovementMode> FormationMovementMode;
+
+	void Merge(const FETW_MassSquadOrder& Order);
+};
+
+namespace UE::Mass::Squad
+{
+	/** Formation layout change of one squad, slots are solved in parallel after squad pass */
+	struct FSquadReformRequest
+	{
+		uint32 SquadIndex = InvalidSquadIndex;
+		FETW_MassFormation Formation;
+		float Spacing = 0.f;
+
+		// current offsets are scaled by that before matching, so old and new layouts are comparable
+		float OffsetScale = 1.f;
+
+		// registry units of squad and their new slots, INDEX_NONE for dead units
+		TArray<FMassEntityHandle> Units;
+		TArray<int32> UnitSlots;
+		TSharedPtr<const FETW_MassFormationSlots> Slots;
+	};
+
+	/** Order result pushed to squad units by parallel unit pass */
+	struct FSquadOrderFanout
+	{
+		int32 ReformIndex = INDEX_NONE;
+		bool bHasDestination = false;
+		FVector Destination = FVector::ZeroVector;
+		FVector Forward = FVector::ForwardVector;
+	};
+}
+
+/**
+ * Applies queued squad orders in one batch per frame.
+ * Squad pass writes squad fragments, formation changes are solved per squad in parallel,
+ * then parallel unit pass fans results out to unit slots and target locations.
+ */
+UCLASS()
+class ENTITYTOTALWAR_API UETW_MassSquadOrderProcessor : public UMassProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UETW_MassSquadOrderProcessor();
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Initialize(UObject& Owner) override;
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+
+	FMassEntityQuery EntityQuery_Squad;
+	FMassEntityQuery EntityQuery_Unit;
+
+	UPROPERTY(Transient)
+	TObjectPtr<class UETW_MassSquadSubsystem> SquadSubsystem = nullptr;
+
+	// keyed by squad index, drained from squad manager at the start of every run
+	TMap<uint32, FETW_MassSquadPendingOrders> PendingOrders;
+
+	// keyed by squad index, written by squad pass, read only during unit pass
+	TMap<uint32, UE::Mass::Squad::FSquadOrderFanout> Fanouts;
+	TArray<UE::Mass::Squad::FSquadReformRequest> ReformRequests;
+};
@@ -2,12 +2,15 @@
 
 
 #include "ETW_MassSquadProcessors.h"
+#include "ETW_MassFormation.h"
 #include "ETW_MassSquadSubsystem.h"
 #include "MassCommanderComponent.h"
 
+#include "Async/ParallelFor.h"
 #include "MassEntityTemplateRegistry.h"
 #include "MassEntityView.h"
 #include "MassExecutionContext.h"
+#include "MassMovementFragments.h"
 #include "MassReplicationFragments.h"
 #include "VisualLogger/VisualLogger.h"
 
@@ -67,8 +70,8 @@ namespace UE::Mass::Squad
 
 		const FString TargetLocation = TargetLocationFragment.Target.ToString();
 		
-		FString DbgString = FString::Printf(TEXT("NetId: %d \n Team %d: \t Unit %d, \t Squad %d: \t TargetSquad: %d \n Target Location: %s"),
-			NetworkID, TeamFragment.TeamIndex, UnitFragment.UnitIndex, SquadSharedFragment.SquadIndex, SquadSharedFragment.TargetSquadIndex, *TargetLocation);
+		FString DbgString = FString::Printf(TEXT("NetId: %d \n Team %d: \t Unit %d, \t Squad %d: \t Slot: %d \n Target Location: %s"),
+			NetworkID, TeamFragment.TeamIndex, UnitFragment.UnitIndex, SquadSharedFragment.SquadIndex, UnitFragment.SlotIndex, *TargetLocation);
 		
 		if ((World->GetNetMode() == NM_Client && bDebugSquadUnits_Client) || (World->GetNetMode() == NM_Standalone && (bDebugSquadUnits_Client || bDebugSquadUnits_Server)))
 		{
@@ -100,6 +103,8 @@ namespace UE::Mass::Squad
 		const FMassTargetLocationFragment& TargetLocationFragment = EntityView.GetFragmentData<FMassTargetLocationFragment>();
 		const FETW_MassSquadCommanderFragment& CommanderFragment = EntityView.GetFragmentData<FETW_MassSquadCommanderFragment>();
 		const FETW_MassSquadSharedFragment& SquadSharedFragment = EntityView.GetSharedFragmentData<FETW_MassSquadSharedFragment>();
+		const FETW_MassSquadAggregateFragment& AggregateFragment = EntityView.GetFragmentData<FETW_MassSquadAggregateFragment>();
+		const FETW_MassSquadStateFragment& StateFragment = EntityView.GetFragmentData<FETW_MassSquadStateFragment>();
 
 		const FVector& Pos = TransformFragment.GetTransform().GetLocation();
 		const uint32 NetworkID = World->GetNetMode() == NM_Standalone ? -1 : EntityView.GetFragmentData<FMassNetworkIDFragment>().NetID.GetValue();
@@ -120,11 +125,13 @@ namespace UE::Mass::Squad
 			DebugColor = FColor(InitialColor / 256 % 256, InitialColor / 256 / 256 % 256, InitialColor % 256);
 		}
 
+		DrawDebugBox(World, AggregateFragment.BoundsCenter, FVector(AggregateFragment.BoundsExtent, 50.f), AggregateFragment.GetFacingQuat(), DebugColor, false, World->GetDeltaSeconds());
+
 		const FString CommanderName = CommanderFragment.CommanderComp.Get()->GetOwner()->GetName();
 		const FString TargetLocation = TargetLocationFragment.Target.ToString();
 		
-		FString DbgString = FString::Printf(TEXT("NetId: %d \n Team %d: \t Squad %d: \t TargetSquad: %d \n Commander: %s \n Target Location: %s"),
-			NetworkID, TeamFragment.TeamIndex, SquadSharedFragment.SquadIndex, SquadSharedFragment.TargetSquadIndex, *CommanderName, *TargetLocation);
+		FString DbgString = FString::Printf(TEXT("NetId: %d \n Team %d: \t Squad %d: \t TargetSquad: %d \t Alive: %d \n Commander: %s \n Target Location: %s"),
+			NetworkID, TeamFragment.TeamIndex, SquadSharedFragment.SquadIndex, StateFragment.TargetSquadIndex, AggregateFragment.AliveCount, *CommanderName, *TargetLocation);
 		
 		if ((World->GetNetMode() == NM_Client && bDebugSquads_Client) || (World->GetNetMode() == NM_Standalone && (bDebugSquads_Client || bDebugSquads_Server)))
 		{
@@ -142,6 +149,27 @@ namespace UE::Mass::Squad
 }
 
 
+namespace UE::Mass::Squad
+{
+	// below that average speed squad facing is taken from its target
+	constexpr float FacingMinSpeed = 10.f;
+
+	void FSquadAggregatePartial::Merge(const FSquadAggregatePartial& Other)
+	{
+		SumLocation += Other.SumLocation;
+		SumVelocity += Other.SumVelocity;
+		SumTargetLocation += Other.SumTargetLocation;
+		Count += Other.Count;
+		Forward = Other.Forward;
+		MinProjection = FVector2D::Min(MinProjection, Other.MinProjection);
+		MaxProjection = FVector2D::Max(MaxProjection, Other.MaxProjection);
+		FrontMinRight = FMath::Min(FrontMinRight, Other.FrontMinRight);
+		FrontMaxRight = FMath::Max(FrontMaxRight, Other.FrontMaxRight);
+		MaxSpeed = FMath::Min(MaxSpeed, Other.MaxSpeed);
+	}
+}
+
+
 UETW_MassSquadProcessor::UETW_MassSquadProcessor()
 	: EntityQuery_Squad(*this), EntityQuery_Unit(*this)
 {
@@ -156,23 +184,26 @@ void UETW_MassSquadProcessor::ConfigureQueries()
 	EntityQuery_Squad.AddRequirement<FETW_MassSquadCommanderFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery_Squad.AddRequirement<FMassTargetLocationFragment>(EMassFragmentAccess::ReadWrite);
 	EntityQuery_Squad.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Squad.AddRequirement<FETW_MassSquadAggregateFragment>(EMassFragmentAccess::ReadWrite);
 
 	EntityQuery_Squad.AddRequirement<FETW_MassTeamFragment>(EMassFragmentAccess::ReadOnly);
-	EntityQuery_Squad.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Squad.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery_Squad.AddConstSharedRequirement<FETW_MassSquadParams>();
+	// dormant squad aggregate is driven by UETW_MassSquadLODProcessor
+	EntityQuery_Squad.AddTagRequirement<FETW_MassSquadDormantTag>(EMassFragmentPresence::None);
 
 	EntityQuery_Squad.AddSubsystemRequirement<UETW_MassSquadSubsystem>(EMassFragmentAccess::ReadWrite);
 
 	EntityQuery_Unit.AddRequirement<FETW_MassUnitFragment>(EMassFragmentAccess::ReadOnly);
-	EntityQuery_Unit.AddRequirement<FMassTargetLocationFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Unit.AddRequirement<FMassTargetLocationFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery_Unit.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Unit.AddRequirement<FMassVelocityFragment>(EMassFragmentAccess::ReadOnly, EMassFragmentPresence::Optional);
 
 	EntityQuery_Unit.AddRequirement<FETW_MassTeamFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery_Unit.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery_Unit.AddConstSharedRequirement<FETW_MassSquadParams>();
-
-	EntityQuery_Unit.AddSubsystemRequirement<UETW_MassSquadSubsystem>(EMassFragmentAccess::ReadWrite);
-
+	EntityQuery_Unit.AddConstSharedRequirement<FMassMovementParameters>(EMassFragmentPresence::Optional);
+	EntityQuery_Unit.AddTagRequirement<FETW_MassSquadUnitDormantTag>(EMassFragmentPresence::None);
 }
 
 void UETW_MassSquadProcessor::Initialize(UObject& Owner)
@@ -190,68 +221,154 @@ void UETW_MassSquadProcessor::Execute(FMassEntityManager& EntityManager, FMassEx
 	UWorld* World = EntityManager.GetWorld();
 	check(World);
 	check(SquadSubsystem);
-	FMassSquadManager& SquadManager = SquadSubsystem->GetMutablSquadManager();
 
-	// for each shared fragment
-	{
-		QUICK_SCOPE_CYCLE_COUNTER(UMassSquadProcessor_ForEachSquadSharedFragment);
-		EntityManager.ForEachSharedFragment<FETW_MassSquadSharedFragment>([&SquadManager](FETW_MassSquadSharedFragment& RepSharedFragment)
-		{
-		
-		});
-	}
+	// keep allocations between frames
+	SquadPartials.Reset();
 
-	// unit logic
+	// unit pass, reduce all squad units into per squad partials. Chunk holds units of single squad (shared fragment),
+	// so each chunk is reduced locally and merged once under the lock
 	{
 		QUICK_SCOPE_CYCLE_COUNTER(UMassSquadProcessor_EntityQuery_Unit);
-		EntityQuery_Unit.ForEachEntityChunk(EntityManager, Context, [&SquadManager](FMassExecutionContext& Context)
+		EntityQuery_Unit.ParallelForEachEntityChunk(EntityManager, Context, [this](FMassExecutionContext& Context)
 		{
-			
-			const FETW_MassSquadParams& SquadParams = Context.GetConstSharedFragment<FETW_MassSquadParams>();
-			FETW_MassSquadSharedFragment& SquadSharedFragment = Context.GetMutableSharedFragment<FETW_MassSquadSharedFragment>();
+			const FETW_MassSquadSharedFragment& SquadSharedFragment = Context.GetSharedFragment<FETW_MassSquadSharedFragment>();
+			if (SquadSharedFragment.SquadIndex == UE::Mass::Squad::InvalidSquadIndex)
+			{
+				return;
+			}
 			
 			const TConstArrayView<FTransformFragment> TransformFragments = Context.GetFragmentView<FTransformFragment>();
-			const TConstArrayView<FETW_MassTeamFragment> TeamFragments = Context.GetFragmentView<FETW_MassTeamFragment>();
-			const TConstArrayView<FETW_MassUnitFragment> UnitFragments = Context.GetFragmentView<FETW_MassUnitFragment>();
+			const TConstArrayView<FMassTargetLocationFragment> TargetLocationFragments = Context.GetFragmentView<FMassTargetLocationFragment>();
+			const TConstArrayView<FMassVelocityFragment> VelocityFragments = Context.GetFragmentView<FMassVelocityFragment>();
+			const bool bHasVelocity = VelocityFragments.Num() > 0;
 
-			const TArrayView<FMassTargetLocationFragment> TargetLocationFragments = Context.GetMutableFragmentView<FMassTargetLocationFragment>();
+			const UE::Mass::Squad::FSquadAggregateFrame* FoundFrame = SquadFrames.Find(SquadSharedFragment.SquadIndex);
+			const UE::Mass::Squad::FSquadAggregateFrame Frame = FoundFrame ? *FoundFrame : UE::Mass::Squad::FSquadAggregateFrame();
+			const FVector Right(-Frame.Forward.Y, Frame.Forward.X, 0.f);
 
-			SquadSharedFragment.CentralUnitId = UnitFragments[0].UnitIndex;
-			SquadSharedFragment.CentralUnitLocation = TransformFragments[0].GetTransform().GetLocation();
-			SquadSharedFragment.CentralUnitTargetLocation = TargetLocationFragments[0].Target;
-			
-			for (int32 EntityIdx = 0; EntityIdx < Context.GetNumEntities(); EntityIdx++)
+			UE::Mass::Squad::FSquadAggregatePartial Partial;
+			Partial.Forward = Frame.Forward;
+			if (const FMassMovementParameters* MovementParams = Context.GetConstSharedFragmentPtr<FMassMovementParameters>())
 			{
-				// draw debug
-				#if WITH_MASSGAMEPLAY_DEBUG && WITH_EDITOR
-				if (UE::Mass::Squad::bDebugSquadUnits_Client || UE::Mass::Squad::bDebugSquadUnits_Server)
+				// movement params are per archetype, so per chunk
+				Partial.MaxSpeed = MovementParams->MaxSpeed;
+			}
+
+			const int32 NumEntities = Context.GetNumEntities();
+			for (int32 EntityIdx = 0; EntityIdx < NumEntities; EntityIdx++)
+			{
+				const FVector& Location = TransformFragments[EntityIdx].GetTransform().GetLocation();
+				Partial.SumLocation += Location;
+				Partial.SumTargetLocation += TargetLocationFragments[EntityIdx].Target;
+				if (bHasVelocity)
 				{
-					UE::Mass::Squad::DebugDrawSquadUnits(Context.GetEntity(EntityIdx), Context.GetEntityManagerChecked());
+					Partial.SumVelocity += VelocityFragments[EntityIdx].Value;
+				}
+
+				const FVector2D Projection(Location | Frame.Forward, Location | Right);
+				Partial.MinProjection = FVector2D::Min(Partial.MinProjection, Projection);
+				Partial.MaxProjection = FVector2D::Max(Partial.MaxProjection, Projection);
+
+				if (Projection.X >= Frame.FrontLineProjection)
+				{
+					Partial.FrontMinRight = FMath::Min(Partial.FrontMinRight, Projection.Y);
+					Partial.FrontMaxRight = FMath::Max(Partial.FrontMaxRight, Projection.Y);
 				}
-				#endif
 			}
+			Partial.Count = NumEntities;
 
+			FScopeLock Lock(&SquadPartialsCS);
+			SquadPartials.FindOrAdd(SquadSharedFragment.SquadIndex).Merge(Partial);
 		});
 	}
 
-	// squad logic
+	// draw debug, not thread safe so separate pass
+#if WITH_MASSGAMEPLAY_DEBUG && WITH_EDITOR
+	if (UE::Mass::Squad::bDebugSquadUnits_Client || UE::Mass::Squad::bDebugSquadUnits_Server)
+	{
+		EntityQuery_Unit.ForEachEntityChunk(EntityManager, Context, [](FMassExecutionContext& Context)
+		{
+			for (int32 EntityIdx = 0; EntityIdx < Context.GetNumEntities(); EntityIdx++)
+			{
+				UE::Mass::Squad::DebugDrawSquadUnits(Context.GetEntity(EntityIdx), Context.GetEntityManagerChecked());
+			}
+		});
+	}
+#endif
+
+	// squad pass, finalize aggregates and prepare squad frames for the next unit pass
+	SquadFrames.Reset();
 	{
 		QUICK_SCOPE_CYCLE_COUNTER(UMassSquadProcessor_EntityQuery_Squad);
-		EntityQuery_Squad.ForEachEntityChunk(EntityManager, Context, [&SquadManager](FMassExecutionContext& Context)
+		EntityQuery_Squad.ForEachEntityChunk(EntityManager, Context, [this](FMassExecutionContext& Context)
 		{
+			const FETW_MassSquadSharedFragment& SquadSharedFragment = Context.GetSharedFragment<FETW_MassSquadSharedFragment>();
 			const FETW_MassSquadParams& SquadParams = Context.GetConstSharedFragment<FETW_MassSquadParams>();
-			FETW_MassSquadSharedFragment& SquadSharedFragment = Context.GetMutableSharedFragment<FETW_MassSquadSharedFragment>();
-
-			const TConstArrayView<FETW_MassSquadCommanderFragment> CommanderFragments = Context.GetFragmentView<FETW_MassSquadCommanderFragment>();
-			const TConstArrayView<FETW_MassTeamFragment> TeamFragments = Context.GetFragmentView<FETW_MassTeamFragment>();
 
+			const TArrayView<FETW_MassSquadAggregateFragment> AggregateFragments = Context.GetMutableFragmentView<FETW_MassSquadAggregateFragment>();
 			const TArrayView<FMassTargetLocationFragment> TargetLocationFragments = Context.GetMutableFragmentView<FMassTargetLocationFragment>();
 			const TArrayView<FTransformFragment> TransformFragments = Context.GetMutableFragmentView<FTransformFragment>();
 
+			// one rank depth, units closer than that to the front are the front line
+			const float RankDepth = FETW_MassFormationSolver::GetSlotSpacing(SquadSharedFragment.Formation, SquadParams) * 0.5f;
+			const UE::Mass::Squad::FSquadAggregatePartial* Partial = SquadPartials.Find(SquadSharedFragment.SquadIndex);
+
 			for (int32 EntityIdx = 0; EntityIdx < Context.GetNumEntities(); EntityIdx++)
 			{
-				TransformFragments[EntityIdx].GetMutableTransform().SetLocation(SquadSharedFragment.CentralUnitLocation);
-				TargetLocationFragments[EntityIdx].Target = SquadSharedFragment.CentralUnitTargetLocation;
+				FETW_MassSquadAggregateFragment& Aggregate = AggregateFragments[EntityIdx];
+
+				if (Partial == nullptr || Partial->Count == 0)
+				{
+					// all units are dead, keep last known placement
+					Aggregate.AliveCount = 0;
+					Aggregate.AverageVelocity = FVector::ZeroVector;
+					Aggregate.MaxSpeed = MAX_flt;
+					continue;
+				}
+
+				// bounds are rebuilt on the axes units were projected on, they lag facing by a frame while turning
+				const float InvCount = 1.f / Partial->Count;
+				const FVector& FrameForward = Partial->Forward;
+				const FVector FrameRight(-FrameForward.Y, FrameForward.X, 0.f);
+
+				Aggregate.AliveCount = Partial->Count;
+				Aggregate.Centroid = Partial->SumLocation * InvCount;
+				Aggregate.AverageVelocity = Partial->SumVelocity * InvCount;
+				Aggregate.AverageTargetLocation = Partial->SumTargetLocation * InvCount;
+				Aggregate.MaxSpeed = Partial->MaxSpeed;
+
+				const FVector2D BoundsCenter2D = (Partial->MinProjection + Partial->MaxProjection) * 0.5f;
+				Aggregate.BoundsExtent = (Partial->MaxProjection - Partial->MinProjection) * 0.5f;
+				Aggregate.BoundsCenter = FrameForward * BoundsCenter2D.X + FrameRight * BoundsCenter2D.Y;
+				Aggregate.BoundsCenter.Z = Aggregate.Centroid.Z;
+
+				// nobody in front band (squad turned around), whole width is the front
+				Aggregate.FrontLineExtents = Partial->FrontMinRight <= Partial->FrontMaxRight
+					? FVector2D(Partial->FrontMinRight - BoundsCenter2D.Y, Partial->FrontMaxRight - BoundsCenter2D.Y)
+					: FVector2D(-Aggregate.BoundsExtent.Y, Aggregate.BoundsExtent.Y);
+
+				// facing follows movement, then direction to target, otherwise stays
+				FVector NewForward = Aggregate.Forward;
+				const FVector ToTarget = Aggregate.AverageTargetLocation - Aggregate.Centroid;
+				if (Aggregate.AverageVelocity.SizeSquared2D() > FMath::Square(UE::Mass::Squad::FacingMinSpeed))
+				{
+					NewForward = Aggregate.AverageVelocity.GetSafeNormal2D();
+				}
+				else if (ToTarget.SizeSquared2D() > FMath::Square(RankDepth))
+				{
+					NewForward = ToTarget.GetSafeNormal2D();
+				}
+
+				const FVector FrontPoint = Aggregate.BoundsCenter + FrameForward * Aggregate.BoundsExtent.X;
+				UE::Mass::Squad::FSquadAggregateFrame& Frame = SquadFrames.Add(SquadSharedFragment.SquadIndex);
+				Frame.Forward = NewForward;
+				Frame.FrontLineProjection = (FrontPoint | NewForward) - RankDepth;
+				Aggregate.Forward = NewForward;
+
+				FTransform& Transform = TransformFragments[EntityIdx].GetMutableTransform();
+				Transform.SetLocation(Aggregate.Centroid);
+				Transform.SetRotation(Aggregate.GetFacingQuat());
+				TargetLocationFragments[EntityIdx].Target = Aggregate.AverageTargetLocation;
 				
 				// draw debug
 				#if WITH_MASSGAMEPLAY_DEBUG && WITH_EDITOR
@@ -278,7 +395,8 @@ void UMassSquadUnitsPostSpawnProcessor::ConfigureQueries()
 {
 	EntityQuery_Unit.AddRequirement<FETW_MassUnitFragment>(EMassFragmentAccess::ReadWrite);
 	EntityQuery_Unit.AddRequirement<FETW_MassTeamFragment>(EMassFragmentAccess::ReadWrite);
-	EntityQuery_Unit.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Unit.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Unit.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery_Unit.AddConstSharedRequirement<FETW_MassSquadParams>();
 
 	EntityQuery_Unit.AddSubsystemRequirement<UETW_MassSquadSubsystem>(EMassFragmentAccess::ReadWrite);
@@ -291,33 +409,127 @@ void UMassSquadUnitsPostSpawnProcessor::Execute(FMassEntityManager& EntityManage
 		UE_VLOG_UELOG(this, LogMass, Log, TEXT("Execution context has invalid AuxData or it's not FMassSquadSpawnData. Entity transforms won't be initialized."));
 		return;
 	}
-	
-	EntityQuery_Unit.ForEachEntityChunk(EntityManager, Context, [](FMassExecutionContext& Context)
-	{
-		const FMassSquadUnitsSpawnAuxData& AuxData = Context.GetAuxData().Get<FMassSquadUnitsSpawnAuxData>();
 
-		UETW_MassSquadSubsystem* SquadSubsystem = Context.GetMutableSubsystem<UETW_MassSquadSubsystem>();
-		if (SquadSubsystem == nullptr)
-		{
-			ensureMsgf(false, TEXT("UETW_MassSquadSubsystem subsystem not found in %s"), __FUNCTION__);
-			return;
-		}
-		FMassSquadManager& SquadManager = SquadSubsystem->GetMutablSquadManager();
+	const FMassSquadUnitsSpawnAuxData& AuxData = Context.GetAuxData().Get<FMassSquadUnitsSpawnAuxData>();
 
+	UETW_MassSquadSubsystem* SquadSubsystem = UWorld::GetSubsystem<UETW_MassSquadSubsystem>(EntityManager.GetWorld());
+	check(SquadSubsystem);
+	FMassSquadManager& SquadManager = SquadSubsystem->GetMutablSquadManager();
+
+	// spawn batch may contain many squads, formation slots are assigned over all units of a squad so gather them first
+	SpawnGroups.Reset();
+	EntityQuery_Unit.ParallelForEachEntityChunk(EntityManager, Context, [this, &AuxData, &SquadManager](FMassExecutionContext& Context)
+	{
+		const FETW_MassSquadSharedFragment& SquadSharedFragment = Context.GetSharedFragment<FETW_MassSquadSharedFragment>();
+		const FETW_MassSquadParams& SquadParams = Context.GetConstSharedFragment<FETW_MassSquadParams>();
+
+		const TConstArrayView<FTransformFragment> TransformFragments = Context.GetFragmentView<FTransformFragment>();
 		const TArrayView<FETW_MassTeamFragment> TeamFragments = Context.GetMutableFragmentView<FETW_MassTeamFragment>();
 		const TArrayView<FETW_MassUnitFragment> UnitFragments = Context.GetMutableFragmentView<FETW_MassUnitFragment>();
-		
+
+		// units are localized in frame of their own squad, batch may spawn squads far apart
+		const FTransform* SquadTransform = AuxData.SquadTransforms.Find(SquadSharedFragment.SquadIndex);
+		const FTransform& InitialTransform = SquadTransform ? *SquadTransform : AuxData.SquadInitialTransform;
+
 		// initialize unit entities
 		const int32 NumEntities = Context.GetNumEntities();
+		TArray<FVector2D, TInlineAllocator<256>> UnitLocations;
+		UnitLocations.Reserve(NumEntities);
 		for (int32 EntityIdx = 0; EntityIdx < NumEntities; EntityIdx++)
 		{
 			TeamFragments[EntityIdx].TeamIndex = AuxData.TeamIndex;
 			UnitFragments[EntityIdx].UnitIndex = SquadManager.GetUnitId();
+
+			const FVector LocalLocation = InitialTransform.InverseTransformPositionNoScale(TransformFragments[EntityIdx].GetTransform().GetLocation());
+			UnitLocations.Emplace(LocalLocation.X, LocalLocation.Y);
 		}
 		// --- end initialize unit entities
-		
+
+		int32 FirstUnitIdx = 0;
+		{
+			FScopeLock Lock(&SpawnGroupsCS);
+			UE::Mass::Squad::FSquadSpawnGroup& Group = SpawnGroups.FindOrAdd(SquadSharedFragment.SquadIndex);
+			Group.Formation = SquadSharedFragment.Formation;
+			Group.SlotSpacing = FETW_MassFormationSolver::GetSlotSpacing(SquadSharedFragment.Formation, SquadParams);
+			FirstUnitIdx = Group.Units.Num();
+			Group.Units.Append(Context.GetEntities());
+			Group.UnitLocations.Append(UnitLocations);
+		}
+
+		// slot isn't known yet, keep unit position in its spawn group until slots are solved
+		for (int32 EntityIdx = 0; EntityIdx < NumEntities; EntityIdx++)
+		{
+			UnitFragments[EntityIdx].SlotIndex = FirstUnitIdx + EntityIdx;
+		}
 	});
-	
+
+	if (SpawnGroups.IsEmpty())
+	{
+		return;
+	}
+
+	// squads are independent, solve them in parallel
+	TArray<UE::Mass::Squad::FSquadSpawnGroup*> Groups;
+	Groups.Reserve(SpawnGroups.Num());
+	for (TPair<uint32, UE::Mass::Squad::FSquadSpawnGroup>& GroupPair : SpawnGroups)
+	{
+		Groups.Add(&GroupPair.Value);
+	}
+
+	FETW_MassFormationSolver& FormationSolver = SquadSubsystem->GetFormationSolver();
+	ParallelFor(Groups.Num(), [&Groups, &FormationSolver](const int32 GroupIdx)
+	{
+		UE::Mass::Squad::FSquadSpawnGroup& Group = *Groups[GroupIdx];
+
+		Group.Slots = FormationSolver.GetSlots(Group.Formation, Group.SlotSpacing, Group.UnitLocations.Num());
+
+		// spawner hands out generated locations in any order, slots are matched to where units actually are.
+		// Formation is centered on units, so units keep their spawn spot as close as possible
+		FVector2D UnitsCenter = FVector2D::ZeroVector;
+		for (const FVector2D& Location : Group.UnitLocations)
+		{
+			UnitsCenter += Location;
+		}
+		UnitsCenter /= Group.UnitLocations.Num();
+
+		FVector2D SlotsCenter = FVector2D::ZeroVector;
+		for (const FVector2D& Offset : Group.Slots->Offsets)
+		{
+			SlotsCenter += Offset;
+		}
+		SlotsCenter /= FMath::Max(Group.Slots->Offsets.Num(), 1);
+
+		for (FVector2D& Location : Group.UnitLocations)
+		{
+			Location += SlotsCenter - UnitsCenter;
+		}
+
+		FETW_MassFormationSolver::AssignSlots(Group.UnitLocations, Group.Slots->Offsets, Group.Formation.Length, Group.UnitSlots);
+	});
+
+	// groups are read only from here
+	EntityQuery_Unit.ParallelForEachEntityChunk(EntityManager, Context, [this](FMassExecutionContext& Context)
+	{
+		const FETW_MassSquadSharedFragment& SquadSharedFragment = Context.GetSharedFragment<FETW_MassSquadSharedFragment>();
+		const UE::Mass::Squad::FSquadSpawnGroup& Group = SpawnGroups.FindChecked(SquadSharedFragment.SquadIndex);
+
+		const TArrayView<FETW_MassUnitFragment> UnitFragments = Context.GetMutableFragmentView<FETW_MassUnitFragment>();
+		for (int32 EntityIdx = 0; EntityIdx < Context.GetNumEntities(); EntityIdx++)
+		{
+			FETW_MassUnitFragment& UnitFragment = UnitFragments[EntityIdx];
+			const int32 SlotIndex = Group.UnitSlots[UnitFragment.SlotIndex];
+			UnitFragment.SlotIndex = SlotIndex;
+			UnitFragment.FormationOffset = Group.Slots->Offsets.IsValidIndex(SlotIndex) ? Group.Slots->Offsets[SlotIndex] : FVector2D::ZeroVector;
+		}
+	});
+
+	// slot occupancy lives in registry, casualties close ranks from there
+	for (TPair<uint32, UE::Mass::Squad::FSquadSpawnGroup>& GroupPair : SpawnGroups)
+	{
+		UE::Mass::Squad::FSquadSpawnGroup& Group = GroupPair.Value;
+		SquadManager.EnqueueAssignSlots(GroupPair.Key, Group.Units, Group.UnitSlots, Group.Slots.ToSharedRef());
+	}
+	SpawnGroups.Reset();
 }
 
 
@@ -332,7 +544,8 @@ void UMassSquadPostSpawnProcessor::ConfigureQueries()
 	EntityQuery_Squad.AddRequirement<FETW_MassSquadCommanderFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery_Squad.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadWrite);
 	EntityQuery_Squad.AddRequirement<FETW_MassTeamFragment>(EMassFragmentAccess::ReadOnly);
-
+	EntityQuery_Squad.AddRequirement<FETW_MassSquadAggregateFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery_Squad.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadOnly);
 }
 
 void UMassSquadPostSpawnProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
@@ -342,22 +555,102 @@ void UMassSquadPostSpawnProcessor::Execute(FMassEntityManager& EntityManager, FM
 		UE_VLOG_UELOG(this, LogMass, Log, TEXT("Execution context has invalid AuxData or it's not FMassSquadSpawnData. Entity transforms won't be initialized."));
 		return;
 	}
-	EntityQuery_Squad.ForEachEntityChunk(EntityManager, Context, [](FMassExecutionContext& Context)
+	EntityQuery_Squad.ParallelForEachEntityChunk(EntityManager, Context, [](FMassExecutionContext& Context)
 	{
 		const FMassSquadUnitsSpawnAuxData& AuxData = Context.GetAuxData().Get<FMassSquadUnitsSpawnAuxData>();
+		const FETW_MassSquadSharedFragment& SquadSharedFragment = Context.GetSharedFragment<FETW_MassSquadSharedFragment>();
+
+		// every squad has its own shared fragment, so one placement per chunk
+		const FTransform* SquadTransform = AuxData.SquadTransforms.Find(SquadSharedFragment.SquadIndex);
+		const FTransform& InitialTransform = SquadTransform ? *SquadTransform : AuxData.SquadInitialTransform;
 
 		const TArrayView<FETW_MassTeamFragment> TeamFragments = Context.GetMutableFragmentView<FETW_MassTeamFragment>();
 		const TArrayView<FTransformFragment> TransformFragments = Context.GetMutableFragmentView<FTransformFragment>();
 		const TArrayView<FETW_MassSquadCommanderFragment> CommanderFragments = Context.GetMutableFragmentView<FETW_MassSquadCommanderFragment>();
+		const TArrayView<FETW_MassSquadAggregateFragment> AggregateFragments = Context.GetMutableFragmentView<FETW_MassSquadAggregateFragment>();
 				
 		// initialize squad entities
 		const int32 NumEntities = Context.GetNumEntities();
 		for (int32 EntityIdx = 0; EntityIdx < NumEntities; EntityIdx++)
 		{
 			TeamFragments[EntityIdx].TeamIndex = AuxData.TeamIndex;
-			TransformFragments[EntityIdx].SetTransform(AuxData.SquadInitialTransform);
+			TransformFragments[EntityIdx].SetTransform(InitialTransform);
 			CommanderFragments[EntityIdx].CommanderComp = AuxData.CommanderComp.Get();
+
+			// standing squad keeps aggregate facing, start from the one squad was spawned with
+			FETW_MassSquadAggregateFragment& Aggregate = AggregateFragments[EntityIdx];
+			Aggregate.Forward = InitialTransform.GetRotation().GetForwardVector().GetSafeNormal2D(UE_SMALL_NUMBER, FVector::ForwardVector);
+			Aggregate.Centroid = InitialTransform.GetLocation();
+			Aggregate.BoundsCenter = InitialTransform.GetLocation();
 		}
 		// --- end initialize squad entities
 	});
 }
+
+
+UMassSquadUnitsRemovedObserver::UMassSquadUnitsRemovedObserver()
+	: EntityQuery_Unit(*this)
+{
+	ObservedType = FETW_MassUnitFragment::StaticStruct();
+	Operation = EMassObservedOperation::Remove;
+	ExecutionFlags = (int32)(EProcessorExecutionFlags::Server | EProcessorExecutionFlags::Standalone);
+}
+
+void UMassSquadUnitsRemovedObserver::ConfigureQueries()
+{
+	EntityQuery_Unit.AddRequirement<FETW_MassUnitFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Unit.AddSubsystemRequirement<UETW_MassSquadSubsystem>(EMassFragmentAccess::ReadWrite);
+}
+
+void UMassSquadUnitsRemovedObserver::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	EntityQuery_Unit.ForEachEntityChunk(EntityManager, Context, [](FMassExecutionContext& Context)
+	{
+		UETW_MassSquadSubsystem* SquadSubsystem = Context.GetMutableSubsystem<UETW_MassSquadSubsystem>();
+		if (SquadSubsystem == nullptr)
+		{
+			return;
+		}
+
+		// whole chunk in one command, applied to registry at next sync point
+		SquadSubsystem->GetMutablSquadManager().EnqueueRemoveUnits(Context.GetEntities());
+	});
+}
+
+
+UMassSquadRemovedObserver::UMassSquadRemovedObserver()
+	: EntityQuery_Squad(*this)
+{
+	ObservedType = FETW_MassSquadCommanderFragment::StaticStruct();
+	Operation = EMassObservedOperation::Remove;
+	ExecutionFlags = (int32)(EProcessorExecutionFlags::Server | EProcessorExecutionFlags::Standalone);
+}
+
+void UMassSquadRemovedObserver::ConfigureQueries()
+{
+	EntityQuery_Squad.AddRequirement<FETW_MassSquadCommanderFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Squad.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery_Squad.AddSubsystemRequirement<UETW_MassSquadSubsystem>(EMassFragmentAccess::ReadWrite);
+}
+
+void UMassSquadRemovedObserver::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	EntityQuery_Squad.ForEachEntityChunk(EntityManager, Context, [](FMassExecutionContext& Context)
+	{
+		UETW_MassSquadSubsystem* SquadSubsystem = Context.GetMutableSubsystem<UETW_MassSquadSubsystem>();
+		if (SquadSubsystem == nullptr)
+		{
+			return;
+		}
+
+		const FETW_MassSquadSharedFragment& SquadSharedFragment = Context.GetSharedFragment<FETW_MassSquadSharedFragment>();
+		FMassSquadManager& SquadManager = SquadSubsystem->GetMutablSquadManager();
+
+		// shared fragment can be a template default one, such squad never was registered.
+		// registration may still be pending in command queue, so don't validate against snapshot here
+		if (SquadSharedFragment.SquadIndex != UE::Mass::Squad::InvalidSquadIndex)
+		{
+			SquadManager.EnqueueUnregisterSquad(SquadSharedFragment.SquadIndex);
+		}
+	});
+}
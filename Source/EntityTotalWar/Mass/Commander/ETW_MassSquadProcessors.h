@@ -3,8 +3,59 @@
 #pragma once
 
 #include "ETW_MassSquadFragments.h"
+#include "MassObserverProcessor.h"
 #include "ETW_MassSquadProcessors.generated.h"
 
+struct FETW_MassFormationSlots;
+
+namespace UE::Mass::Squad
+{
+	/** Partial sums of one units chunk, chunks are merged into per squad value by UETW_MassSquadProcessor */
+	struct FSquadAggregatePartial
+	{
+		FVector SumLocation = FVector::ZeroVector;
+		FVector SumVelocity = FVector::ZeroVector;
+		FVector SumTargetLocation = FVector::ZeroVector;
+		int32 Count = 0;
+
+		// squad frame axis the projections are taken on, same for all partials of a squad
+		FVector Forward = FVector::ForwardVector;
+
+		// projections on squad frame axes
+		FVector2D MinProjection = FVector2D(MAX_flt);
+		FVector2D MaxProjection = FVector2D(-MAX_flt);
+
+		// right axis projection range of units in front rank band
+		float FrontMinRight = MAX_flt;
+		float FrontMaxRight = -MAX_flt;
+
+		// max speed of the slowest unit
+		float MaxSpeed = MAX_flt;
+
+		void Merge(const FSquadAggregatePartial& Other);
+	};
+
+	/** Squad facing from previous frame, used as OBB axes for the current one */
+	struct FSquadAggregateFrame
+	{
+		FVector Forward = FVector::ForwardVector;
+		float FrontLineProjection = -MAX_flt;
+	};
+
+	/** Units of one spawned squad, gathered from all spawned chunks so formation slots are assigned over whole squad */
+	struct FSquadSpawnGroup
+	{
+		FETW_MassFormation Formation;
+		float SlotSpacing = 0.f;
+		TArray<FMassEntityHandle> Units;
+		TArray<FVector2D> UnitLocations;
+
+		// solved slot per unit, same order as Units
+		TArray<int32> UnitSlots;
+		TSharedPtr<const FETW_MassFormationSlots> Slots;
+	};
+}
+
 UCLASS()
 class ENTITYTOTALWAR_API UETW_MassSquadProcessor : public UMassProcessor
 {
@@ -23,6 +74,13 @@ protected:
 
 	UPROPERTY(Transient)
 	TObjectPtr<class UETW_MassSquadSubsystem> SquadSubsystem = nullptr;
+
+	// keyed by squad index, filled by parallel unit pass, consumed by squad pass
+	TMap<uint32, UE::Mass::Squad::FSquadAggregatePartial> SquadPartials;
+	FCriticalSection SquadPartialsCS;
+
+	// keyed by squad index, written by squad pass, read only during unit pass
+	TMap<uint32, UE::Mass::Squad::FSquadAggregateFrame> SquadFrames;
 };
 
 UCLASS()
@@ -38,6 +96,10 @@ protected:
 	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
 
 	FMassEntityQuery EntityQuery_Unit;
+
+	// keyed by squad index, spawn batch may contain many squads
+	TMap<uint32, UE::Mass::Squad::FSquadSpawnGroup> SpawnGroups;
+	FCriticalSection SpawnGroupsCS;
 };
 
 
@@ -55,3 +117,37 @@ protected:
 
 	FMassEntityQuery EntityQuery_Squad;
 };
+
+
+/** Removes destroyed unit entities from squad registry */
+UCLASS()
+class ENTITYTOTALWAR_API UMassSquadUnitsRemovedObserver : public UMassObserverProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UMassSquadUnitsRemovedObserver();
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+
+	FMassEntityQuery EntityQuery_Unit;
+};
+
+
+/** Unregisters destroyed squad entities from squad registry */
+UCLASS()
+class ENTITYTOTALWAR_API UMassSquadRemovedObserver : public UMassObserverProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UMassSquadRemovedObserver();
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+
+	FMassEntityQuery EntityQuery_Squad;
+};
@@ -4,6 +4,7 @@
 #include "ETW_MassSquadSubsystem.h"
 
 #include "ETW_MassSubsystem.h"
+#include "MassEntityUtils.h"
 #include "MassReplicationSubsystem.h"
 #include "MassSimulationSubsystem.h"
 #include "Replication/Squad/ETW_MassSquadBubble.h"
@@ -26,6 +27,416 @@ void FMassSquadManager::Initialize()
 
 void FMassSquadManager::Deinitialize()
 {
+	CommandQueue.Empty();
+	OrderQueue.Empty();
+	LastAppliedCommands.Reset();
+	RegistryBuffers[0].Reset();
+	RegistryBuffers[1].Reset();
+}
+
+void FMassSquadManager::EnqueueRegisterSquad(const uint32 SquadIndex, const FMassEntityHandle SquadEntity, const int8 TeamIndex)
+{
+	check(SquadIndex != UE::Mass::Squad::InvalidSquadIndex);
+
+	FETW_MassSquadRegistryCommand Command;
+	Command.Type = EETW_MassSquadRegistryCommandType::RegisterSquad;
+	Command.SquadIndex = SquadIndex;
+	Command.SquadEntity = SquadEntity;
+	Command.TeamIndex = TeamIndex;
+	CommandQueue.Enqueue(MoveTemp(Command));
+}
+
+void FMassSquadManager::EnqueueUnregisterSquad(const uint32 SquadIndex)
+{
+	FETW_MassSquadRegistryCommand Command;
+	Command.Type = EETW_MassSquadRegistryCommandType::UnregisterSquad;
+	Command.SquadIndex = SquadIndex;
+	CommandQueue.Enqueue(MoveTemp(Command));
+}
+
+void FMassSquadManager::EnqueueAddUnits(const uint32 SquadIndex, TConstArrayView<FMassEntityHandle> Units)
+{
+	FETW_MassSquadRegistryCommand Command;
+	Command.Type = EETW_MassSquadRegistryCommandType::AddUnits;
+	Command.SquadIndex = SquadIndex;
+	Command.Units = Units;
+	CommandQueue.Enqueue(MoveTemp(Command));
+}
+
+void FMassSquadManager::EnqueueRemoveUnits(TConstArrayView<FMassEntityHandle> Units)
+{
+	FETW_MassSquadRegistryCommand Command;
+	Command.Type = EETW_MassSquadRegistryCommandType::RemoveUnits;
+	Command.Units = Units;
+	CommandQueue.Enqueue(MoveTemp(Command));
+}
+
+void FMassSquadManager::EnqueueAssignSlots(const uint32 SquadIndex, TConstArrayView<FMassEntityHandle> Units, TConstArrayView<int32> SlotIndices,
+	const TSharedRef<const FETW_MassFormationSlots>& FormationSlots)
+{
+	check(Units.Num() == SlotIndices.Num());
+
+	FETW_MassSquadRegistryCommand Command;
+	Command.Type = EETW_MassSquadRegistryCommandType::AssignSlots;
+	Command.SquadIndex = SquadIndex;
+	Command.Units = Units;
+	Command.SlotIndices = SlotIndices;
+	Command.FormationSlots = FormationSlots;
+	CommandQueue.Enqueue(MoveTemp(Command));
+}
+
+void FMassSquadManager::EnqueueOrder(const FETW_MassSquadOrder& Order)
+{
+	OrderQueue.Enqueue(Order);
+}
+
+void FMassSquadManager::DrainOrders(TMap<uint32, FETW_MassSquadPendingOrders>& OutOrders)
+{
+	FETW_MassSquadOrder Order;
+	while (OrderQueue.Dequeue(Order))
+	{
+		OutOrders.FindOrAdd(Order.SquadIndex).Merge(Order);
+	}
+}
+
+void FMassSquadManager::ApplyCommand(FETW_MassSquadRegistry& Registry, const FETW_MassSquadRegistryCommand& Command, TArray<FMassEntityHandle>* OutReassignedUnits)
+{
+	switch (Command.Type)
+	{
+	case EETW_MassSquadRegistryCommandType::RegisterSquad:
+		Registry.RegisterSquad(Command.SquadIndex, Command.SquadEntity, Command.TeamIndex);
+		break;
+	case EETW_MassSquadRegistryCommandType::UnregisterSquad:
+		Registry.UnregisterSquad(Command.SquadIndex);
+		break;
+	case EETW_MassSquadRegistryCommandType::AddUnits:
+		Registry.BatchAddUnits(Command.SquadIndex, Command.Units);
+		break;
+	case EETW_MassSquadRegistryCommandType::RemoveUnits:
+		Registry.BatchRemoveUnits(Command.Units, OutReassignedUnits);
+		break;
+	case EETW_MassSquadRegistryCommandType::AssignSlots:
+		Registry.BatchAssignSlots(Command.SquadIndex, Command.Units, Command.SlotIndices, Command.FormationSlots);
+		break;
+	default:
+		checkNoEntry();
+		break;
+	}
+}
+
+bool FMassSquadManager::FlushCommands()
+{
+	check(IsInGameThread());
+	QUICK_SCOPE_CYCLE_COUNTER(FMassSquadManager_FlushCommands);
+
+	ReassignedUnits.Reset();
+
+	if (CommandQueue.IsEmpty() && LastAppliedCommands.IsEmpty())
+	{
+		return false;
+	}
+
+	const int32 WriteRegistryIndex = 1 - ReadRegistryIndex;
+	FETW_MassSquadRegistry& WriteRegistry = RegistryBuffers[WriteRegistryIndex];
+
+	// bring back buffer to the state of published one
+	for (const FETW_MassSquadRegistryCommand& Command : LastAppliedCommands)
+	{
+		ApplyCommand(WriteRegistry, Command, nullptr);
+	}
+	LastAppliedCommands.Reset();
+
+	FETW_MassSquadRegistryCommand Command;
+	while (CommandQueue.Dequeue(Command))
+	{
+		ApplyCommand(WriteRegistry, Command, &ReassignedUnits);
+		LastAppliedCommands.Add(MoveTemp(Command));
+	}
+
+	ReadRegistryIndex = WriteRegistryIndex;
+	return true;
+}
+
+void FETW_MassSquadRegistry::Reset()
+{
+	Squads.Reset();
+	SquadIndexToDenseIndex.Reset();
+	EntityToUnitLocation.Reset();
+}
+
+const FETW_MassSquadRecord* FETW_MassSquadRegistry::FindSquadRecord(const uint32 SquadIndex) const
+{
+	if (!SquadIndexToDenseIndex.IsValidIndex(SquadIndex))
+	{
+		return nullptr;
+	}
+	const int32 DenseIndex = SquadIndexToDenseIndex[SquadIndex];
+	return DenseIndex != INDEX_NONE ? &Squads[DenseIndex] : nullptr;
+}
+
+FETW_MassSquadRecord* FETW_MassSquadRegistry::FindSquadRecord(const uint32 SquadIndex)
+{
+	return const_cast<FETW_MassSquadRecord*>(static_cast<const FETW_MassSquadRegistry*>(this)->FindSquadRecord(SquadIndex));
+}
+
+const FETW_MassSquadUnitLocation* FETW_MassSquadRegistry::FindUnitLocation(const FMassEntityHandle Unit) const
+{
+	if (!EntityToUnitLocation.IsValidIndex(Unit.Index))
+	{
+		return nullptr;
+	}
+	const FETW_MassSquadUnitLocation& Location = EntityToUnitLocation[Unit.Index];
+	return Location.SquadIndex != UE::Mass::Squad::InvalidSquadIndex && Location.SerialNumber == Unit.SerialNumber ? &Location : nullptr;
+}
+
+void FETW_MassSquadRegistry::RegisterSquad(const uint32 SquadIndex, const FMassEntityHandle SquadEntity, const int8 TeamIndex)
+{
+	check(SquadIndex != UE::Mass::Squad::InvalidSquadIndex);
+
+	if (FETW_MassSquadRecord* ExistingRecord = FindSquadRecord(SquadIndex))
+	{
+		ExistingRecord->SquadEntity = SquadEntity;
+		ExistingRecord->TeamIndex = TeamIndex;
+		return;
+	}
+
+	if (!SquadIndexToDenseIndex.IsValidIndex(SquadIndex))
+	{
+		const int32 OldNum = SquadIndexToDenseIndex.Num();
+		SquadIndexToDenseIndex.SetNumUninitialized(SquadIndex + 1);
+		for (int32 Idx = OldNum; Idx < SquadIndexToDenseIndex.Num(); Idx++)
+		{
+			SquadIndexToDenseIndex[Idx] = INDEX_NONE;
+		}
+	}
+
+	FETW_MassSquadRecord& Record = Squads.AddDefaulted_GetRef();
+	Record.SquadIndex = SquadIndex;
+	Record.SquadEntity = SquadEntity;
+	Record.TeamIndex = TeamIndex;
+	SquadIndexToDenseIndex[SquadIndex] = Squads.Num() - 1;
+}
+
+void FETW_MassSquadRegistry::UnregisterSquad(const uint32 SquadIndex)
+{
+	if (!SquadIndexToDenseIndex.IsValidIndex(SquadIndex) || SquadIndexToDenseIndex[SquadIndex] == INDEX_NONE)
+	{
+		return;
+	}
+
+	const int32 DenseIndex = SquadIndexToDenseIndex[SquadIndex];
+	for (const FMassEntityHandle Unit : Squads[DenseIndex].Units)
+	{
+		EntityToUnitLocation[Unit.Index] = FETW_MassSquadUnitLocation();
+	}
+
+	Squads.RemoveAtSwap(DenseIndex, 1, /*bAllowShrinking=*/false);
+	if (Squads.IsValidIndex(DenseIndex))
+	{
+		SquadIndexToDenseIndex[Squads[DenseIndex].SquadIndex] = DenseIndex;
+	}
+	SquadIndexToDenseIndex[SquadIndex] = INDEX_NONE;
+}
+
+void FETW_MassSquadRegistry::BatchAddUnits(const uint32 SquadIndex, TConstArrayView<FMassEntityHandle> Units)
+{
+	FETW_MassSquadRecord* Record = FindSquadRecord(SquadIndex);
+	if (!ensureMsgf(Record, TEXT("Squad %u should be registered before adding units"), SquadIndex))
+	{
+		return;
+	}
+
+	int32 MaxEntityIndex = EntityToUnitLocation.Num() - 1;
+	for (const FMassEntityHandle Unit : Units)
+	{
+		MaxEntityIndex = FMath::Max(MaxEntityIndex, Unit.Index);
+	}
+	if (MaxEntityIndex >= EntityToUnitLocation.Num())
+	{
+		EntityToUnitLocation.SetNum(MaxEntityIndex + 1);
+	}
+
+	Record->Units.Reserve(Record->Units.Num() + Units.Num());
+	for (const FMassEntityHandle Unit : Units)
+	{
+		FETW_MassSquadUnitLocation& Location = EntityToUnitLocation[Unit.Index];
+		if (Location.SquadIndex != UE::Mass::Squad::InvalidSquadIndex && Location.SerialNumber == Unit.SerialNumber)
+		{
+			// already registered, move between squads is remove + add
+			continue;
+		}
+
+		Location.SquadIndex = SquadIndex;
+		Location.UnitSlot = Record->Units.Add(Unit);
+		Location.SerialNumber = Unit.SerialNumber;
+	}
+}
+
+void FETW_MassSquadRegistry::BatchAssignSlots(const uint32 SquadIndex, TConstArrayView<FMassEntityHandle> Units, TConstArrayView<int32> SlotIndices,
+	const TSharedPtr<const FETW_MassFormationSlots>& FormationSlots)
+{
+	FETW_MassSquadRecord* Record = FindSquadRecord(SquadIndex);
+	if (!ensureMsgf(Record && FormationSlots.IsValid(), TEXT("Squad %u should be registered before assigning slots"), SquadIndex))
+	{
+		return;
+	}
+
+	// new layout, previous occupancy is dropped
+	for (const FMassEntityHandle Occupant : Record->SlotOccupants)
+	{
+		if (Occupant.IsSet())
+		{
+			EntityToUnitLocation[Occupant.Index].FormationSlot = INDEX_NONE;
+		}
+	}
+	Record->FormationSlots = FormationSlots;
+	Record->SlotOccupants.Reset();
+	Record->SlotOccupants.SetNum(FormationSlots->Offsets.Num());
+
+	for (int32 Idx = 0; Idx < Units.Num(); Idx++)
+	{
+		const FMassEntityHandle Unit = Units[Idx];
+		const int32 FormationSlot = SlotIndices[Idx];
+		const FETW_MassSquadUnitLocation* Location = FindUnitLocation(Unit);
+		if (Location == nullptr || Location->SquadIndex != SquadIndex || !Record->SlotOccupants.IsValidIndex(FormationSlot))
+		{
+			continue;
+		}
+
+		EntityToUnitLocation[Unit.Index].FormationSlot = FormationSlot;
+		Record->SlotOccupants[FormationSlot] = Unit;
+	}
+}
+
+void FETW_MassSquadRegistry::CloseRanks(FETW_MassSquadRecord& Record, int32 VacantSlot, TArray<FMassEntityHandle>* OutReassignedUnits)
+{
+	if (!Record.FormationSlots.IsValid())
+	{
+		return;
+	}
+
+	// each step moves one unit a rank forward, vacancy travels back until nobody is behind it
+	while (Record.SlotOccupants.IsValidIndex(VacantSlot) && !Record.SlotOccupants[VacantSlot].IsSet())
+	{
+		const int32 DonorSlot = FETW_MassFormationSolver::FindRankDonorSlot(Record.FormationSlots->Offsets, Record.SlotOccupants, VacantSlot);
+		if (DonorSlot == INDEX_NONE)
+		{
+			break;
+		}
+
+		const FMassEntityHandle Donor = Record.SlotOccupants[DonorSlot];
+		Record.SlotOccupants[DonorSlot] = FMassEntityHandle();
+		Record.SlotOccupants[VacantSlot] = Donor;
+		EntityToUnitLocation[Donor.Index].FormationSlot = VacantSlot;
+		if (OutReassignedUnits)
+		{
+			OutReassignedUnits->Add(Donor);
+		}
+
+		VacantSlot = DonorSlot;
+	}
+}
+
+void FETW_MassSquadRegistry::BatchRemoveUnits(TConstArrayView<FMassEntityHandle> Units, TArray<FMassEntityHandle>* OutReassignedUnits)
+{
+	struct FVacantSlot
+	{
+		uint32 SquadIndex;
+		int32 Slot;
+	};
+	TArray<FVacantSlot, TInlineAllocator<64>> VacantSlots;
+
+	for (const FMassEntityHandle Unit : Units)
+	{
+		const FETW_MassSquadUnitLocation* Location = FindUnitLocation(Unit);
+		if (Location == nullptr)
+		{
+			continue;
+		}
+
+		FETW_MassSquadRecord* Record = FindSquadRecord(Location->SquadIndex);
+		const int32 UnitSlot = Location->UnitSlot;
+		const int32 FormationSlot = Location->FormationSlot;
+		EntityToUnitLocation[Unit.Index] = FETW_MassSquadUnitLocation();
+
+		if (Record == nullptr)
+		{
+			continue;
+		}
+
+		if (Record->SlotOccupants.IsValidIndex(FormationSlot) && Record->SlotOccupants[FormationSlot] == Unit)
+		{
+			Record->SlotOccupants[FormationSlot] = FMassEntityHandle();
+			VacantSlots.Add({ Record->SquadIndex, FormationSlot });
+		}
+		
+		check(Record->Units.IsValidIndex(UnitSlot) && Record->Units[UnitSlot] == Unit);
+		Record->Units.RemoveAtSwap(UnitSlot, 1, /*bAllowShrinking=*/false);
+		if (Record->Units.IsValidIndex(UnitSlot))
+		{
+			EntityToUnitLocation[Record->Units[UnitSlot].Index].UnitSlot = UnitSlot;
+		}
+	}
+
+	// all casualties of the batch are out first, so dead units are never pulled forward.
+	// front vacancies first, reassigned units come out grouped per squad
+	VacantSlots.Sort([](const FVacantSlot& A, const FVacantSlot& B)
+	{
+		return A.SquadIndex != B.SquadIndex ? A.SquadIndex < B.SquadIndex : A.Slot < B.Slot;
+	});
+	for (const FVacantSlot& VacantSlot : VacantSlots)
+	{
+		if (FETW_MassSquadRecord* Record = FindSquadRecord(VacantSlot.SquadIndex))
+		{
+			CloseRanks(*Record, VacantSlot.Slot, OutReassignedUnits);
+		}
+	}
+}
+
+FMassEntityHandle FETW_MassSquadRegistry::GetSquadEntity(const uint32 SquadIndex) const
+{
+	const FETW_MassSquadRecord* Record = FindSquadRecord(SquadIndex);
+	return Record ? Record->SquadEntity : FMassEntityHandle();
+}
+
+TConstArrayView<FMassEntityHandle> FETW_MassSquadRegistry::GetSquadUnits(const uint32 SquadIndex) const
+{
+	const FETW_MassSquadRecord* Record = FindSquadRecord(SquadIndex);
+	return Record ? TConstArrayView<FMassEntityHandle>(Record->Units) : TConstArrayView<FMassEntityHandle>();
+}
+
+uint32 FETW_MassSquadRegistry::GetUnitSquadIndex(const FMassEntityHandle Unit) const
+{
+	const FETW_MassSquadUnitLocation* Location = FindUnitLocation(Unit);
+	return Location ? Location->SquadIndex : UE::Mass::Squad::InvalidSquadIndex;
+}
+
+FMassEntityHandle FETW_MassSquadRegistry::GetUnitSquadEntity(const FMassEntityHandle Unit) const
+{
+	return GetSquadEntity(GetUnitSquadIndex(Unit));
+}
+
+int32 FETW_MassSquadRegistry::GetUnitIndexInSquad(const FMassEntityHandle Unit) const
+{
+	const FETW_MassSquadUnitLocation* Location = FindUnitLocation(Unit);
+	return Location ? Location->UnitSlot : INDEX_NONE;
+}
+
+int32 FETW_MassSquadRegistry::GetUnitFormationSlot(const FMassEntityHandle Unit) const
+{
+	const FETW_MassSquadUnitLocation* Location = FindUnitLocation(Unit);
+	return Location ? Location->FormationSlot : INDEX_NONE;
+}
+
+void FETW_MassSquadRegistry::GetTeamSquads(const int8 TeamIndex, TArray<uint32>& OutSquadIndices) const
+{
+	for (const FETW_MassSquadRecord& Record : Squads)
+	{
+		if (Record.TeamIndex == TeamIndex)
+		{
+			OutSquadIndices.Add(Record.SquadIndex);
+		}
+	}
 }
 
 void FMassSquadManager::AddReferencedObjects(FReferenceCollector& Collector)
@@ -35,6 +446,7 @@ void FMassSquadManager::AddReferencedObjects(FReferenceCollector& Collector)
 
 UETW_MassSquadSubsystem::UETW_MassSquadSubsystem()
 	: SquadManager(MakeShareable(new FMassSquadManager(this)))
+	, FormationSolver(MakeShared<FETW_MassFormationSolver>())
 {
 	SquadUnitsPostSpawnProcessor = NewObject<UMassSquadUnitsPostSpawnProcessor>(this, UMassSquadUnitsPostSpawnProcessor::StaticClass(), FName(GetName() + TEXT("_MassSquadUnitsPostSpawnProc")));
 	SquadPostSpawnProcessor = NewObject<UMassSquadPostSpawnProcessor>(this, UMassSquadPostSpawnProcessor::StaticClass(), FName(GetName() + TEXT("_MassSquadPostSpawnProc")));
@@ -64,6 +476,21 @@ UMassProcessor* UETW_MassSquadSubsystem::GetSpawnDataInitializer(TSubclassOf<UMa
 	return *Initializer;
 }
 
+bool UETW_MassSquadSubsystem::RequestSquadMove(const uint32 SquadIndex, const FVector& Destination)
+{
+	if (!SquadManager->GetRegistry().IsSquadRegistered(SquadIndex))
+	{
+		return false;
+	}
+
+	FETW_MassSquadOrder Order;
+	Order.Type = EETW_MassSquadOrderType::Move;
+	Order.SquadIndex = SquadIndex;
+	Order.Location = Destination;
+	SquadManager->EnqueueOrder(Order);
+	return true;
+}
+
 void UETW_MassSquadSubsystem::Initialize(FSubsystemCollectionBase& Collection)
 {
 	Collection.InitializeDependency<UMassSimulationSubsystem>();
@@ -77,6 +504,10 @@ void UETW_MassSquadSubsystem::Initialize(FSubsystemCollectionBase& Collection)
 
 	ensure(SquadPostSpawnProcessor);
 	SquadPostSpawnProcessor->Initialize(*this);
+
+	UMassSimulationSubsystem* SimSystem = UWorld::GetSubsystem<UMassSimulationSubsystem>(GetWorld());
+	check(SimSystem);
+	SimSystem->GetOnProcessingPhaseStarted(EMassProcessingPhase::PrePhysics).AddUObject(this, &UETW_MassSquadSubsystem::OnPrePhysicsPhaseStarted);
 }
 
 void UETW_MassSquadSubsystem::PostInitialize()
@@ -92,7 +523,106 @@ void UETW_MassSquadSubsystem::PostInitialize()
 
 void UETW_MassSquadSubsystem::Deinitialize()
 {
+	if (UMassSimulationSubsystem* SimSystem = UWorld::GetSubsystem<UMassSimulationSubsystem>(GetWorld()))
+	{
+		SimSystem->GetOnProcessingPhaseStarted(EMassProcessingPhase::PrePhysics).RemoveAll(this);
+	}
+
 	SquadManager->Deinitialize();
+	FormationSolver->Reset();
+	Engagements.Reset();
+}
+
+void UETW_MassSquadSubsystem::OnPrePhysicsPhaseStarted(const float DeltaSeconds)
+{
+	if (SquadManager->FlushCommands())
+	{
+		ApplyReassignedSlots();
+	}
+}
+
+void UETW_MassSquadSubsystem::ApplyReassignedSlots()
+{
+	const TConstArrayView<FMassEntityHandle> ReassignedUnits = SquadManager->GetReassignedUnits();
+	if (ReassignedUnits.IsEmpty())
+	{
+		return;
+	}
+
+	QUICK_SCOPE_CYCLE_COUNTER(UETW_MassSquadSubsystem_ApplyReassignedSlots);
+
+	// sync point, no processor is running so fragments are written directly
+	FMassEntityManager& EntityManager = UE::Mass::Utils::GetEntityManagerChecked(*GetWorld());
+	const FETW_MassSquadRegistry& Registry = SquadManager->GetRegistry();
+
+	// units come grouped per squad, squad frame is resolved once per batch
+	uint32 BatchSquadIndex = UE::Mass::Squad::InvalidSquadIndex;
+	const FETW_MassSquadRecord* Record = nullptr;
+	FVector Origin = FVector::ZeroVector;
+	FVector Forward = FVector::ForwardVector;
+
+	for (const FMassEntityHandle Unit : ReassignedUnits)
+	{
+		const int32 FormationSlot = Registry.GetUnitFormationSlot(Unit);
+		if (FormationSlot == INDEX_NONE || !EntityManager.IsEntityValid(Unit))
+		{
+			continue;
+		}
+
+		const uint32 SquadIndex = Registry.GetUnitSquadIndex(Unit);
+		if (SquadIndex != BatchSquadIndex)
+		{
+			BatchSquadIndex = SquadIndex;
+			Record = Registry.FindSquadRecord(SquadIndex);
+			if (Record == nullptr || !Record->FormationSlots.IsValid() || !EntityManager.IsEntityValid(Record->SquadEntity))
+			{
+				Record = nullptr;
+				continue;
+			}
+
+			// current placement and facing of the squad
+			if (const FETW_MassSquadAggregateFragment* Aggregate = EntityManager.GetFragmentDataPtr<FETW_MassSquadAggregateFragment>(Record->SquadEntity))
+			{
+				Origin = Aggregate->Centroid;
+				Forward = Aggregate->Forward;
+			}
+			else
+			{
+				Origin = EntityManager.GetFragmentDataChecked<FTransformFragment>(Record->SquadEntity).GetTransform().GetLocation();
+				Forward = FVector::ForwardVector;
+			}
+
+			if (FETW_MassSquadMoveFragment* MoveFragment = EntityManager.GetFragmentDataPtr<FETW_MassSquadMoveFragment>(Record->SquadEntity))
+			{
+				if (MoveFragment->State == EETW_MassSquadMoveState::Idle && !MoveFragment->bReformRanks)
+				{
+					// idle squad stays idle and keeps its facing, formation move processor walks units to their new slots
+					MoveFragment->AnchorLocation = Origin;
+					MoveFragment->AnchorForward = Forward;
+					MoveFragment->bReformRanks = true;
+				}
+				Origin = MoveFragment->AnchorLocation;
+				Forward = MoveFragment->AnchorForward;
+			}
+		}
+
+		if (Record == nullptr)
+		{
+			continue;
+		}
+
+		const FVector2D& Offset = Record->FormationSlots->Offsets[FormationSlot];
+		const FVector Right(-Forward.Y, Forward.X, 0.f);
+
+		FETW_MassUnitFragment& UnitFragment = EntityManager.GetFragmentDataChecked<FETW_MassUnitFragment>(Unit);
+		UnitFragment.SlotIndex = FormationSlot;
+		UnitFragment.FormationOffset = Offset;
+
+		if (FMassTargetLocationFragment* TargetLocationFragment = EntityManager.GetFragmentDataPtr<FMassTargetLocationFragment>(Unit))
+		{
+			TargetLocationFragment->Target = Origin + Forward * Offset.X + Right * Offset.Y;
+		}
+	}
 }
 
 void UETW_MassSquadSubsystem::OnWorldBeginPlay(UWorld& InWorld)
@@ -3,11 +3,124 @@
 #pragma once
 
 #include "ETW_MassTypes.h"
+#include "ETW_MassFormation.h"
+#include "ETW_MassSquadEngagement.h"
+#include "ETW_MassSquadOrders.h"
+#include "Containers/Queue.h"
 #include "Subsystems/WorldSubsystem.h"
 #include "ETW_MassSquadProcessors.h"
 
 #include "ETW_MassSquadSubsystem.generated.h"
 
+/** Registry record of one squad, units are stored contiguous so squad level queries are a single array read */
+struct ENTITYTOTALWAR_API FETW_MassSquadRecord
+{
+	uint32 SquadIndex = UE::Mass::Squad::InvalidSquadIndex;
+	FMassEntityHandle SquadEntity;
+	int8 TeamIndex = 0;
+	TArray<FMassEntityHandle> Units;
+
+	// formation slot -> unit, invalid handle for vacant slot. Empty until slots are assigned
+	TArray<FMassEntityHandle> SlotOccupants;
+	TSharedPtr<const FETW_MassFormationSlots> FormationSlots;
+};
+
+/** Where unit is stored in registry: owning squad and position in squad units array */
+struct FETW_MassSquadUnitLocation
+{
+	uint32 SquadIndex = UE::Mass::Squad::InvalidSquadIndex;
+	int32 UnitSlot = INDEX_NONE;
+	int32 SerialNumber = 0;  // guards against recycled entity indices
+	int32 FormationSlot = INDEX_NONE;
+};
+
+/**
+ * Squad to units topology. Instances published by FMassSquadManager are immutable between two sync points,
+ * so any number of processors can read them from worker threads without locks.
+ * Unit handles can belong to entities destroyed during current frame, validate them before accessing fragments.
+ */
+struct ENTITYTOTALWAR_API FETW_MassSquadRegistry
+{
+	friend struct FMassSquadManager;
+
+	bool IsSquadRegistered(const uint32 SquadIndex) const { return FindSquadRecord(SquadIndex) != nullptr; }
+
+	// entity handle of squad entity, invalid handle if squad is not registered
+	FMassEntityHandle GetSquadEntity(const uint32 SquadIndex) const;
+
+	// contiguous units of squad, empty if squad is not registered
+	TConstArrayView<FMassEntityHandle> GetSquadUnits(const uint32 SquadIndex) const;
+
+	// squad index of unit entity, UE::Mass::Squad::InvalidSquadIndex if unit is not registered
+	uint32 GetUnitSquadIndex(const FMassEntityHandle Unit) const;
+	FMassEntityHandle GetUnitSquadEntity(const FMassEntityHandle Unit) const;
+
+	// position of unit in GetSquadUnits() array, INDEX_NONE if unit is not registered
+	int32 GetUnitIndexInSquad(const FMassEntityHandle Unit) const;
+
+	// formation slot of unit, INDEX_NONE if unit is not registered or has no slot
+	int32 GetUnitFormationSlot(const FMassEntityHandle Unit) const;
+
+	void GetTeamSquads(const int8 TeamIndex, TArray<uint32>& OutSquadIndices) const;
+	TConstArrayView<FETW_MassSquadRecord> GetSquads() const { return Squads; }
+
+	const FETW_MassSquadRecord* FindSquadRecord(const uint32 SquadIndex) const;
+
+private:
+	FETW_MassSquadRecord* FindSquadRecord(const uint32 SquadIndex);
+	const FETW_MassSquadUnitLocation* FindUnitLocation(const FMassEntityHandle Unit) const;
+
+	void RegisterSquad(const uint32 SquadIndex, const FMassEntityHandle SquadEntity, const int8 TeamIndex);
+	void UnregisterSquad(const uint32 SquadIndex);
+	void BatchAddUnits(const uint32 SquadIndex, TConstArrayView<FMassEntityHandle> Units);
+	void BatchAssignSlots(const uint32 SquadIndex, TConstArrayView<FMassEntityHandle> Units, TConstArrayView<int32> SlotIndices, const TSharedPtr<const FETW_MassFormationSlots>& FormationSlots);
+
+	// removed units leave their slots vacant, ranks behind close them. Units which got new slot are added to OutReassignedUnits
+	void BatchRemoveUnits(TConstArrayView<FMassEntityHandle> Units, TArray<FMassEntityHandle>* OutReassignedUnits);
+	void CloseRanks(FETW_MassSquadRecord& Record, int32 VacantSlot, TArray<FMassEntityHandle>* OutReassignedUnits);
+	void Reset();
+
+	// dense squad records, order is not stable (swap removal)
+	TArray<FETW_MassSquadRecord> Squads;
+
+	// sparse set: squad index -> index in Squads, INDEX_NONE when squad is not registered
+	TArray<int32> SquadIndexToDenseIndex;
+
+	// indexed by FMassEntityHandle::Index, gives owning squad and position inside its units array
+	TArray<FETW_MassSquadUnitLocation> EntityToUnitLocation;
+};
+
+enum class EETW_MassSquadRegistryCommandType : uint8
+{
+	RegisterSquad,
+	UnregisterSquad,
+	AddUnits,
+	RemoveUnits,
+	AssignSlots
+};
+
+/** Registry mutation, queued from any thread and applied at sync point */
+struct FETW_MassSquadRegistryCommand
+{
+	EETW_MassSquadRegistryCommandType Type = EETW_MassSquadRegistryCommandType::AddUnits;
+	uint32 SquadIndex = UE::Mass::Squad::InvalidSquadIndex;
+	FMassEntityHandle SquadEntity;
+	int8 TeamIndex = 0;
+	TArray<FMassEntityHandle> Units;
+
+	// AssignSlots only, slot index per unit
+	TArray<int32> SlotIndices;
+	TSharedPtr<const FETW_MassFormationSlots> FormationSlots;
+};
+
+/**
+ * Squad manager concurrency model:
+ * - readers (processors on any thread) use GetRegistry(), the snapshot published at last sync point, no locks.
+ * - writers (spawn code, observers, processors) use Enqueue* functions, lock free MPSC queue.
+ * - FlushCommands() is the sync point, called on game thread at start of PrePhysics processing phase,
+ *   when no processor is running. Registry is double buffered, commands are applied to the back buffer
+ *   and replayed next frame on the other one, so publishing does not copy the whole registry.
+ */
 struct ENTITYTOTALWAR_API FMassSquadManager : public TSharedFromThis<FMassSquadManager>, public FGCObject
 {
 	FMassSquadManager() = delete;
@@ -30,25 +143,51 @@ private:
 	TWeakObjectPtr<UObject> Owner;
 
 	std::atomic<uint32> UnitIdGenerator = 0;
-	std::atomic<uint32> SquadIdGenerator = 0;
+	std::atomic<uint32> SquadIdGenerator = 1;  // 0 is reserved for UE::Mass::Squad::InvalidSquadIndex
+
+	FETW_MassSquadRegistry RegistryBuffers[2];
+	int32 ReadRegistryIndex = 0;
+
+	TQueue<FETW_MassSquadRegistryCommand, EQueueMode::Mpsc> CommandQueue;
 
-	TMultiMap<uint32, uint32> SquadToEntityMap;
-	TMap<uint32, uint32> EntityToSquadMap;
+	// commands applied at last flush, replayed on the other buffer to keep both in sync
+	TArray<FETW_MassSquadRegistryCommand> LastAppliedCommands;
+
+	// player orders, consumed by UETW_MassSquadOrderProcessor
+	TQueue<FETW_MassSquadOrder, EQueueMode::Mpsc> OrderQueue;
+
+	// units moved to another formation slot at last flush (rank closing), can contain duplicates
+	TArray<FMassEntityHandle> ReassignedUnits;
+
+	// OutReassignedUnits is null on replay, changes were already reported when command was applied first time
+	static void ApplyCommand(FETW_MassSquadRegistry& Registry, const FETW_MassSquadRegistryCommand& Command, TArray<FMassEntityHandle>* OutReassignedUnits);
 
 public:
 	// Squad Manager functions
 	uint32 GetSquadId() { return SquadIdGenerator.fetch_add(1); };
 	uint32 GetUnitId() { return UnitIdGenerator.fetch_add(1); };
-	
-	// Map unit to squad
 
-	//entity handle get squad entity (squad index, manager)
-	//array<entityhandle> get units entity (squad index, manager)
-	//get squad entity from unit id (unit index, manager)
-	// get squads of team (team index, manager)
+	// snapshot published at last sync point, safe to read from any thread until next sync point
+	const FETW_MassSquadRegistry& GetRegistry() const { return RegistryBuffers[ReadRegistryIndex]; }
+
+	// Map unit to squad, thread safe, visible in registry after next FlushCommands
+	void EnqueueRegisterSquad(const uint32 SquadIndex, const FMassEntityHandle SquadEntity, const int8 TeamIndex);
+	void EnqueueUnregisterSquad(const uint32 SquadIndex);
+	void EnqueueAddUnits(const uint32 SquadIndex, TConstArrayView<FMassEntityHandle> Units);
+	void EnqueueRemoveUnits(TConstArrayView<FMassEntityHandle> Units);
+	void EnqueueAssignSlots(const uint32 SquadIndex, TConstArrayView<FMassEntityHandle> Units, TConstArrayView<int32> SlotIndices, const TSharedRef<const FETW_MassFormationSlots>& FormationSlots);
+
+	// sync point, game thread only, returns true if new registry snapshot was published
+	bool FlushCommands();
 
-	//TArray<FMassAgentLookupData> AgentLookupArray;
-	//TMap<FMassNetworkID, FMassReplicatedAgentHandle> NetworkIDToAgentHandleMap;
+	// thread safe, order is applied by next UETW_MassSquadOrderProcessor run
+	void EnqueueOrder(const FETW_MassSquadOrder& Order);
+
+	// single consumer, merges queued orders per squad
+	void DrainOrders(TMap<uint32, FETW_MassSquadPendingOrders>& OutOrders);
+
+	// units which formation slot changed during last FlushCommands, slot is read from registry
+	TConstArrayView<FMassEntityHandle> GetReassignedUnits() const { return ReassignedUnits; }
 
 	// End Squad Manager functions
 };
@@ -73,19 +212,35 @@ class ENTITYTOTALWAR_API UETW_MassSquadSubsystem : public UWorldSubsystem
 	/** Creates all runtime data using main collection */
 	void InitializeRuntime();
 
+	/** Squad manager sync point */
+	void OnPrePhysicsPhaseStarted(const float DeltaSeconds);
+
+	/** Pushes slots changed by rank closing to unit entities, batched per squad */
+	void ApplyReassignedSlots();
+
 public:
 
 	UETW_MassSquadSubsystem();
 	FMassSquadManager& GetMutablSquadManager() const { check(SquadManager); return *SquadManager.Get(); }
-	const FMassSquadManager& GetSquadManager() { check(SquadManager); return *SquadManager.Get(); }
+	const FMassSquadManager& GetSquadManager() const { check(SquadManager); return *SquadManager.Get(); }
+	FETW_MassFormationSolver& GetFormationSolver() const { check(FormationSolver); return *FormationSolver.Get(); }
+
+	// engaged squad pairs of current frame, valid for processors running after UETW_MassSquadEngagementProcessor
+	const FETW_MassSquadEngagements& GetEngagements() const { return Engagements; }
+	FETW_MassSquadEngagements& GetMutableEngagements() { return Engagements; }
 
 	UMassSquadUnitsPostSpawnProcessor* GetSquadUnitsPostSpawnProcessor() const { return SquadUnitsPostSpawnProcessor; }
 	UMassSquadPostSpawnProcessor* GetSquadPostSpawnProcessor() const { return SquadPostSpawnProcessor; }
 
 	UMassProcessor* GetSpawnDataInitializer(TSubclassOf<UMassProcessor> InitializerClass);
+
+	/** Orders squad to move as a whole, squad requests single path and units follow their formation slots along it. Queued, see UETW_MassSquadOrderProcessor */
+	bool RequestSquadMove(const uint32 SquadIndex, const FVector& Destination);
 	
 protected:
     TSharedPtr<FMassSquadManager> SquadManager;
+	TSharedPtr<FETW_MassFormationSolver> FormationSolver;
+	FETW_MassSquadEngagements Engagements;
 
 	UPROPERTY()
 	TObjectPtr<UMassSquadUnitsPostSpawnProcessor> SquadUnitsPostSpawnProcessor;
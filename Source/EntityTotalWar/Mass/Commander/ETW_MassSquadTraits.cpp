@@ -36,6 +36,11 @@ void UETW_MassSquadTrait::BuildTemplate(FMassEntityTemplateBuildContext& BuildCo
 	BuildContext.AddFragment<FTransformFragment>();
 	BuildContext.AddFragment<FAgentRadiusFragment>();
 	BuildContext.AddFragment<FETW_MassTeamFragment>();
+	BuildContext.AddFragment<FETW_MassSquadAggregateFragment>();
+	BuildContext.AddFragment<FETW_MassSquadMoveFragment>();
+	BuildContext.AddFragment<FETW_MassSquadStateFragment>();
+	BuildContext.AddFragment<FETW_MassSquadLODFragment>();
+	BuildContext.AddFragment<FMassPathFragment>();
 	//BuildContext.AddFragment<FAgentRadiusFragment>();  // actually required for replication
 	
 	FETW_MassSquadSharedFragment SquadSharedFragment;
@@ -64,6 +69,7 @@ void UETW_MassSquadUnitTrait::BuildTemplate(FMassEntityTemplateBuildContext& Bui
 	BuildContext.RequireFragment<FAgentRadiusFragment>();
 	BuildContext.AddFragment<FETW_MassUnitFragment>();  
 	BuildContext.AddFragment<FETW_MassTeamFragment>(); 
+	BuildContext.AddFragment<FETW_MassFormationFollowFragment>();
 	
 	FETW_MassSquadSharedFragment SquadSharedFragment;
 	SquadSharedFragment.Formation = Params.DefaultFormation;
@@ -3,15 +3,18 @@
 
 #include "MassCommanderComponent.h"
 
+#include "ETW_MassFormationSpawnGenerator.h"
 #include "ETW_MassSquadProcessors.h"
 #include "MassEntityConfigAsset.h"
 #include "MassEntityEQSSpawnPointsGenerator.h"
 #include "MassSpawnerSubsystem.h"
 #include "MassSpawnerTypes.h"
 #include "Camera/CameraComponent.h"
+#include "Engine/AssetManager.h"
 #include "Net/UnrealNetwork.h"
 #include "VisualLogger/VisualLogger.h"
 #include "MassExecutor.h"
+#include "MassSimulationSubsystem.h"
 #include "ETW_MassSquadSubsystem.h"
 #include "ETW_MassSquadTraits.h"
 #include "Math/UnitConversion.h"
@@ -62,6 +65,7 @@ bool UMassCommanderComponent::RaycastCommandTarget(const FVector& ClientCursorLo
 
 UMassCommanderComponent::UMassCommanderComponent()
 {
+	// generated squads are materialized from Mass phase end, see OnPostPhysicsPhaseFinished
 	PrimaryComponentTick.bCanEverTick = false;
 	SetIsReplicatedByDefault(true);
 	bWantsInitializeComponent = true;
@@ -92,6 +96,31 @@ void UMassCommanderComponent::ServerProcessInputAction_Implementation(FVector_Ne
 	OnCommandProcessedDelegate.Broadcast(CommandTraceResult);
 }
 
+void UMassCommanderComponent::IssueSquadOrder(const FETW_MassSquadOrder& Order)
+{
+	ServerIssueSquadOrder(Order);
+}
+
+void UMassCommanderComponent::ServerIssueSquadOrder_Implementation(const FETW_MassSquadOrder& Order)
+{
+	UETW_MassSquadSubsystem* SquadSubsystem = UWorld::GetSubsystem<UETW_MassSquadSubsystem>(GetWorld());
+	if (SquadSubsystem == nullptr)
+	{
+		return;
+	}
+
+	FMassSquadManager& SquadManager = SquadSubsystem->GetMutablSquadManager();
+	const FETW_MassSquadRecord* Record = SquadManager.GetRegistry().FindSquadRecord(Order.SquadIndex);
+	if (Record == nullptr || Record->TeamIndex != static_cast<int8>(TeamIndex))
+	{
+		UE_VLOG_UELOG(this, ETW_Mass, Warning, TEXT("Squad order rejected, squad %u is not registered or not owned by commander team %d"), Order.SquadIndex, TeamIndex);
+		return;
+	}
+
+	// no fragment writes here, spam clicks collapse into one order per squad in UETW_MassSquadOrderProcessor
+	SquadManager.EnqueueOrder(Order);
+}
+
 void UMassCommanderComponent::BeginPlay()
 {
 	Super::BeginPlay();
@@ -99,6 +128,20 @@ void UMassCommanderComponent::BeginPlay()
 	RegisterEntityTemplates();
 }
 
+void UMassCommanderComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (PostPhysicsPhaseFinishedHandle.IsValid())
+	{
+		if (UMassSimulationSubsystem* SimSystem = UWorld::GetSubsystem<UMassSimulationSubsystem>(GetWorld()))
+		{
+			SimSystem->GetOnProcessingPhaseFinished(EMassProcessingPhase::PostPhysics).Remove(PostPhysicsPhaseFinishedHandle);
+		}
+		PostPhysicsPhaseFinishedHandle.Reset();
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
 void UMassCommanderComponent::InitializeComponent()
 {
 	Super::InitializeComponent();
@@ -113,62 +156,275 @@ void UMassCommanderComponent::InitializeComponent()
 
 void UMassCommanderComponent::RegisterEntityTemplates()
 {
+	TArray<FSoftObjectPath> TemplatePaths;
+	TemplatePaths.Reserve(PreLoadTemplates.Num());
+	for (const TSoftObjectPtr<UMassEntityConfigAsset>& ConfigAssetSoftRef : PreLoadTemplates)
+	{
+		if (!ConfigAssetSoftRef.IsNull())
+		{
+			TemplatePaths.AddUnique(ConfigAssetSoftRef.ToSoftObjectPath());
+		}
+	}
+
+	if (!TemplatePaths.IsEmpty())
+	{
+		EntityTemplateLoadHandles.Add(UAssetManager::GetStreamableManager().RequestAsyncLoad(TemplatePaths,
+			FStreamableDelegate::CreateUObject(this, &UMassCommanderComponent::OnEntityTemplatesLoaded, TemplatePaths)));
+	}
+}
+
+void UMassCommanderComponent::OnEntityTemplatesLoaded(TArray<FSoftObjectPath> LoadedPaths)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(UMassCommanderComponent_OnEntityTemplatesLoaded);
+
 	UWorld* World = GetWorld();
-	check(World);
-	for (TSoftObjectPtr<UMassEntityConfigAsset>& ConfigAssetSoftRef : PreLoadTemplates)
+	if (World == nullptr)
 	{
-		if (const UMassEntityConfigAsset* EntityConfig = ConfigAssetSoftRef.LoadSynchronous())
+		return;
+	}
+
+	// building template creates its archetype and shared fragments, first spawn only looks them up
+	TArray<FSoftObjectPath> ReferencedPaths;
+	for (const FSoftObjectPath& LoadedPath : LoadedPaths)
+	{
+		const UMassEntityConfigAsset* EntityConfig = Cast<UMassEntityConfigAsset>(LoadedPath.ResolveObject());
+		if (EntityConfig == nullptr || WarmedUpEntityTemplates.Contains(LoadedPath))
 		{
-			EntityConfig->GetOrCreateEntityTemplate(*World);
+			continue;
+		}
+		WarmedUpEntityTemplates.Add(LoadedPath);
+
+		const FMassEntityTemplate& EntityTemplate = EntityConfig->GetOrCreateEntityTemplate(*World);
+		for (const FConstSharedStruct& ConstSharedStruct : EntityTemplate.GetSharedFragmentValues().GetConstSharedFragments())
+		{
+			// unit templates reference squad entity template, warm it up too
+			if (const FETW_MassSquadParams* SquadParams = ConstSharedStruct.GetPtr<FETW_MassSquadParams>())
+			{
+				const FSoftObjectPath SquadTemplatePath = SquadParams->SquadEntityTemplate.ToSoftObjectPath();
+				if (!SquadTemplatePath.IsNull() && !WarmedUpEntityTemplates.Contains(SquadTemplatePath))
+				{
+					ReferencedPaths.AddUnique(SquadTemplatePath);
+				}
+				break;
+			}
 		}
 	}
+
+	if (!ReferencedPaths.IsEmpty())
+	{
+		EntityTemplateLoadHandles.Add(UAssetManager::GetStreamableManager().RequestAsyncLoad(ReferencedPaths,
+			FStreamableDelegate::CreateUObject(this, &UMassCommanderComponent::OnEntityTemplatesLoaded, ReferencedPaths)));
+		return;
+	}
+
+	UE_VLOG_UELOG(this, ETW_Mass, Log, TEXT("%d entity templates warmed up"), WarmedUpEntityTemplates.Num());
 }
 
 void UMassCommanderComponent::Server_SpawnSquad_Implementation(FSoftObjectPath EntityTemplatePath, int32 NumToSpawn,  FSoftObjectPath PointGeneratorPath)
 {
-	if (bSquadEntitiesSpawnInProgress)
+	GenerateSquadsSpawnData(MakeArrayView(&EntityTemplatePath, 1), NumToSpawn, PointGeneratorPath);
+}
+
+void UMassCommanderComponent::Server_SpawnSquads_Implementation(const TArray<FSoftObjectPath>& EntityTemplatePaths, int32 NumPerSquad, FSoftObjectPath PointGeneratorPath)
+{
+	GenerateSquadsSpawnData(EntityTemplatePaths, NumPerSquad, PointGeneratorPath);
+}
+
+static const UETW_MassSquadUnitTrait* FindSquadUnitTrait(const UMassEntityConfigAsset& EntityConfig)
+{
+	const UMassEntityTraitBase* const* Trait = EntityConfig.GetConfig().GetTraits().FindByPredicate([](const UMassEntityTraitBase* Trait){ return Trait && Trait->IsA<UETW_MassSquadUnitTrait>(); });
+	return Trait ? CastChecked<UETW_MassSquadUnitTrait>(*Trait) : nullptr;
+}
+
+void UMassCommanderComponent::GenerateSquadsSpawnData(TConstArrayView<FSoftObjectPath> EntityTemplatePaths, int32 NumPerSquad, const FSoftObjectPath& PointGeneratorPath, int32 LoadPass)
+{
+	if (EntityTemplatePaths.IsEmpty() || NumPerSquad <= 0)
 	{
-		UE_VLOG_UELOG(this, ETW_Mass, Error, TEXT("UMassCommanderComponent::Server_SpawnSquad_Implementation spawning squad allready in progress"));
+		return;
 	}
-	
-	bSquadEntitiesSpawnInProgress = true;
-	
-	UClass* PointGeneratorClass = StaticCast<UClass*>(PointGeneratorPath.TryLoad());
-	UMassEntityEQSSpawnPointsGenerator* SpawnPointGeneratorCDO = CastChecked<UMassEntityEQSSpawnPointsGenerator>(PointGeneratorClass->ClassDefaultObject);
 
-	UMassEntityConfigAsset* EntityConfig = StaticCast<UMassEntityConfigAsset*>(EntityTemplatePath.TryLoad());
-	EntityConfig->GetOrCreateEntityTemplate(*GetWorld());
+	// unit configs and generator come first, squad templates are known once unit configs are there. Paths still missing
+	// after that don't exist and are skipped below
+	static constexpr int32 MaxLoadPasses = 2;
+	TArray<FSoftObjectPath> PathsToLoad;
+	if (!PointGeneratorPath.IsNull() && PointGeneratorPath.ResolveObject() == nullptr)
+	{
+		PathsToLoad.Add(PointGeneratorPath);
+	}
+	for (const FSoftObjectPath& EntityTemplatePath : EntityTemplatePaths)
+	{
+		if (const UMassEntityConfigAsset* EntityConfig = Cast<UMassEntityConfigAsset>(EntityTemplatePath.ResolveObject()))
+		{
+			const UETW_MassSquadUnitTrait* SquadUnitTrait = FindSquadUnitTrait(*EntityConfig);
+			const FSoftObjectPath SquadTemplatePath = SquadUnitTrait ? SquadUnitTrait->SquadEntityTemplate.ToSoftObjectPath() : FSoftObjectPath();
+			if (!SquadTemplatePath.IsNull() && SquadTemplatePath.ResolveObject() == nullptr)
+			{
+				PathsToLoad.AddUnique(SquadTemplatePath);
+			}
+		}
+		else if (!EntityTemplatePath.IsNull())
+		{
+			PathsToLoad.AddUnique(EntityTemplatePath);
+		}
+	}
 
-	bool bHasSquadTrait = EntityConfig->GetConfig().GetTraits().FindByPredicate([](const UMassEntityTraitBase* Trait){return Trait->IsA<UETW_MassSquadUnitTrait>(); }) != nullptr;
-	ensureMsgf(bHasSquadTrait, TEXT("%s Mass Commander Component can only spawn from entity config that containts squad entity trait!"), *EntityConfig->GetName());
+	if (!PathsToLoad.IsEmpty() && LoadPass < MaxLoadPasses)
+	{
+		EntityTemplateLoadHandles.Add(UAssetManager::GetStreamableManager().RequestAsyncLoad(PathsToLoad,
+			FStreamableDelegate::CreateUObject(this, &UMassCommanderComponent::OnSpawnAssetsLoaded, TArray<FSoftObjectPath>(EntityTemplatePaths), NumPerSquad, PointGeneratorPath, LoadPass + 1)));
+		return;
+	}
 	
-	FMassSpawnedEntityType EntityType;
-	EntityType.EntityConfig = EntityTemplatePath;
-	EntityType.Proportion = 1.f;
-	PendingSpawnEntityTypes.Empty();
-	PendingSpawnEntityTypes.Add(EntityType);
+	// native formation generator by default, no EQS query latency
+	UClass* PointGeneratorClass = PointGeneratorPath.IsNull() ? UETW_MassFormationSpawnGenerator::StaticClass() : Cast<UClass>(PointGeneratorPath.ResolveObject());
+	if (PointGeneratorClass == nullptr || !PointGeneratorClass->IsChildOf<UMassEntitySpawnDataGeneratorBase>())
+	{
+		UE_VLOG_UELOG(this, ETW_Mass, Error, TEXT("Squads not spawned, %s is not a spawn data generator class"), *PointGeneratorPath.ToString());
+		return;
+	}
+	const UMassEntitySpawnDataGeneratorBase* SpawnPointGeneratorCDO = PointGeneratorClass->GetDefaultObject<UMassEntitySpawnDataGeneratorBase>();
 
-	
-	
-	FFinishedGeneratingSpawnDataSignature Delegate = FFinishedGeneratingSpawnDataSignature::CreateUObject(this, &UMassCommanderComponent::OnSpawnQueryGeneratorFinished);
-	SpawnPointGeneratorCDO->Generate(*GetOwner(), TArrayView<FMassSpawnedEntityType>(PendingSpawnEntityTypes), NumToSpawn, Delegate);
+	TArray<FMassSpawnedEntityType> EntityTypes;
+	EntityTypes.Reserve(EntityTemplatePaths.Num());
+	for (const FSoftObjectPath& EntityTemplatePath : EntityTemplatePaths)
+	{
+		UMassEntityConfigAsset* EntityConfig = Cast<UMassEntityConfigAsset>(EntityTemplatePath.ResolveObject());
+		if (EntityConfig == nullptr)
+		{
+			UE_VLOG_UELOG(this, ETW_Mass, Error, TEXT("Squad not spawned, %s is not a mass entity config"), *EntityTemplatePath.ToString());
+			continue;
+		}
+
+		if (FindSquadUnitTrait(*EntityConfig) == nullptr)
+		{
+			UE_VLOG_UELOG(this, ETW_Mass, Error, TEXT("Squad not spawned, %s has no squad unit trait"), *EntityConfig->GetName());
+			continue;
+		}
+		EntityConfig->GetOrCreateEntityTemplate(*GetWorld());
+		
+		// equal proportions, generator splits points evenly between squads
+		FMassSpawnedEntityType EntityType;
+		EntityType.EntityConfig = EntityTemplatePath;
+		EntityType.Proportion = 1.f;
+		EntityTypes.Add(EntityType);
+	}
+
+	if (EntityTypes.IsEmpty())
+	{
+		return;
+	}
+
+	FETW_MassSquadSpawnRequest& Request = SpawnRequests.AddDefaulted_GetRef();
+	Request.RequestId = NextSpawnRequestId++;
+	Request.EntityTypes = EntityTypes;
+
+	// generator may finish synchronously and remove the request, so nothing is read from it after Generate
+	const uint32 RequestId = Request.RequestId;
+	FFinishedGeneratingSpawnDataSignature Delegate = FFinishedGeneratingSpawnDataSignature::CreateUObject(this, &UMassCommanderComponent::OnSpawnQueryGeneratorFinished, RequestId);
+	SpawnPointGeneratorCDO->Generate(*GetOwner(), EntityTypes, NumPerSquad * EntityTypes.Num(), Delegate);
+}
+
+void UMassCommanderComponent::OnSpawnAssetsLoaded(TArray<FSoftObjectPath> EntityTemplatePaths, int32 NumPerSquad, FSoftObjectPath PointGeneratorPath, int32 LoadPass)
+{
+	GenerateSquadsSpawnData(EntityTemplatePaths, NumPerSquad, PointGeneratorPath, LoadPass);
 }
 
 void UMassCommanderComponent::SpawnSquad(TSoftObjectPtr<UMassEntityConfigAsset> EntityTemplate, int32 NumToSpawn,
-	TSoftClassPtr<UMassEntityEQSSpawnPointsGenerator> PointGenerator)
+	TSoftClassPtr<UMassEntitySpawnDataGeneratorBase> PointGenerator)
 {
 	Server_SpawnSquad(EntityTemplate.ToSoftObjectPath(), NumToSpawn, PointGenerator.ToSoftObjectPath());
 }
 
-void UMassCommanderComponent::OnSpawnQueryGeneratorFinished(TConstArrayView<FMassEntitySpawnDataGeneratorResult> Results)
+void UMassCommanderComponent::SpawnSquads(const TArray<TSoftObjectPtr<UMassEntityConfigAsset>>& EntityTemplates, int32 NumPerSquad,
+	TSoftClassPtr<UMassEntitySpawnDataGeneratorBase> PointGenerator)
 {
-	if (Results.Num() > 1)
+	TArray<FSoftObjectPath> EntityTemplatePaths;
+	EntityTemplatePaths.Reserve(EntityTemplates.Num());
+	for (const TSoftObjectPtr<UMassEntityConfigAsset>& EntityTemplate : EntityTemplates)
 	{
-		UE_VLOG_UELOG(this, ETW_Mass, Error, TEXT("UMassCommanderComponent::SpawnSquad supports only one archeotype to spawn"));
-		check(false);
-		//return;
+		EntityTemplatePaths.Add(EntityTemplate.ToSoftObjectPath());
 	}
-	
+	Server_SpawnSquads(EntityTemplatePaths, NumPerSquad, PointGenerator.ToSoftObjectPath());
+}
+
+void UMassCommanderComponent::OnSpawnQueryGeneratorFinished(TConstArrayView<FMassEntitySpawnDataGeneratorResult> Results, uint32 RequestId)
+{
+	const int32 RequestIdx = SpawnRequests.IndexOfByPredicate([RequestId](const FETW_MassSquadSpawnRequest& Request) { return Request.RequestId == RequestId; });
+	if (RequestIdx == INDEX_NONE)
+	{
+		return;
+	}
+
+	// results of all requests are coalesced, materialized by budget in OnPostPhysicsPhaseFinished
+	const FETW_MassSquadSpawnRequest& Request = SpawnRequests[RequestIdx];
+	for (const FMassEntitySpawnDataGeneratorResult& Result : Results)
+	{
+		if (Result.NumEntities <= 0)
+		{
+			continue;
+		}
+
+		check(Request.EntityTypes.IsValidIndex(Result.EntityConfigIndex));
+		FETW_MassPendingSquadSpawn& PendingSquad = PendingSquadSpawns.AddDefaulted_GetRef();
+		PendingSquad.EntityType = Request.EntityTypes[Result.EntityConfigIndex];
+		PendingSquad.Result = Result;
+	}
+	SpawnRequests.RemoveAtSwap(RequestIdx);
+
+	if (!PostPhysicsPhaseFinishedHandle.IsValid() && !PendingSquadSpawns.IsEmpty())
+	{
+		UMassSimulationSubsystem* SimSystem = UWorld::GetSubsystem<UMassSimulationSubsystem>(GetWorld());
+		if (SimSystem == nullptr)
+		{
+			UE_VLOG_UELOG(this, ETW_Mass, Error, TEXT("UMassSimulationSubsystem missing, generated squads can't be spawned"));
+			return;
+		}
+		PostPhysicsPhaseFinishedHandle = SimSystem->GetOnProcessingPhaseFinished(EMassProcessingPhase::PostPhysics).AddUObject(this, &UMassCommanderComponent::OnPostPhysicsPhaseFinished);
+	}
+}
+
+void UMassCommanderComponent::OnPostPhysicsPhaseFinished(const float DeltaSeconds)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(UMassCommanderComponent_OnPostPhysicsPhaseFinished);
+
+	// whole squads only, at least one per frame
+	int32 NumSquads = 0;
+	int32 NumUnits = 0;
+	for (; NumSquads < PendingSquadSpawns.Num(); NumSquads++)
+	{
+		const int32 SquadUnits = PendingSquadSpawns[NumSquads].Result.NumEntities;
+		if (NumSquads > 0 && NumUnits + SquadUnits > MaxSpawnedUnitsPerFrame)
+		{
+			break;
+		}
+		NumUnits += SquadUnits;
+	}
+
+	if (NumSquads > 0)
+	{
+		MaterializeSquads(MakeArrayView(PendingSquadSpawns.GetData(), NumSquads));
+		PendingSquadSpawns.RemoveAt(0, NumSquads);
+	}
+
+	if (PendingSquadSpawns.IsEmpty())
+	{
+		if (UMassSimulationSubsystem* SimSystem = UWorld::GetSubsystem<UMassSimulationSubsystem>(GetWorld()))
+		{
+			SimSystem->GetOnProcessingPhaseFinished(EMassProcessingPhase::PostPhysics).Remove(PostPhysicsPhaseFinishedHandle);
+		}
+		PostPhysicsPhaseFinishedHandle.Reset();
+
+		if (SpawnRequests.IsEmpty())
+		{
+			OnSquadSpawningFinishedEvent.Broadcast();
+		}
+	}
+}
+
+void UMassCommanderComponent::MaterializeSquads(TConstArrayView<FETW_MassPendingSquadSpawn> Squads)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(UMassCommanderComponent_MaterializeSquads);
+
 	UWorld* World = GetWorld();
 	check(World);
 
@@ -182,140 +438,163 @@ void UMassCommanderComponent::OnSpawnQueryGeneratorFinished(TConstArrayView<FMas
 	}
 		
 	UETW_MassSquadSubsystem* SquadSubsystem = World->GetSubsystem<UETW_MassSquadSubsystem>();
-	if (SpawnerSystem == nullptr)
+	if (SquadSubsystem == nullptr)
 	{
 		UE_VLOG_UELOG(this, ETW_Mass, Error, TEXT("UETW_MassSquadSubsystem missing while trying to spawn squads!"));
 		return;
 	}
 	FMassSquadManager& SquadManager = SquadSubsystem->GetMutablSquadManager();
-	
-	TArray<FMassEntityHandle> SpawnedEntities;
-	FMassArchetypeHandle UnitsArchetypeHandle;
-	FMassEntityHandle SpawnedSquadEntity;
-	FMassArchetypeHandle SquadArchetypeHandle;
 
-	for (const FMassEntitySpawnDataGeneratorResult& Result : Results)
+	// find processors-initializers
+	UMassSquadUnitsPostSpawnProcessor* SquadUnitsPostSpawnProc = SquadSubsystem->GetSquadUnitsPostSpawnProcessor();
+	if (SquadUnitsPostSpawnProc == nullptr)
 	{
-		if (Result.NumEntities <= 0)
+		UE_VLOG_UELOG(this, ETW_Mass, Error, TEXT("UMassSquadUnitsPostSpawnProcessor missing while trying to spawn squads!"));
+		return;
+	}
+
+	UMassSquadPostSpawnProcessor* SquadPostSpawnProc = SquadSubsystem->GetSquadPostSpawnProcessor();
+	if (SquadPostSpawnProc == nullptr)
+	{
+		UE_VLOG_UELOG(this, ETW_Mass, Error, TEXT("UMassSquadPostSpawnProcessor missing while trying to spawn squads!"));
+		return;
+	}
+	//
+
+	// every result is a squad of its entity type. Entities of all squads are created first, initializers then run once per
+	// archetype over all of them. Creation contexts are kept alive until then, so observers see initialized entities
+	TMap<FMassArchetypeHandle, TArray<FMassEntityHandle>> SpawnedUnitsByArchetype;
+	TMap<FMassArchetypeHandle, TArray<FMassEntityHandle>> SpawnedSquadsByArchetype;
+	TArray<TSharedRef<FMassEntityManager::FEntityCreationContext>> CreationContexts;
+	CreationContexts.Reserve(Squads.Num() * 2);
+
+	// spawn generators face squads the way commander looks
+	const FQuat SquadFacing = FRotator(0.f, GetOwner()->GetActorRotation().Yaw, 0.f).Quaternion();
+	TMap<uint32, FTransform> SquadTransforms;
+	SquadTransforms.Reserve(Squads.Num());
+
+	for (const FETW_MassPendingSquadSpawn& PendingSquad : Squads)
+	{
+		const FMassEntitySpawnDataGeneratorResult& Result = PendingSquad.Result;
+		check(Result.SpawnDataProcessor != nullptr);
+		
+		// loaded before spawn points were generated
+		UMassEntityConfigAsset* UnitEntityConfig = PendingSquad.EntityType.EntityConfig.Get();
+		if (UnitEntityConfig == nullptr)
 		{
+			UE_VLOG_UELOG(this, ETW_Mass, Error, TEXT("Squad not spawned, %s isn't loaded"), *PendingSquad.EntityType.EntityConfig.ToString());
 			continue;
 		}
-		
-		check(PendingSpawnEntityTypes.IsValidIndex(Result.EntityConfigIndex));
-		check(Result.SpawnDataProcessor != nullptr);
-		
-		FMassSpawnedEntityType& EntityType = PendingSpawnEntityTypes[Result.EntityConfigIndex];
-		if (UMassEntityConfigAsset* UnitEntityConfig = EntityType.EntityConfig.LoadSynchronous())
+
+		const FMassEntityTemplate& UnitEntityTemplate = UnitEntityConfig->GetOrCreateEntityTemplate(*World);
+		if (!UnitEntityTemplate.IsValid())
 		{
-			const FMassEntityTemplate& UnitEntityTemplate = UnitEntityConfig->GetOrCreateEntityTemplate(*World);
-			if (UnitEntityTemplate.IsValid())
-			{
-				FSharedStruct NewSquadFragment_SharedStruct; // should be newly created fragment so it's not shared amoung all entities but with selected group of them (new spawned group in this case) 
+			continue;
+		}
 
-				TArray<FMassEntityHandle> SpawnedUnitsEntities;
-				UnitsArchetypeHandle = UnitEntityTemplate.GetArchetype();
+		FSharedStruct NewSquadFragment_SharedStruct; // should be newly created fragment so it's not shared amoung all entities but with selected group of them (new spawned group in this case) 
+		uint32 SpawnedSquadIndex = UE::Mass::Squad::InvalidSquadIndex;
+		FMassEntityHandle SpawnedSquadEntity;
+
+		// recreate shared fragments and make them unique for each spawned squad units group
+		FMassArchetypeSharedFragmentValues UnitMutableTemplateSharedFragments = UnitEntityTemplate.GetSharedFragmentValues();  // shared fragments values struct copy
+		for (FSharedStruct& SharedStruct : UnitMutableTemplateSharedFragments.GetMutableSharedFragments())
+		{
+			if (FETW_MassSquadSharedFragment* SquadSharedFragment = SharedStruct.GetMutablePtr<FETW_MassSquadSharedFragment>())
+			{
+				FETW_MassSquadSharedFragment SquadSharedFragment_UniquePerSquad;
+				SquadSharedFragment_UniquePerSquad.Formation = SquadSharedFragment->Formation;
+				SquadSharedFragment_UniquePerSquad.SquadIndex = SquadManager.GetSquadId();
+				SpawnedSquadIndex = SquadSharedFragment_UniquePerSquad.SquadIndex;
+
+				uint32 SquadSharedFragmentHash = UE::StructUtils::GetStructCrc32(FConstStructView::Make(SquadSharedFragment_UniquePerSquad), SquadSharedFragment_UniquePerSquad.SquadIndex);  // add crc to make hash different from default object 
+				NewSquadFragment_SharedStruct = EntityManager.GetOrCreateSharedFragmentByHash<FETW_MassSquadSharedFragment>(SquadSharedFragmentHash, SquadSharedFragment_UniquePerSquad);
+				SharedStruct = NewSquadFragment_SharedStruct;  // make new shared fragment unique per squad and not archetype
+				break;
+			}
+		}
+		//
 
-				// recreate shared fragments and make them unique for each spawned squad units group
-				FMassArchetypeSharedFragmentValues UnitMutableTemplateSharedFragments = UnitEntityTemplate.GetSharedFragmentValues();  // shared fragments values struct copy
-				for (FSharedStruct& SharedStruct : UnitMutableTemplateSharedFragments.GetMutableSharedFragments())
+		// create additional "Squad" entity for spawned squad units 
+		for (const FConstSharedStruct& ConstSharedStruct : UnitMutableTemplateSharedFragments.GetConstSharedFragments())
+		{
+			if (const FETW_MassSquadParams* SquadParams = ConstSharedStruct.GetPtr<FETW_MassSquadParams>())
+			{
+				if (UMassEntityConfigAsset* SquadEntityConfig = SquadParams->SquadEntityTemplate.Get())
 				{
-					if (FETW_MassSquadSharedFragment* SquadSharedFragment = SharedStruct.GetMutablePtr<FETW_MassSquadSharedFragment>())
+					const FMassEntityTemplate& SquadEntityTemplate = SquadEntityConfig->GetOrCreateEntityTemplate(*World);
+					FMassArchetypeSharedFragmentValues SquadMutableTemplateSharedFragments = SquadEntityTemplate.GetSharedFragmentValues();
+
+					for (FSharedStruct& SharedStruct : SquadMutableTemplateSharedFragments.GetMutableSharedFragments())
 					{
-						FETW_MassSquadSharedFragment SquadSharedFragment_UniquePerSquad;
-						SquadSharedFragment_UniquePerSquad.Formation = SquadSharedFragment->Formation;
-						SquadSharedFragment_UniquePerSquad.SquadIndex = SquadManager.GetSquadId();
-	
-						uint32 SquadSharedFragmentHash = UE::StructUtils::GetStructCrc32(FConstStructView::Make(SquadSharedFragment_UniquePerSquad), SquadSharedFragment_UniquePerSquad.SquadIndex);  // add crc to make hash different from default object 
-						NewSquadFragment_SharedStruct = EntityManager.GetOrCreateSharedFragmentByHash<FETW_MassSquadSharedFragment>(SquadSharedFragmentHash, SquadSharedFragment_UniquePerSquad);
-						SharedStruct = NewSquadFragment_SharedStruct;  // make new shared fragment unique per squad and not archetype
-						break;
+						if (SharedStruct.GetMutablePtr<FETW_MassSquadSharedFragment>())
+						{
+							SharedStruct = NewSquadFragment_SharedStruct;  // copy new shared fragment unique per squad and not archetype
+							break;
+						}
 					}
-				}
-				//
 
-				// create additional "Squad" entity for spawned squad units 
-				for (const FConstSharedStruct& ConstSharedStruct : UnitMutableTemplateSharedFragments.GetConstSharedFragments())
-				{
-					if (const FETW_MassSquadParams* SquadParams = ConstSharedStruct.GetPtr<FETW_MassSquadParams>())
+					for (const FConstSharedStruct& ConstSharedStruct_SquadTemplate : SquadMutableTemplateSharedFragments.GetConstSharedFragments())
 					{
-						if (UMassEntityConfigAsset* SquadEntityConfig = SquadParams->SquadEntityTemplate.LoadSynchronous())
+						if (ConstSharedStruct_SquadTemplate.GetPtr<FETW_MassSquadParams>())
 						{
-							const FMassEntityTemplate& SquadEntityTemplate = SquadEntityConfig->GetOrCreateEntityTemplate(*World);
-							FMassArchetypeSharedFragmentValues SquadMutableTemplateSharedFragments = SquadEntityTemplate.GetSharedFragmentValues();
-
-							for (FSharedStruct& SharedStruct : SquadMutableTemplateSharedFragments.GetMutableSharedFragments())
-							{
-								if (SharedStruct.GetMutablePtr<FETW_MassSquadSharedFragment>())
-								{
-									SharedStruct = NewSquadFragment_SharedStruct;  // copy new shared fragment unique per squad and not archetype
-									break;
-								}
-							}
-
-							for (const FConstSharedStruct& ConstSharedStruct_SquadTemplate : SquadMutableTemplateSharedFragments.GetConstSharedFragments())
-							{
-								if (ConstSharedStruct_SquadTemplate.GetPtr<FETW_MassSquadParams>())
-								{
-									FConstSharedStruct& MutableConstSharedStruct = const_cast<FConstSharedStruct&>(ConstSharedStruct_SquadTemplate);
-									MutableConstSharedStruct = EntityManager.GetOrCreateConstSharedFragment(*SquadParams);  // copy new shared fragment unique per squad and not archetype
-									break;
-								}
-							}
-							
-							SquadArchetypeHandle = SquadEntityTemplate.GetArchetype();
-							//SpawnedSquadEntity = EntityManager.CreateEntity(SquadArchetypeHandle, SquadMutableTemplateSharedFragments);  //create squad entity
-							// hack for observer processors triggers for proper initialization of entity, todo: find method like EntityObserverManager.TriggerObserversCheck(Entity)
-							{
-								TArray<FMassEntityHandle> Temp_InSquadEntities;
-								TSharedRef<FMassEntityManager::FEntityCreationContext> CreationContext = EntityManager.BatchCreateEntities(SquadArchetypeHandle, SquadMutableTemplateSharedFragments, 1, Temp_InSquadEntities);
-								SpawnedSquadEntity = Temp_InSquadEntities[0];
-							}
-							TConstArrayView<FInstancedStruct> FragmentInstances = SquadEntityTemplate.GetInitialFragmentValues();
-							EntityManager.SetEntityFragmentsValues(SpawnedSquadEntity, FragmentInstances);
+							FConstSharedStruct& MutableConstSharedStruct = const_cast<FConstSharedStruct&>(ConstSharedStruct_SquadTemplate);
+							MutableConstSharedStruct = EntityManager.GetOrCreateConstSharedFragment(*SquadParams);  // copy new shared fragment unique per squad and not archetype
+							break;
 						}
-						break;
 					}
+					
+					const FMassArchetypeHandle SquadArchetypeHandle = SquadEntityTemplate.GetArchetype();
+					TArray<FMassEntityHandle> SquadEntities;
+					CreationContexts.Add(EntityManager.BatchCreateEntities(SquadArchetypeHandle, SquadMutableTemplateSharedFragments, 1, SquadEntities));
+					SpawnedSquadEntity = SquadEntities[0];
+
+					TConstArrayView<FInstancedStruct> FragmentInstances = SquadEntityTemplate.GetInitialFragmentValues();
+					EntityManager.SetEntityFragmentsValues(SpawnedSquadEntity, FragmentInstances);
+					SpawnedSquadsByArchetype.FindOrAdd(SquadArchetypeHandle).Add(SpawnedSquadEntity);
 				}
-				//
-				
-				// create units entities, initialize their fragment values and run spawn processor view (to pass transform from query result)
-				TSharedRef<FMassEntityManager::FEntityCreationContext> CreationContext = EntityManager.BatchCreateEntities(UnitsArchetypeHandle, UnitMutableTemplateSharedFragments, Result.NumEntities, SpawnedUnitsEntities);
-				
-				TConstArrayView<FInstancedStruct> FragmentInstances = UnitEntityTemplate.GetInitialFragmentValues();
-				EntityManager.BatchSetEntityFragmentsValues(CreationContext->GetEntityCollection(), FragmentInstances);
-
-				UMassProcessor* SpawnDataInitializer = Result.SpawnData.IsValid() ? SquadSubsystem->GetSpawnDataInitializer(Result.SpawnDataProcessor) : nullptr;
-				if (SpawnDataInitializer)
-				{
-					FMassProcessingContext ProcessingContext(EntityManager, /*TimeDelta=*/0.0f);
-					ProcessingContext.AuxData = Result.SpawnData;
-					UE::Mass::Executor::RunProcessorsView(MakeArrayView(&SpawnDataInitializer, 1), ProcessingContext, &CreationContext->GetEntityCollection());
-				}
-				
-				SpawnedEntities.Append(SpawnedUnitsEntities);
-				//
+				break;
 			}
 		}
+		//
 		
-		break;  // expected only one entity type to spawn per call
-	}
+		// create units entities, initialize their fragment values and run spawn processor view (to pass transform from query result)
+		const FMassArchetypeHandle UnitsArchetypeHandle = UnitEntityTemplate.GetArchetype();
+		TArray<FMassEntityHandle> SpawnedUnitsEntities;
+		TSharedRef<FMassEntityManager::FEntityCreationContext> CreationContext = EntityManager.BatchCreateEntities(UnitsArchetypeHandle, UnitMutableTemplateSharedFragments, Result.NumEntities, SpawnedUnitsEntities);
+		CreationContexts.Add(CreationContext);
+		
+		TConstArrayView<FInstancedStruct> FragmentInstances = UnitEntityTemplate.GetInitialFragmentValues();
+		EntityManager.BatchSetEntityFragmentsValues(CreationContext->GetEntityCollection(), FragmentInstances);
 
-	// find processors-initializers
-	/* todo: Use Single Run Processor view in this function */
-	UMassSquadUnitsPostSpawnProcessor* SquadUnitsPostSpawnProc = SquadSubsystem->GetSquadUnitsPostSpawnProcessor();
-	if (SquadUnitsPostSpawnProc == nullptr)
-	{
-		UE_VLOG_UELOG(this, ETW_Mass, Error, TEXT("UMassSquadUnitsPostSpawnProcessor missing while trying to spawn squads!"));
-		return;
-	}
+		// spawn data is per result
+		UMassProcessor* SpawnDataInitializer = Result.SpawnData.IsValid() ? SquadSubsystem->GetSpawnDataInitializer(Result.SpawnDataProcessor) : nullptr;
+		if (SpawnDataInitializer)
+		{
+			FMassProcessingContext ProcessingContext(EntityManager, /*TimeDelta=*/0.0f);
+			ProcessingContext.AuxData = Result.SpawnData;
+			UE::Mass::Executor::RunProcessorsView(MakeArrayView(&SpawnDataInitializer, 1), ProcessingContext, &CreationContext->GetEntityCollection());
+		}
 
-	UMassSquadPostSpawnProcessor* SquadPostSpawnProc = SquadSubsystem->GetSquadPostSpawnProcessor();
-	if (SquadPostSpawnProc == nullptr)
-	{
-		UE_VLOG_UELOG(this, ETW_Mass, Error, TEXT("UMassSquadPostSpawnProcessor missing while trying to spawn squads!"));
-		return;
+		// register spawned squad and its units, removal is handled by UMassSquadUnitsRemovedObserver and UMassSquadRemovedObserver.
+		// registry snapshot will see them after next PrePhysics flush. Queued before initializers, units initializer queues their formation slots
+		if (SpawnedSquadIndex != UE::Mass::Squad::InvalidSquadIndex && SpawnedSquadEntity.IsSet())
+		{
+			SquadManager.EnqueueRegisterSquad(SpawnedSquadIndex, SpawnedSquadEntity, static_cast<int8>(TeamIndex));
+			SquadManager.EnqueueAddUnits(SpawnedSquadIndex, SpawnedUnitsEntities);
+
+			// squad is placed in the middle of its generated units, not on commander
+			FVector UnitsCenter = FVector::ZeroVector;
+			for (const FMassEntityHandle Unit : SpawnedUnitsEntities)
+			{
+				UnitsCenter += EntityManager.GetFragmentDataChecked<FTransformFragment>(Unit).GetTransform().GetLocation();
+			}
+			UnitsCenter /= FMath::Max(SpawnedUnitsEntities.Num(), 1);
+			SquadTransforms.Add(SpawnedSquadIndex, FTransform(SquadFacing, UnitsCenter));
+		}
+
+		SpawnedUnitsByArchetype.FindOrAdd(UnitsArchetypeHandle).Append(SpawnedUnitsEntities);
 	}
-	//
 	
 	// aux data for processor-initializer
 	FMassProcessingContext UnitsProcessingContext(EntityManager, /*TimeDelta=*/0.0f);
@@ -324,21 +603,28 @@ void UMassCommanderComponent::OnSpawnQueryGeneratorFinished(TConstArrayView<FMas
 	SpawnData.TeamIndex = TeamIndex;
 	SpawnData.CommanderComp = this;
 	SpawnData.SquadInitialTransform = GetOwner()->GetTransform();
+	SpawnData.SquadTransforms = MoveTemp(SquadTransforms);
 	//
 
-	// run processor-initializer for units entities
-	FMassArchetypeEntityCollection UnitsEntityCollection(UnitsArchetypeHandle, SpawnedEntities, FMassArchetypeEntityCollection::NoDuplicates);
+	// run processor-initializer for units entities, chunks are initialized in parallel
 	TArray<UMassProcessor*> SquadUnitsProcesorView = { SquadUnitsPostSpawnProc };
-	UE::Mass::Executor::RunProcessorsView(SquadUnitsProcesorView, UnitsProcessingContext, &UnitsEntityCollection);
+	for (const TPair<FMassArchetypeHandle, TArray<FMassEntityHandle>>& UnitsPair : SpawnedUnitsByArchetype)
+	{
+		FMassArchetypeEntityCollection UnitsEntityCollection(UnitsPair.Key, UnitsPair.Value, FMassArchetypeEntityCollection::NoDuplicates);
+		UE::Mass::Executor::RunProcessorsView(SquadUnitsProcesorView, UnitsProcessingContext, &UnitsEntityCollection);
+	}
 	
-	// run processor-initialzier for squad entity
+	// run processor-initialzier for squad entities
 	FMassProcessingContext SquadEntityProcessingContext = UnitsProcessingContext;
-	FMassArchetypeEntityCollection SquadEntityCollection(SquadArchetypeHandle, {SpawnedSquadEntity}, FMassArchetypeEntityCollection::NoDuplicates);
 	TArray<UMassProcessor*> SquadProcessorView = { SquadPostSpawnProc };
-	UE::Mass::Executor::RunProcessorsView(SquadProcessorView, SquadEntityProcessingContext, &SquadEntityCollection);
-	
-	bSquadEntitiesSpawnInProgress = false;
-	OnSquadSpawningFinishedEvent.Broadcast();
+	for (const TPair<FMassArchetypeHandle, TArray<FMassEntityHandle>>& SquadsPair : SpawnedSquadsByArchetype)
+	{
+		FMassArchetypeEntityCollection SquadEntityCollection(SquadsPair.Key, SquadsPair.Value, FMassArchetypeEntityCollection::NoDuplicates);
+		UE::Mass::Executor::RunProcessorsView(SquadProcessorView, SquadEntityProcessingContext, &SquadEntityCollection);
+	}
+
+	// observers run once contexts are released
+	CreationContexts.Reset();
 }
 
 void UMassCommanderComponent::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
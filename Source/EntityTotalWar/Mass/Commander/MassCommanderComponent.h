@@ -8,11 +8,13 @@
 #include "EnvironmentQuery/EnvQueryInstanceBlueprintWrapper.h"
 #include "EnvironmentQuery/EnvQueryTypes.h"
 #include "ETW_MassTypes.h"
+#include "ETW_MassSquadOrders.h"
 #include "MassEntitySpawnDataGeneratorBase.h"
 
 #include "MassCommanderComponent.generated.h"
 
 struct MASSSPAWNER_API FMassSpawnedEntityType;
+struct FStreamableHandle;
 
 USTRUCT(BlueprintType, Blueprintable)
 struct ENTITYTOTALWAR_API FMassCommanderCommandTrace
@@ -47,6 +49,30 @@ struct ENTITYTOTALWAR_API FMassCommanderCommandTrace
 //};
 
 
+/** Spawn request waiting for its spawn point generator */
+USTRUCT()
+struct ENTITYTOTALWAR_API FETW_MassSquadSpawnRequest
+{
+	GENERATED_BODY()
+
+	uint32 RequestId = 0;
+
+	UPROPERTY()
+	TArray<FMassSpawnedEntityType> EntityTypes;
+};
+
+/** Generated squad waiting to be materialized, one generator result of one entity type */
+USTRUCT()
+struct ENTITYTOTALWAR_API FETW_MassPendingSquadSpawn
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	FMassSpawnedEntityType EntityType;
+
+	FMassEntitySpawnDataGeneratorResult Result;
+};
+
 DECLARE_DYNAMIC_MULTICAST_DELEGATE(FMassCommanderOnSquadSpawningFinishedEvent);
 
 UCLASS(ClassGroup=(Custom), Blueprintable, meta=(BlueprintSpawnableComponent))
@@ -67,6 +93,12 @@ public:
 	UFUNCTION(BlueprintImplementableEvent)
 	void K2_ServerProcessInputAction();
 
+	// queues order for one of commander's squads, orders are batched and applied once per frame on server
+	void IssueSquadOrder(const FETW_MassSquadOrder& Order);
+
+	UFUNCTION(Server, Reliable)
+	void ServerIssueSquadOrder(const FETW_MassSquadOrder& Order);
+
 	UFUNCTION(BlueprintImplementableEvent)
 	void K2_ReceiveCommandInputAction();
 
@@ -82,15 +114,27 @@ public:
 	const FVector& GetCommandLocation() const { return CommandTraceResult.Trace.Location; }
 
 	UFUNCTION(BlueprintCallable)
-	void SpawnSquad(TSoftObjectPtr<UMassEntityConfigAsset> EntityTemplate, int32 NumToSpawn, TSoftClassPtr<UMassEntityEQSSpawnPointsGenerator> PointGenerator);
+	void SpawnSquad(TSoftObjectPtr<UMassEntityConfigAsset> EntityTemplate, int32 NumToSpawn, TSoftClassPtr<UMassEntitySpawnDataGeneratorBase> PointGenerator);
+
+	// spawns one squad of NumPerSquad units per template in single batch, same template can be listed multiple times.
+	// Units are placed on formation slots by UETW_MassFormationSpawnGenerator when PointGenerator isn't set
+	UFUNCTION(BlueprintCallable)
+	void SpawnSquads(const TArray<TSoftObjectPtr<UMassEntityConfigAsset>>& EntityTemplates, int32 NumPerSquad, TSoftClassPtr<UMassEntitySpawnDataGeneratorBase> PointGenerator);
 
+	// async loaded at BeginPlay with squad templates they reference, their entity templates and archetypes are built before first spawn
 	UPROPERTY(EditDefaultsOnly)
 	TArray<TSoftObjectPtr<UMassEntityConfigAsset>> PreLoadTemplates;
 
+	// broadcast when all queued spawn requests are materialized
 	UPROPERTY(BlueprintAssignable)
 	FMassCommanderOnSquadSpawningFinishedEvent OnSquadSpawningFinishedEvent;
+
+	// max units materialized per frame, squads are never split so single bigger squad still spawns in one frame
+	UPROPERTY(EditDefaultsOnly)
+	int32 MaxSpawnedUnitsPerFrame = 4000;
 	
-	void OnSpawnQueryGeneratorFinished(TConstArrayView<FMassEntitySpawnDataGeneratorResult> Results);
+	void OnSpawnQueryGeneratorFinished(TConstArrayView<FMassEntitySpawnDataGeneratorResult> Results, uint32 RequestId);
+
 	
 	// try to find player camera component
 	UFUNCTION(BlueprintCallable, BlueprintNativeEvent)
@@ -101,16 +145,51 @@ public:
 
 protected:
 	virtual void BeginPlay() override;
+
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 	
 	virtual void InitializeComponent() override;
 	
 	void RegisterEntityTemplates();
+
+	void OnEntityTemplatesLoaded(TArray<FSoftObjectPath> LoadedPaths);
+
+	// keep warmed up configs loaded
+	TArray<TSharedPtr<FStreamableHandle>> EntityTemplateLoadHandles;
+
+	TSet<FSoftObjectPath> WarmedUpEntityTemplates;
 	
 	UFUNCTION(BlueprintCallable, Server, Reliable)
 	void Server_SpawnSquad(FSoftObjectPath EntityTemplatePath, int32 NumToSpawn, FSoftObjectPath PointGeneratorPath);
+
+	UFUNCTION(Server, Reliable)
+	void Server_SpawnSquads(const TArray<FSoftObjectPath>& EntityTemplatePaths, int32 NumPerSquad, FSoftObjectPath PointGeneratorPath);
+
+	// generates spawn points for all squads at once, result of every entity type becomes one squad.
+	// Requests don't wait for each other, generators of all requests run concurrently.
+	// Nothing is loaded synchronously, configs, squad templates they reference and generator class are streamed in first
+	void GenerateSquadsSpawnData(TConstArrayView<FSoftObjectPath> EntityTemplatePaths, int32 NumPerSquad, const FSoftObjectPath& PointGeneratorPath, int32 LoadPass = 0);
+
+	void OnSpawnAssetsLoaded(TArray<FSoftObjectPath> EntityTemplatePaths, int32 NumPerSquad, FSoftObjectPath PointGeneratorPath, int32 LoadPass);
+
+	// creates entities of given squads in one batch and runs their initializers
+	void MaterializeSquads(TConstArrayView<FETW_MassPendingSquadSpawn> Squads);
+
+	// materializes pending squads by budget between Mass phases, so archetypes never change while processors run
+	void OnPostPhysicsPhaseFinished(const float DeltaSeconds);
+
+	// bound only while there are generated squads to materialize
+	FDelegateHandle PostPhysicsPhaseFinishedHandle;
 	
+	// requests with spawn point generation in flight
 	UPROPERTY()
-	TArray<FMassSpawnedEntityType> PendingSpawnEntityTypes;
+	TArray<FETW_MassSquadSpawnRequest> SpawnRequests;
+
+	// generated squads of all requests, materialized in frame budgeted batches
+	UPROPERTY()
+	TArray<FETW_MassPendingSquadSpawn> PendingSquadSpawns;
+
+	uint32 NextSpawnRequestId = 0;
 	
 	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
 
@@ -128,8 +207,4 @@ protected:
 	bool RaycastCommandTarget(const FVector& ClientCursorLocation, const FVector& ClientCursorDirection, bool bTraceFromCursor = false);
 
 	FHitResult LastCommandTraceResult;
-
-	
-private:
-	bool bSquadEntitiesSpawnInProgress = false;
 };
@@ -9,12 +9,13 @@
 
 FETW_ReplicatedSquadAgentData::FETW_ReplicatedSquadAgentData(
 	const FETW_MassSquadCommanderFragment& SquadCommanderFragment, const FETW_MassTeamFragment& TeamFragment,
-	const FMassTargetLocationFragment& TargetLocationFragment, const FETW_MassSquadSharedFragment& SquadSharedFragment)
+	const FMassTargetLocationFragment& TargetLocationFragment, const FETW_MassSquadSharedFragment& SquadSharedFragment,
+	const FETW_MassSquadStateFragment& SquadStateFragment)
 		: Formation(SquadSharedFragment.Formation),
 		TargetLocation(TargetLocationFragment.Target),
 		CommanderComp(SquadCommanderFragment.CommanderComp),
 		SquadIndex(SquadSharedFragment.SquadIndex),
-		TargetSquadIndex(SquadSharedFragment.TargetSquadIndex),
+		TargetSquadIndex(SquadStateFragment.TargetSquadIndex),
 		TeamIndex(TeamFragment.TeamIndex)
 
 {
@@ -22,14 +23,15 @@ FETW_ReplicatedSquadAgentData::FETW_ReplicatedSquadAgentData(
 
 void FETW_ReplicatedSquadAgentData::InitEntity(const UWorld& InWorld, const FMassEntityView& InEntityView,
 	FETW_MassSquadCommanderFragment& OutSquadCommanderFragment, FETW_MassTeamFragment& OutTeamFragment,
-	FMassTargetLocationFragment& OutTargetLocationFragment, FETW_MassSquadSharedFragment& OutSquadSharedFragment) const
+	FMassTargetLocationFragment& OutTargetLocationFragment, FETW_MassSquadSharedFragment& OutSquadSharedFragment,
+	FETW_MassSquadStateFragment& OutSquadStateFragment) const
 {
 	OutSquadCommanderFragment.CommanderComp = CommanderComp;
 	OutTeamFragment.TeamIndex = TeamIndex;
 	OutTargetLocationFragment.Target = TargetLocation;
 	OutSquadSharedFragment.SquadIndex = SquadIndex;
-	OutSquadSharedFragment.TargetSquadIndex = TargetSquadIndex;
 	OutSquadSharedFragment.Formation = Formation;
+	OutSquadStateFragment.TargetSquadIndex = TargetSquadIndex;
 }
 
 void FETW_ReplicatedSquadAgentData::ApplyToEntity(const UWorld& InWorld, const FMassEntityView& InEntityView) const
@@ -43,16 +45,23 @@ void FETW_ReplicatedSquadAgentData::ApplyToEntity(const UWorld& InWorld, const F
 	FMassTargetLocationFragment& TargetLocationFragment = InEntityView.GetFragmentData<FMassTargetLocationFragment>();
 	TargetLocationFragment.Target = TargetLocation;
 
+	// identity changes rarely, don't touch shared fragment when nothing changed
 	FETW_MassSquadSharedFragment& SquadSharedFragment = InEntityView.GetSharedFragmentData<FETW_MassSquadSharedFragment>();
-	SquadSharedFragment.Formation = Formation;
-	SquadSharedFragment.SquadIndex = SquadIndex;
-	SquadSharedFragment.TargetSquadIndex = TargetSquadIndex;
+	if (!(SquadSharedFragment.Formation == Formation) || SquadSharedFragment.SquadIndex != SquadIndex)
+	{
+		SquadSharedFragment.Formation = Formation;
+		SquadSharedFragment.SquadIndex = SquadIndex;
+	}
+
+	FETW_MassSquadStateFragment& SquadStateFragment = InEntityView.GetFragmentData<FETW_MassSquadStateFragment>();
+	SquadStateFragment.TargetSquadIndex = TargetSquadIndex;
 }
 
 #if UE_REPLICATION_COMPILE_SERVER_CODE
 void FETW_MassClientBubbleSquadHandler::SetBubbleSquadData(const FMassReplicatedAgentHandle Handle,
 	const FETW_MassSquadCommanderFragment& SquadCommanderFragment, const FETW_MassTeamFragment& TeamFragment,
-	const FMassTargetLocationFragment& TargetLocationFragment, const FETW_MassSquadSharedFragment& SquadSharedFragment)
+	const FMassTargetLocationFragment& TargetLocationFragment, const FETW_MassSquadSharedFragment& SquadSharedFragment,
+	const FETW_MassSquadStateFragment& SquadStateFragment)
 {
 	check(OwnerHandler.GetAgentHandleManager().IsValidHandle(Handle));
 
@@ -90,9 +99,9 @@ void FETW_MassClientBubbleSquadHandler::SetBubbleSquadData(const FMassReplicated
 		bMarkDirty = true;
 	}
 
-	if (SquadSharedFragment.TargetSquadIndex != ReplicatedSquadUnit.TargetSquadIndex)
+	if (SquadStateFragment.TargetSquadIndex != ReplicatedSquadUnit.TargetSquadIndex)
 	{
-		ReplicatedSquadUnit.TargetSquadIndex = SquadSharedFragment.TargetSquadIndex;
+		ReplicatedSquadUnit.TargetSquadIndex = SquadStateFragment.TargetSquadIndex;
 		bMarkDirty = true;
 	}
 
@@ -115,6 +124,7 @@ void FETW_MassClientBubbleSquadHandler::AddRequirementsForSpawnQuery(FMassEntity
 	InQuery.AddRequirement<FETW_MassSquadCommanderFragment>(EMassFragmentAccess::ReadWrite);
 	InQuery.AddRequirement<FETW_MassTeamFragment>(EMassFragmentAccess::ReadWrite);
 	InQuery.AddRequirement<FMassTargetLocationFragment>(EMassFragmentAccess::ReadWrite);
+	InQuery.AddRequirement<FETW_MassSquadStateFragment>(EMassFragmentAccess::ReadWrite);
 	InQuery.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadWrite);
 }
 
@@ -124,6 +134,7 @@ void FETW_MassClientBubbleSquadHandler::CacheFragmentViewsForSpawnQuery(FMassExe
 	TeamFragmentList = InExecContext.GetMutableFragmentView<FETW_MassTeamFragment>();
 	TargetFragmentList = InExecContext.GetMutableFragmentView<FMassTargetLocationFragment>();
 	SquadSharedFragmentList = MakeArrayView<FETW_MassSquadSharedFragment>(&InExecContext.GetMutableSharedFragment<FETW_MassSquadSharedFragment>(), 1);
+	SquadStateFragmentList = InExecContext.GetMutableFragmentView<FETW_MassSquadStateFragment>();
 }
 
 void FETW_MassClientBubbleSquadHandler::ClearFragmentViewsForSpawnQuery()
@@ -132,6 +143,7 @@ void FETW_MassClientBubbleSquadHandler::ClearFragmentViewsForSpawnQuery()
 	TeamFragmentList = TArrayView<FETW_MassTeamFragment>();
 	TargetFragmentList = TArrayView<FMassTargetLocationFragment>();
 	SquadSharedFragmentList = TArrayView<FETW_MassSquadSharedFragment>();
+	SquadStateFragmentList = TArrayView<FETW_MassSquadStateFragment>();
 }
 
 void FETW_MassClientBubbleSquadHandler::SetSpawnedEntityData(const FMassEntityView& EntityView,
@@ -140,7 +152,7 @@ void FETW_MassClientBubbleSquadHandler::SetSpawnedEntityData(const FMassEntityVi
 	UWorld* World = OwnerHandler.GetSerializer()->GetWorld();
 	check(World);
 	ReplicatedUnitAgentData.InitEntity(
-		*World, EntityView, CommanderFragmentList[EntityIdx], TeamFragmentList[EntityIdx], TargetFragmentList[EntityIdx], SquadSharedFragmentList[EntityIdx]);
+		*World, EntityView, CommanderFragmentList[EntityIdx], TeamFragmentList[EntityIdx], TargetFragmentList[EntityIdx], SquadSharedFragmentList[0], SquadStateFragmentList[EntityIdx]);
 }
 
 void FETW_MassClientBubbleSquadHandler::SetModifiedEntityData(const FMassEntityView& EntityView,
@@ -157,7 +169,8 @@ void FMassReplicationProcessorSquadHandler::AddRequirements(FMassEntityQuery& In
 	InQuery.AddRequirement<FETW_MassSquadCommanderFragment>(EMassFragmentAccess::ReadWrite);
 	InQuery.AddRequirement<FETW_MassTeamFragment>(EMassFragmentAccess::ReadWrite);
 	InQuery.AddRequirement<FMassTargetLocationFragment>(EMassFragmentAccess::ReadWrite);
-	InQuery.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadWrite);
+	InQuery.AddRequirement<FETW_MassSquadStateFragment>(EMassFragmentAccess::ReadOnly);
+	InQuery.AddSharedRequirement<FETW_MassSquadSharedFragment>(EMassFragmentAccess::ReadOnly);
 }
 
 void FMassReplicationProcessorSquadHandler::CacheFragmentViews(FMassExecutionContext& InExecContext)
@@ -165,7 +178,8 @@ void FMassReplicationProcessorSquadHandler::CacheFragmentViews(FMassExecutionCon
 	CommanderFragmentList = InExecContext.GetMutableFragmentView<FETW_MassSquadCommanderFragment>();
 	TeamFragmentList = InExecContext.GetMutableFragmentView<FETW_MassTeamFragment>();
 	TargetFragmentList = InExecContext.GetMutableFragmentView<FMassTargetLocationFragment>();
-	SquadSharedFragmentList = MakeArrayView<FETW_MassSquadSharedFragment>(&InExecContext.GetMutableSharedFragment<FETW_MassSquadSharedFragment>(), 1);
+	SquadStateFragmentList = InExecContext.GetFragmentView<FETW_MassSquadStateFragment>();
+	SquadSharedFragment = &InExecContext.GetSharedFragment<FETW_MassSquadSharedFragment>();
 }
 
 void FMassReplicationProcessorSquadHandler::AddEntity(const int32 EntityIdx,
@@ -174,9 +188,9 @@ void FMassReplicationProcessorSquadHandler::AddEntity(const int32 EntityIdx,
 	const FETW_MassSquadCommanderFragment& SquadCommanderFragment = CommanderFragmentList[EntityIdx];
 	const FETW_MassTeamFragment& TeamFragment = TeamFragmentList[EntityIdx];
 	const FMassTargetLocationFragment& TargetLocationFragment = TargetFragmentList[EntityIdx];
-	const FETW_MassSquadSharedFragment& SquadSharedFragment = SquadSharedFragmentList[EntityIdx];
+	const FETW_MassSquadStateFragment& SquadStateFragment = SquadStateFragmentList[EntityIdx];
 
-	InOutReplicatedSquadData = FETW_ReplicatedSquadAgentData(SquadCommanderFragment, TeamFragment, TargetLocationFragment, SquadSharedFragment);
+	InOutReplicatedSquadData = FETW_ReplicatedSquadAgentData(SquadCommanderFragment, TeamFragment, TargetLocationFragment, *SquadSharedFragment, SquadStateFragment);
 }
 
 void FMassReplicationProcessorSquadHandler::ModifyEntity(const FMassReplicatedAgentHandle Handle, const int32 EntityIdx,
@@ -185,7 +199,7 @@ void FMassReplicationProcessorSquadHandler::ModifyEntity(const FMassReplicatedAg
 	const FETW_MassSquadCommanderFragment& SquadCommanderFragment = CommanderFragmentList[EntityIdx];
 	const FETW_MassTeamFragment& TeamFragment = TeamFragmentList[EntityIdx];
 	const FMassTargetLocationFragment& TargetLocationFragment = TargetFragmentList[EntityIdx];
-	const FETW_MassSquadSharedFragment& SquadSharedFragment = SquadSharedFragmentList[EntityIdx];
+	const FETW_MassSquadStateFragment& SquadStateFragment = SquadStateFragmentList[EntityIdx];
 
-	BubbleSquadHandler.SetBubbleSquadData(Handle, SquadCommanderFragment, TeamFragment, TargetLocationFragment, SquadSharedFragment);
+	BubbleSquadHandler.SetBubbleSquadData(Handle, SquadCommanderFragment, TeamFragment, TargetLocationFragment, *SquadSharedFragment, SquadStateFragment);
 }
@@ -26,7 +26,8 @@ struct ENTITYTOTALWAR_API FETW_ReplicatedSquadAgentData
 		const FETW_MassSquadCommanderFragment& SquadCommanderFragment,
 		const FETW_MassTeamFragment& TeamFragment,
 		const FMassTargetLocationFragment& TargetLocationFragment,
-		const FETW_MassSquadSharedFragment& SquadSharedFragment
+		const FETW_MassSquadSharedFragment& SquadSharedFragment,
+		const FETW_MassSquadStateFragment& SquadStateFragment
 		);
 
 	void InitEntity(const UWorld& InWorld,
@@ -34,7 +35,8 @@ struct ENTITYTOTALWAR_API FETW_ReplicatedSquadAgentData
 					FETW_MassSquadCommanderFragment& OutSquadCommanderFragment,
 					FETW_MassTeamFragment& OutTeamFragment,
 					FMassTargetLocationFragment& OutTargetLocationFragment,
-					FETW_MassSquadSharedFragment& OutSquadSharedFragment
+					FETW_MassSquadSharedFragment& OutSquadSharedFragment,
+					FETW_MassSquadStateFragment& OutSquadStateFragment
 					) const;
 
 	void ApplyToEntity(const UWorld& InWorld, const FMassEntityView& InEntityView) const;
@@ -77,7 +79,8 @@ public:
 		const FETW_MassSquadCommanderFragment& SquadCommanderFragment,
 		const FETW_MassTeamFragment& TeamFragment,
 		const FMassTargetLocationFragment& TargetLocationFragment,
-		const FETW_MassSquadSharedFragment& SquadSharedFragment
+		const FETW_MassSquadSharedFragment& SquadSharedFragment,
+		const FETW_MassSquadStateFragment& SquadStateFragment
 		);
 #endif // UE_REPLICATION_COMPILE_SERVER_CODE
 
@@ -101,6 +104,7 @@ protected:
 	TArrayView<FETW_MassTeamFragment> TeamFragmentList;
 	TArrayView<FMassTargetLocationFragment> TargetFragmentList;
 	TArrayView<FETW_MassSquadSharedFragment> SquadSharedFragmentList;
+	TArrayView<FETW_MassSquadStateFragment> SquadStateFragmentList;
 
 	FETW_MassSquadsClientBubbleHandler& OwnerHandler;
 };
@@ -137,5 +141,8 @@ public:
 	TArrayView<FETW_MassSquadCommanderFragment> CommanderFragmentList;
 	TArrayView<FETW_MassTeamFragment> TeamFragmentList;
 	TArrayView<FMassTargetLocationFragment> TargetFragmentList;
-	TArrayView<FETW_MassSquadSharedFragment> SquadSharedFragmentList;
+	TConstArrayView<FETW_MassSquadStateFragment> SquadStateFragmentList;
+
+	// identity only, read only on server
+	const FETW_MassSquadSharedFragment* SquadSharedFragment = nullptr;
 };
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include "MassObserverRegistry.h"
 #include "MassSimulationLOD.h"
 #include "Mass/Common/Fragments/ETW_MassFragments.h"
+#include "Mass/Navigation/ETW_MassNavigationSubsystem.h"
 
 
 void UETW_MassSelectRandMoveTargetTrait::BuildTemplate(FMassEntityTemplateBuildContext& BuildContext,
@@ -57,7 +58,9 @@ void UETW_MassSelectRandMoveTargetProcessor::ConfigureQueries()
 
 void UETW_MassSelectRandMoveTargetProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
 {
-	EntityQuery.ForEachEntityChunk(EntityManager, Context, ([&EntityManager](FMassExecutionContext& Context)
+	const UETW_MassNavigationSubsystem* NavigationSubsystem = UWorld::GetSubsystem<UETW_MassNavigationSubsystem>(EntityManager.GetWorld());
+
+	EntityQuery.ForEachEntityChunk(EntityManager, Context, ([&EntityManager, NavigationSubsystem](FMassExecutionContext& Context)
 		{
 			const UWorld* World = EntityManager.GetWorld();
 
@@ -69,25 +72,45 @@ void UETW_MassSelectRandMoveTargetProcessor::Execute(FMassEntityManager& EntityM
 			const TConstArrayView<FMassInitialLocationFragment> InitialLocationList = Context.GetFragmentView<FMassInitialLocationFragment>();
 			const TConstArrayView<FTransformFragment> TransformList = Context.GetFragmentView<FTransformFragment>();
 
+			// new targets of the chunk are projected to navmesh in one batch
+			TArray<int32, TInlineAllocator<16>> NewTargetEntities;
+			TArray<FVector, TInlineAllocator<16>> NewTargets;
+			for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
+			{
+				const FMassMoveTargetFragment& MoveTargetFrag = MoveTargetList[EntityIndex];
+				if (MoveTargetFrag.GetCurrentAction() == EMassMovementAction::Stand || MoveTargetFrag.DistanceToGoal <= ArriveSlackRadius)
+				{
+					NewTargetEntities.Add(EntityIndex);
+					NewTargets.Add(FVector(FMath::FRandRange(-MoveDistMax, MoveDistMax), FMath::FRandRange(-MoveDistMax, MoveDistMax), 0) + InitialLocationList[EntityIndex].Location);
+				}
+			}
+
+			// off navmesh target is dropped, entity picks another one next tick. Level without navmesh takes targets as they are
+			TArray<bool> Projected;
+			const bool bHasNavmesh = NavigationSubsystem && !NewTargets.IsEmpty() && NavigationSubsystem->ProjectPointsToNavigation(FNavAgentProperties::DefaultProperties, NewTargets, Projected);
+			for (int32 TargetIdx = 0; TargetIdx < NewTargets.Num(); TargetIdx++)
+			{
+				if (bHasNavmesh && !Projected[TargetIdx])
+				{
+					continue;
+				}
+
+				// set new target, XY mover keeps its own height
+				const int32 EntityIndex = NewTargetEntities[TargetIdx];
+				FMassMoveTargetFragment& MoveTargetFrag = MoveTargetList[EntityIndex];
+				MoveTargetFrag.CreateNewAction(EMassMovementAction::Move, *World);
+				MoveTargetFrag.IntentAtGoal = EMassMovementAction::Stand;
+				TargetLocationList[EntityIndex].Target = FVector(NewTargets[TargetIdx].X, NewTargets[TargetIdx].Y, InitialLocationList[EntityIndex].Location.Z);
+			}
+
 			for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
 			{
 				FMassMoveTargetFragment& MoveTargetFrag = MoveTargetList[EntityIndex];
-				FVector& TargetLocation = TargetLocationList[EntityIndex].Target;
-				const FVector& InitialLocation = InitialLocationList[EntityIndex].Location;
+				const FVector& TargetLocation = TargetLocationList[EntityIndex].Target;
 				const FTransform& Transform = TransformList[EntityIndex].GetTransform();
 
 				FVector CurrentLocation = Transform.GetLocation();
 
-				if (MoveTargetFrag.GetCurrentAction() == EMassMovementAction::Stand || MoveTargetFrag.DistanceToGoal <= ArriveSlackRadius)
-				{
-					// set new target
-					MoveTargetFrag.CreateNewAction(EMassMovementAction::Move, *World);
-					MoveTargetFrag.IntentAtGoal = EMassMovementAction::Stand;
-					const FVector NewMoveToLocation = FVector(FMath::FRandRange(-MoveDistMax, MoveDistMax), FMath::FRandRange(-MoveDistMax, MoveDistMax), 0) + InitialLocation;
-					TargetLocation = NewMoveToLocation;
-					// MoveTargetFrag.Center = NewMoveToLocation;
-				}
-				
 				// update MoveTargetFragment
 				FVector DirectionToTarget = TargetLocation - CurrentLocation;
 				MoveTargetFrag.Center = CurrentLocation;
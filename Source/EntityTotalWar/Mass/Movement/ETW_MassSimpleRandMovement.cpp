@@ -8,6 +8,32 @@
 #include "MassEntitySubsystem.h"
 #include "MassSimulationLOD.h"
 #include "Mass/Common/Fragments/ETW_MassFragments.h"
+#include "Mass/Navigation/ETW_MassNavigationSubsystem.h"
+
+namespace
+{
+	/**
+	 * Projects random targets of a chunk to navmesh in one batch. Off navmesh targets are dropped and picked again next tick,
+	 * level without navmesh takes targets as they are.
+	 */
+	void ApplyRandomTargets(const UETW_MassNavigationSubsystem* NavigationSubsystem, const FNavAgentProperties& NavAgentProps, const TArrayView<FMassTargetLocationFragment> TargetList, TConstArrayView<int32> EntityIndices, TArrayView<FVector> Targets)
+	{
+		if (Targets.IsEmpty())
+		{
+			return;
+		}
+
+		TArray<bool> Projected;
+		const bool bHasNavmesh = NavigationSubsystem && NavigationSubsystem->ProjectPointsToNavigation(NavAgentProps, Targets, Projected);
+		for (int32 TargetIdx = 0; TargetIdx < Targets.Num(); TargetIdx++)
+		{
+			if (!bHasNavmesh || Projected[TargetIdx])
+			{
+				TargetList[EntityIndices[TargetIdx]].Target = Targets[TargetIdx];
+			}
+		}
+	}
+}
 
 
 void UMassSimpleRandMovementTrait::BuildTemplate(FMassEntityTemplateBuildContext& BuildContext, const UWorld& World) const
@@ -44,11 +70,15 @@ void UMassSimpleRandMovementProcessor::ConfigureQueries()
 	EntityQuery.SetChunkFilter(&FMassSimulationVariableTickChunkFragment::ShouldTickChunkThisFrame);
 
 	EntityQuery.RegisterWithProcessor(*this);
+
+	ProcessorRequirements.AddSubsystemRequirement<UETW_MassNavigationSubsystem>(EMassFragmentAccess::ReadOnly);
 }
 
 void UMassSimpleRandMovementProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
 {
-	EntityQuery.ForEachEntityChunk(EntityManager, Context, ([this](FMassExecutionContext& Context)
+	const UETW_MassNavigationSubsystem* NavigationSubsystem = UWorld::GetSubsystem<UETW_MassNavigationSubsystem>(EntityManager.GetWorld());
+
+	EntityQuery.ForEachEntityChunk(EntityManager, Context, ([NavigationSubsystem](FMassExecutionContext& Context)
 		{
 			const float Speed = Context.GetConstSharedFragment<FMassMassSimpleRandMovementParams>().Speed;
 			const float AcceptanceRadius = Context.GetConstSharedFragment<FMassMassSimpleRandMovementParams>().AcceptanceRadius;
@@ -62,6 +92,9 @@ void UMassSimpleRandMovementProcessor::Execute(FMassEntityManager& EntityManager
 			const TArrayView<FTransformFragment> TransformList = Context.GetMutableFragmentView<FTransformFragment>();
 			const TArrayView<FMassTargetLocationFragment> TargetList = Context.GetMutableFragmentView<FMassTargetLocationFragment>();
 
+			TArray<int32, TInlineAllocator<16>> NewTargetEntities;
+			TArray<FVector, TInlineAllocator<16>> NewTargets;
+
 			for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
 			{
 				FTransform& Transform = TransformList[EntityIndex].GetMutableTransform();
@@ -78,7 +111,8 @@ void UMassSimpleRandMovementProcessor::Execute(FMassEntityManager& EntityManager
 				if (FMath::Abs((CurrentLocation - MoveTarget).Size()) <= AcceptanceRadius || MoveTarget.IsZero())
 				{
 					// set new target
-					MoveTarget = FVector(FMath::FRandRange(-MoveDistMax, MoveDistMax), FMath::FRandRange(-MoveDistMax, MoveDistMax), 200.f);
+					NewTargetEntities.Add(EntityIndex);
+					NewTargets.Add(FVector(FMath::FRandRange(-MoveDistMax, MoveDistMax), FMath::FRandRange(-MoveDistMax, MoveDistMax), 200.f));
 				}
 				else
 				{
@@ -88,6 +122,8 @@ void UMassSimpleRandMovementProcessor::Execute(FMassEntityManager& EntityManager
 
 				
 			}
+
+			ApplyRandomTargets(NavigationSubsystem, Context.GetConstSharedFragment<FMassMassSimpleRandMovementParams>().NavAgentProps, TargetList, NewTargetEntities, NewTargets);
 		}));
 
 }
@@ -125,11 +161,15 @@ void UMassRandVelocityProcessor::ConfigureQueries()
 	EntityQuery.AddConstSharedRequirement<FMassMassSimpleRandMovementParams>(EMassFragmentPresence::All);
 
 	EntityQuery.SetChunkFilter(&FMassSimulationVariableTickChunkFragment::ShouldTickChunkThisFrame);
+
+	ProcessorRequirements.AddSubsystemRequirement<UETW_MassNavigationSubsystem>(EMassFragmentAccess::ReadOnly);
 }
 
 void UMassRandVelocityProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
 {
-	EntityQuery.ForEachEntityChunk(EntityManager, Context, ([this](FMassExecutionContext& Context)
+	const UETW_MassNavigationSubsystem* NavigationSubsystem = UWorld::GetSubsystem<UETW_MassNavigationSubsystem>(EntityManager.GetWorld());
+
+	EntityQuery.ForEachEntityChunk(EntityManager, Context, ([NavigationSubsystem](FMassExecutionContext& Context)
 		{
 			const float Speed = Context.GetConstSharedFragment<FMassMassSimpleRandMovementParams>().Speed;
 			const float AcceptanceRadius = Context.GetConstSharedFragment<FMassMassSimpleRandMovementParams>().AcceptanceRadius;
@@ -140,6 +180,9 @@ void UMassRandVelocityProcessor::Execute(FMassEntityManager& EntityManager, FMas
 			const TConstArrayView<FTransformFragment> TransformList = Context.GetFragmentView<FTransformFragment>();
 			const TArrayView<FMassTargetLocationFragment> TargetList = Context.GetMutableFragmentView<FMassTargetLocationFragment>();
 
+			TArray<int32, TInlineAllocator<16>> NewTargetEntities;
+			TArray<FVector, TInlineAllocator<16>> NewTargets;
+
 			for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
 			{
 				const FTransform& Transform = TransformList[EntityIndex].GetTransform();
@@ -159,8 +202,11 @@ void UMassRandVelocityProcessor::Execute(FMassEntityManager& EntityManager, FMas
 				if (FMath::Abs((CurrentLocation - MoveTarget).Size2D()) <= AcceptanceRadius || MoveTarget.IsZero())
 				{
 					// set new target
-					MoveTarget = FVector(FMath::FRandRange(-MoveDistMax, MoveDistMax), FMath::FRandRange(-MoveDistMax, MoveDistMax), 200.f);
+					NewTargetEntities.Add(EntityIndex);
+					NewTargets.Add(FVector(FMath::FRandRange(-MoveDistMax, MoveDistMax), FMath::FRandRange(-MoveDistMax, MoveDistMax), 200.f));
 				}
 			}
+
+			ApplyRandomTargets(NavigationSubsystem, Context.GetConstSharedFragment<FMassMassSimpleRandMovementParams>().NavAgentProps, TargetList, NewTargetEntities, NewTargets);
 		}));
 }
@@ -5,6 +5,7 @@
 #include "MassEntityTraitBase.h"
 #include "MassProcessor.h"
 #include "MassEntityTypes.h"
+#include "AI/Navigation/NavigationTypes.h"
 #include "ETW_MassSimpleRandMovement.generated.h"
 
 
@@ -30,6 +31,10 @@ struct ENTITYTOTALWAR_API FMassMassSimpleRandMovementParams : public FMassShared
 	/**  */
 	UPROPERTY(EditAnywhere, Category = "Movement", meta = (ClampMin = "0", ForceUnits="cm"))
 	float MoveDistMax = 400.f;
+
+	/** Agent random targets are projected to navmesh for */
+	UPROPERTY(EditAnywhere, Category = "Movement")
+	FNavAgentProperties NavAgentProps = FNavAgentProperties::DefaultProperties;
 };
 
 
@@ -0,0 +1,492 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "ETW_MassFlowField.h"
+#include "ETW_MassNavigationSubsystem.h"
+#include "ETW_MassPathFollowing.h"
+#include "MassEntityTemplateRegistry.h"
+#include "MassCommonFragments.h"
+#include "MassExecutionContext.h"
+#include "MassNavigationFragments.h"
+#include "NavigationData.h"
+#include "Async/ParallelFor.h"
+
+namespace UE::Mass::Navigation::FlowField
+{
+	// X, Y offsets of 8 neighbours, orthogonal first
+	constexpr int32 NeighbourOffsets[8][2] = { {1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {1, -1}, {-1, 1}, {-1, -1} };
+
+	// each link is raycast once, by the cell it's ahead of. Link to neighbour behind is stored by that neighbour
+	constexpr uint8 AheadNeighbourMask = (1 << 0) | (1 << 2) | (1 << 4) | (1 << 5);
+	constexpr int32 OppositeNeighbours[8] = { 1, 0, 3, 2, 7, 6, 5, 4 };
+
+	constexpr int32 ProjectBlockSize = 256;
+
+	struct FOpenHeapPredicate
+	{
+		bool operator()(const TPair<float, int32>& A, const TPair<float, int32>& B) const { return A.Key < B.Key; }
+	};
+}
+
+void FETW_MassFlowField::Init(const ANavigationData& InNavData, const FVector& InDestination, const float InCellSize, const float HalfExtent, const float InVerticalExtent)
+{
+	NavData = &InNavData;
+	Destination = InDestination;
+	CellSize = FMath::Max(InCellSize, 1.f);
+	VerticalExtent = InVerticalExtent;
+
+	// odd size, so destination is in the center cell
+	Size = 2 * FMath::CeilToInt(HalfExtent / CellSize) + 1;
+	GoalCell = FIntPoint(Size / 2, Size / 2);
+	Origin = Destination - FVector(Size * CellSize * 0.5f, Size * CellSize * 0.5f, 0.f);
+
+	Invalidate();
+}
+
+void FETW_MassFlowField::Invalidate()
+{
+	const int32 NumCells = Size * Size;
+	CellPolys.Init(INVALID_NAVNODEREF, NumCells);
+	CellLocations.Init(FVector3f::ZeroVector, NumCells);
+	CellLinks.Init(0, NumCells);
+	Integration.Init(MAX_flt, NumCells);
+	Directions.Init(FVector2f::ZeroVector, NumCells);
+	TileRefs.Reset();
+	OpenHeap.Reset();
+
+	Stage = EBuildStage::Projecting;
+	NextCell = 0;
+}
+
+bool FETW_MassFlowField::AreTilesValid() const
+{
+	// field without navigation data has nothing to rebuild from
+	const ANavigationData* NavDataPtr = NavData.Get();
+	return NavDataPtr == nullptr || UE::Mass::Navigation::AreTileRefsValid(*NavDataPtr, TileRefs);
+}
+
+FVector FETW_MassFlowField::GetCellCenter(const int32 X, const int32 Y) const
+{
+	return Origin + FVector((X + 0.5f) * CellSize, (Y + 0.5f) * CellSize, 0.f);
+}
+
+bool FETW_MassFlowField::IsLinked(const int32 CellIdx, const int32 NeighbourCell, const int32 NeighbourIdx) const
+{
+	using namespace UE::Mass::Navigation::FlowField;
+
+	return (AheadNeighbourMask & (1 << NeighbourIdx))
+		? (CellLinks[CellIdx] & (1 << NeighbourIdx)) != 0
+		: (CellLinks[NeighbourCell] & (1 << OppositeNeighbours[NeighbourIdx])) != 0;
+}
+
+void FETW_MassFlowField::Build(int32& InOutCellBudget)
+{
+	while (InOutCellBudget > 0 && Stage != EBuildStage::Ready)
+	{
+		if (Stage == EBuildStage::Projecting)
+		{
+			ProjectCells(InOutCellBudget);
+		}
+		else if (Stage == EBuildStage::Linking)
+		{
+			LinkCells(InOutCellBudget);
+		}
+		else
+		{
+			Integrate(InOutCellBudget);
+		}
+	}
+}
+
+void FETW_MassFlowField::ProjectCells(int32& InOutCellBudget)
+{
+	using namespace UE::Mass::Navigation::FlowField;
+
+	const ANavigationData* NavDataPtr = NavData.Get();
+	const int32 NumCells = FMath::Min(InOutCellBudget, CellPolys.Num() - NextCell);
+	if (NavDataPtr && NumCells > 0)
+	{
+		const int32 FirstCell = NextCell;
+		const FVector Extent(CellSize * 0.5f, CellSize * 0.5f, VerticalExtent);
+		const int32 NumBlocks = FMath::DivideAndRoundUp(NumCells, ProjectBlockSize);
+
+		// navmesh queries are read only, cells are written by one block each
+		ParallelFor(NumBlocks, [this, NavDataPtr, FirstCell, NumCells, &Extent](const int32 BlockIdx)
+		{
+			const int32 BlockEnd = FirstCell + FMath::Min((BlockIdx + 1) * ProjectBlockSize, NumCells);
+			for (int32 CellIdx = FirstCell + BlockIdx * ProjectBlockSize; CellIdx < BlockEnd; CellIdx++)
+			{
+				FNavLocation NavLocation;
+				if (NavDataPtr->ProjectPoint(GetCellCenter(CellIdx % Size, CellIdx / Size), NavLocation, Extent))
+				{
+					CellPolys[CellIdx] = NavLocation.NodeRef;
+					CellLocations[CellIdx] = FVector3f(NavLocation.Location);
+				}
+			}
+		});
+	}
+
+	NextCell += FMath::Max(NumCells, 0);
+	InOutCellBudget -= FMath::Max(NumCells, 1);
+
+	if (NavDataPtr == nullptr || NextCell >= CellPolys.Num())
+	{
+		if (NavDataPtr)
+		{
+			UE::Mass::Navigation::GetTileRefs(*NavDataPtr, CellPolys, TileRefs);
+		}
+
+		NextCell = 0;
+		Stage = EBuildStage::Linking;
+	}
+}
+
+void FETW_MassFlowField::LinkCells(int32& InOutCellBudget)
+{
+	using namespace UE::Mass::Navigation::FlowField;
+
+	const ANavigationData* NavDataPtr = NavData.Get();
+	const int32 NumCells = FMath::Min(InOutCellBudget, CellLinks.Num() - NextCell);
+	if (NavDataPtr && NumCells > 0)
+	{
+		const int32 FirstCell = NextCell;
+		const int32 GoalIdx = GetCellIndex(GoalCell.X, GoalCell.Y);
+		const FSharedConstNavQueryFilter Filter = NavDataPtr->GetDefaultQueryFilter();
+		const int32 NumBlocks = FMath::DivideAndRoundUp(NumCells, ProjectBlockSize);
+
+		// adjacent passable cells may be split by wall or ledge thinner than a cell, they are linked only when
+		// navmesh raycast between their projections isn't blocked. Cells write own links only
+		ParallelFor(NumBlocks, [this, NavDataPtr, FirstCell, NumCells, GoalIdx, &Filter](const int32 BlockIdx)
+		{
+			const int32 BlockEnd = FirstCell + FMath::Min((BlockIdx + 1) * ProjectBlockSize, NumCells);
+			for (int32 CellIdx = FirstCell + BlockIdx * ProjectBlockSize; CellIdx < BlockEnd; CellIdx++)
+			{
+				const int32 X = CellIdx % Size;
+				const int32 Y = CellIdx / Size;
+				uint8 Links = 0;
+				for (int32 NeighbourIdx = 0; NeighbourIdx < 8; NeighbourIdx++)
+				{
+					const int32 NX = X + NeighbourOffsets[NeighbourIdx][0];
+					const int32 NY = Y + NeighbourOffsets[NeighbourIdx][1];
+					if (!(AheadNeighbourMask & (1 << NeighbourIdx)) || NX < 0 || NY < 0 || NX >= Size || NY >= Size)
+					{
+						continue;
+					}
+
+					const int32 NeighbourCell = GetCellIndex(NX, NY);
+					const bool bPassable = IsPassable(CellIdx);
+					const bool bNeighbourPassable = IsPassable(NeighbourCell);
+
+					// off navmesh goal cell is linked to its passable neighbours, destination may be right next to obstacle
+					bool bLinked = (CellIdx == GoalIdx && !bPassable && bNeighbourPassable) || (NeighbourCell == GoalIdx && !bNeighbourPassable && bPassable);
+					if (bPassable && bNeighbourPassable)
+					{
+						FVector HitLocation;
+						bLinked = !NavDataPtr->Raycast(FVector(CellLocations[CellIdx]), FVector(CellLocations[NeighbourCell]), HitLocation, Filter);
+					}
+					Links |= bLinked ? (1 << NeighbourIdx) : 0;
+				}
+				CellLinks[CellIdx] = Links;
+			}
+		});
+	}
+
+	NextCell += FMath::Max(NumCells, 0);
+	InOutCellBudget -= FMath::Max(NumCells, 1);
+
+	if (NavDataPtr == nullptr || NextCell >= CellLinks.Num())
+	{
+		// goal cell is seeded even when off navmesh, its links lead to passable neighbours
+		const int32 GoalIdx = GetCellIndex(GoalCell.X, GoalCell.Y);
+		Integration[GoalIdx] = 0.f;
+		OpenHeap.HeapPush(TPair<float, int32>(0.f, GoalIdx), FOpenHeapPredicate());
+		Stage = EBuildStage::Integrating;
+	}
+}
+
+void FETW_MassFlowField::Integrate(int32& InOutCellBudget)
+{
+	using namespace UE::Mass::Navigation::FlowField;
+
+	while (InOutCellBudget > 0 && !OpenHeap.IsEmpty())
+	{
+		TPair<float, int32> Open;
+		OpenHeap.HeapPop(Open, FOpenHeapPredicate(), false);
+		InOutCellBudget--;
+
+		// stale entry, cell was reached cheaper meanwhile
+		if (Open.Key > Integration[Open.Value])
+		{
+			continue;
+		}
+
+		const int32 X = Open.Value % Size;
+		const int32 Y = Open.Value / Size;
+		for (int32 NeighbourIdx = 0; NeighbourIdx < 8; NeighbourIdx++)
+		{
+			const int32 NX = X + NeighbourOffsets[NeighbourIdx][0];
+			const int32 NY = Y + NeighbourOffsets[NeighbourIdx][1];
+			if (NX < 0 || NY < 0 || NX >= Size || NY >= Size || !IsPassable(GetCellIndex(NX, NY)) || !IsLinked(Open.Value, GetCellIndex(NX, NY), NeighbourIdx))
+			{
+				continue;
+			}
+
+			// diagonal step doesn't cut corners
+			const bool bDiagonal = NeighbourIdx >= 4;
+			if (bDiagonal && (!IsPassable(GetCellIndex(NX, Y)) || !IsPassable(GetCellIndex(X, NY))))
+			{
+				continue;
+			}
+
+			const int32 NeighbourCell = GetCellIndex(NX, NY);
+			const float Cost = Open.Key + (bDiagonal ? UE_SQRT_2 : 1.f);
+			if (Cost < Integration[NeighbourCell])
+			{
+				Integration[NeighbourCell] = Cost;
+				OpenHeap.HeapPush(TPair<float, int32>(Cost, NeighbourCell), FOpenHeapPredicate());
+			}
+		}
+	}
+
+	if (OpenHeap.IsEmpty())
+	{
+		BuildDirections();
+		OpenHeap.Empty();
+		Stage = EBuildStage::Ready;
+	}
+}
+
+void FETW_MassFlowField::BuildDirections()
+{
+	using namespace UE::Mass::Navigation::FlowField;
+
+	ParallelFor(Size, [this](const int32 Y)
+	{
+		for (int32 X = 0; X < Size; X++)
+		{
+			const int32 CellIdx = GetCellIndex(X, Y);
+			float BestCost = Integration[CellIdx];
+			if (BestCost == MAX_flt || CellIdx == GetCellIndex(GoalCell.X, GoalCell.Y))
+			{
+				// unreached cells and goal cell have no direction, agents head straight to destination there
+				continue;
+			}
+
+			FVector2f BestDirection = FVector2f::ZeroVector;
+			for (int32 NeighbourIdx = 0; NeighbourIdx < 8; NeighbourIdx++)
+			{
+				const int32 NX = X + NeighbourOffsets[NeighbourIdx][0];
+				const int32 NY = Y + NeighbourOffsets[NeighbourIdx][1];
+				if (NX < 0 || NY < 0 || NX >= Size || NY >= Size || !IsLinked(CellIdx, GetCellIndex(NX, NY), NeighbourIdx))
+				{
+					continue;
+				}
+				if (NeighbourIdx >= 4 && (!IsPassable(GetCellIndex(NX, Y)) || !IsPassable(GetCellIndex(X, NY))))
+				{
+					continue;
+				}
+
+				const float NeighbourCost = Integration[GetCellIndex(NX, NY)];
+				if (NeighbourCost < BestCost)
+				{
+					BestCost = NeighbourCost;
+					BestDirection = FVector2f(NeighbourOffsets[NeighbourIdx][0], NeighbourOffsets[NeighbourIdx][1]).GetSafeNormal();
+				}
+			}
+			Directions[CellIdx] = BestDirection;
+		}
+	});
+}
+
+bool FETW_MassFlowField::SampleDirection(const FVector& Location, FVector& OutDirection) const
+{
+	if (!IsReady())
+	{
+		return false;
+	}
+
+	// bilinear blend of 4 nearest cell centers, smooths 8-way grid directions
+	const float LocalX = (Location.X - Origin.X) / CellSize - 0.5f;
+	const float LocalY = (Location.Y - Origin.Y) / CellSize - 0.5f;
+	const int32 X0 = FMath::FloorToInt(LocalX);
+	const int32 Y0 = FMath::FloorToInt(LocalY);
+	const float FracX = LocalX - X0;
+	const float FracY = LocalY - Y0;
+
+	FVector2f Blended = FVector2f::ZeroVector;
+	for (int32 DY = 0; DY < 2; DY++)
+	{
+		for (int32 DX = 0; DX < 2; DX++)
+		{
+			const int32 X = X0 + DX;
+			const int32 Y = Y0 + DY;
+			if (X < 0 || Y < 0 || X >= Size || Y >= Size)
+			{
+				continue;
+			}
+			const float Weight = (DX ? FracX : 1.f - FracX) * (DY ? FracY : 1.f - FracY);
+			Blended += Directions[GetCellIndex(X, Y)] * Weight;
+		}
+	}
+
+	if (Blended.IsNearlyZero())
+	{
+		return false;
+	}
+
+	const FVector2f Direction = Blended.GetSafeNormal();
+	OutDirection = FVector(Direction.X, Direction.Y, 0.f);
+	return true;
+}
+
+void UETW_MassFlowFieldFollowTrait::BuildTemplate(FMassEntityTemplateBuildContext& BuildContext, const UWorld& World) const
+{
+	BuildContext.AddFragment<FETW_MassFlowFieldFragment>();
+	BuildContext.RequireFragment<FMassMoveTargetFragment>();
+	BuildContext.RequireFragment<FTransformFragment>();
+
+	FMassEntityManager& EntityManager = UE::Mass::Utils::GetEntityManagerChecked(World);
+	const FConstSharedStruct ParamsFragment = EntityManager.GetOrCreateConstSharedFragment(Params);
+	BuildContext.AddConstSharedFragment(ParamsFragment);
+}
+
+UETW_MassFlowFieldFollowProcessor::UETW_MassFlowFieldFollowProcessor()
+	: EntityQuery(*this)
+{
+	bAutoRegisterWithProcessingPhases = true;
+	ExecutionFlags = (int32)(EProcessorExecutionFlags::Server | EProcessorExecutionFlags::Standalone);
+	ExecutionOrder.ExecuteInGroup = UE::Mass::ProcessorGroupNames::Tasks;
+	ExecutionOrder.ExecuteAfter.Add(UETW_MassPathRequestProcessor::StaticClass()->GetFName());
+}
+
+void UETW_MassFlowFieldFollowProcessor::ConfigureQueries()
+{
+	EntityQuery.AddRequirement<FETW_MassFlowFieldFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FMassMoveTargetFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddConstSharedRequirement<FMassPathFollowParams>(EMassFragmentPresence::All);
+	EntityQuery.AddSubsystemRequirement<UETW_MassNavigationSubsystem>(EMassFragmentAccess::ReadWrite);
+}
+
+void UETW_MassFlowFieldFollowProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(UETW_MassFlowFieldFollowProcessor_Execute);
+
+	UWorld* World = EntityManager.GetWorld();
+	UETW_MassNavigationSubsystem* NavigationSubsystem = UWorld::GetSubsystem<UETW_MassNavigationSubsystem>(World);
+	if (NavigationSubsystem == nullptr)
+	{
+		return;
+	}
+
+	ArrivedFieldIds.Reset();
+
+	// fields are only read here, they are built and released on game thread by navigation subsystem
+	EntityQuery.ParallelForEachEntityChunk(EntityManager, Context, [this, World, NavigationSubsystem](FMassExecutionContext& Context)
+	{
+		const FMassPathFollowParams& Params = Context.GetConstSharedFragment<FMassPathFollowParams>();
+		const TConstArrayView<FTransformFragment> TransformList = Context.GetFragmentView<FTransformFragment>();
+		const TArrayView<FETW_MassFlowFieldFragment> FlowFieldList = Context.GetMutableFragmentView<FETW_MassFlowFieldFragment>();
+		const TArrayView<FMassMoveTargetFragment> MoveTargetList = Context.GetMutableFragmentView<FMassMoveTargetFragment>();
+
+		TArray<uint32> LocalArrivedFieldIds;
+		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
+		{
+			FETW_MassFlowFieldFragment& FlowFieldFrag = FlowFieldList[EntityIndex];
+			if (FlowFieldFrag.FieldId == 0)
+			{
+				continue;
+			}
+
+			FMassMoveTargetFragment& MoveTarget = MoveTargetList[EntityIndex];
+			const FVector Location = TransformList[EntityIndex].GetTransform().GetLocation();
+			const FETW_MassFlowField* FlowField = NavigationSubsystem->FindFlowField(FlowFieldFrag.FieldId);
+
+			FVector ToGoal = FlowFieldFrag.Destination - Location;
+			ToGoal.Z = 0.f;
+			const float DistanceToGoal = ToGoal.Size();
+
+			if (FlowField == nullptr || DistanceToGoal <= Params.SlackRadius)
+			{
+				if (MoveTarget.GetCurrentAction() != EMassMovementAction::Stand)
+				{
+					MoveTarget.CreateNewAction(EMassMovementAction::Stand, *World);
+				}
+				MoveTarget.Center = Location;
+				MoveTarget.DistanceToGoal = 0.f;
+
+				if (FlowField)
+				{
+					LocalArrivedFieldIds.Add(FlowFieldFrag.FieldId);
+				}
+				FlowFieldFrag.FieldId = 0;
+				continue;
+			}
+
+			// last cell and cells the field didn't reach are crossed straight
+			FVector Direction;
+			if (DistanceToGoal <= FlowField->GetCellSize() || !FlowField->SampleDirection(Location, Direction))
+			{
+				Direction = ToGoal / DistanceToGoal;
+			}
+
+			if (MoveTarget.GetCurrentAction() != EMassMovementAction::Move)
+			{
+				MoveTarget.CreateNewAction(EMassMovementAction::Move, *World);
+				MoveTarget.IntentAtGoal = EMassMovementAction::Stand;
+				MoveTarget.DesiredSpeed = FMassInt16Real(Params.DesiredSpeed);
+			}
+			MoveTarget.Center = Location + Direction * FMath::Min(DistanceToGoal, FlowField->GetCellSize());
+			MoveTarget.Forward = Direction;
+			MoveTarget.DistanceToGoal = DistanceToGoal;
+		}
+
+		if (!LocalArrivedFieldIds.IsEmpty())
+		{
+			FScopeLock Lock(&ArrivedFieldIdsCS);
+			ArrivedFieldIds.Append(LocalArrivedFieldIds);
+		}
+	});
+
+	// processor may run on a worker, fields map is changed on game thread only
+	if (!ArrivedFieldIds.IsEmpty())
+	{
+		NavigationSubsystem->QueueFlowFieldReleases(ArrivedFieldIds);
+	}
+}
+
+UETW_MassFlowFieldReleaseObserver::UETW_MassFlowFieldReleaseObserver()
+	: EntityQuery(*this)
+{
+	ObservedType = FETW_MassFlowFieldFragment::StaticStruct();
+	Operation = EMassObservedOperation::Remove;
+	ExecutionFlags = (int32)(EProcessorExecutionFlags::Server | EProcessorExecutionFlags::Standalone);
+}
+
+void UETW_MassFlowFieldReleaseObserver::ConfigureQueries()
+{
+	EntityQuery.AddRequirement<FETW_MassFlowFieldFragment>(EMassFragmentAccess::ReadWrite);
+}
+
+void UETW_MassFlowFieldReleaseObserver::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	UETW_MassNavigationSubsystem* NavigationSubsystem = UWorld::GetSubsystem<UETW_MassNavigationSubsystem>(EntityManager.GetWorld());
+	if (NavigationSubsystem == nullptr)
+	{
+		return;
+	}
+
+	EntityQuery.ForEachEntityChunk(EntityManager, Context, [NavigationSubsystem](FMassExecutionContext& Context)
+	{
+		const TArrayView<FETW_MassFlowFieldFragment> FlowFieldList = Context.GetMutableFragmentView<FETW_MassFlowFieldFragment>();
+		TArray<uint32, TInlineAllocator<64>> FieldIds;
+		for (FETW_MassFlowFieldFragment& FlowFieldFrag : FlowFieldList)
+		{
+			if (FlowFieldFrag.FieldId != 0)
+			{
+				FieldIds.Add(FlowFieldFrag.FieldId);
+				FlowFieldFrag.FieldId = 0;
+			}
+		}
+		NavigationSubsystem->QueueFlowFieldReleases(FieldIds);
+	});
+}
@@ -0,0 +1,183 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "MassEntityTraitBase.h"
+#include "MassProcessor.h"
+#include "MassObserverProcessor.h"
+#include "ETW_MassNavigationTypes.h"
+#include "ETW_MassFlowField.generated.h"
+
+class ANavigationData;
+
+/** Orders to the same area share one field, destination is quantized to field cells */
+struct FETW_MassFlowFieldKey
+{
+	UPTRINT NavData = 0;
+	FIntVector GoalCell = FIntVector::ZeroValue;
+
+	bool operator==(const FETW_MassFlowFieldKey& Other) const
+	{
+		return NavData == Other.NavData && GoalCell == Other.GoalCell;
+	}
+
+	friend uint32 GetTypeHash(const FETW_MassFlowFieldKey& Key)
+	{
+		return HashCombine(GetTypeHash(Key.NavData), GetTypeHash(Key.GoalCell));
+	}
+};
+
+/**
+ * Integration field on square grid centered on destination.
+ * Built in time slices: cells are projected to navmesh in parallel, then neighbour cells are linked by navmesh
+ * raycasts between their projections, then Dijkstra from goal cell fills integration costs over links, then each
+ * reached cell gets direction to its cheapest linked neighbour.
+ */
+struct ENTITYTOTALWAR_API FETW_MassFlowField
+{
+	enum class EBuildStage : uint8
+	{
+		Projecting,
+		Linking,
+		Integrating,
+		Ready,
+	};
+
+	void Init(const ANavigationData& InNavData, const FVector& InDestination, const float InCellSize, const float HalfExtent, const float InVerticalExtent);
+
+	/**
+	 * Continues build until field is ready or budget is spent.
+	 * @param InOutCellBudget cells to project, link or integrate this step, decreased by work done
+	 */
+	void Build(int32& InOutCellBudget);
+
+	bool IsReady() const { return Stage == EBuildStage::Ready; }
+
+	// restarts build, keeps destination and grid
+	void Invalidate();
+
+	// false when navmesh tile under the field was rebuilt since projection
+	bool AreTilesValid() const;
+
+	/**
+	 * Direction of flow at location, blended from surrounding cells.
+	 * @return false when field isn't ready or location isn't reachable through the field
+	 */
+	bool SampleDirection(const FVector& Location, FVector& OutDirection) const;
+
+	SIZE_T GetAllocatedSize() const
+	{
+		return sizeof(*this) + CellPolys.GetAllocatedSize() + CellLocations.GetAllocatedSize() + CellLinks.GetAllocatedSize() + TileRefs.GetAllocatedSize()
+			+ Integration.GetAllocatedSize() + Directions.GetAllocatedSize() + OpenHeap.GetAllocatedSize();
+	}
+
+	const FVector& GetDestination() const { return Destination; }
+	float GetCellSize() const { return CellSize; }
+
+	// ref count of orders using the field, field with no users is kept for a while for next orders
+	int32 RefCount = 0;
+	double ReleaseTime = 0.;
+
+private:
+	int32 GetCellIndex(const int32 X, const int32 Y) const { return Y * Size + X; }
+	bool IsPassable(const int32 CellIdx) const { return CellPolys[CellIdx] != INVALID_NAVNODEREF; }
+	FVector GetCellCenter(const int32 X, const int32 Y) const;
+	bool IsLinked(const int32 CellIdx, const int32 NeighbourCell, const int32 NeighbourIdx) const;
+
+	void ProjectCells(int32& InOutCellBudget);
+	void LinkCells(int32& InOutCellBudget);
+	void Integrate(int32& InOutCellBudget);
+	void BuildDirections();
+
+	TWeakObjectPtr<const ANavigationData> NavData;
+	FVector Destination = FVector::ZeroVector;
+	FVector Origin = FVector::ZeroVector;
+	float CellSize = 0.f;
+	float VerticalExtent = 0.f;
+	int32 Size = 0;
+	FIntPoint GoalCell = FIntPoint::ZeroValue;
+
+	// navmesh poly of the cell, INVALID_NAVNODEREF when cell is off navmesh
+	TArray<NavNodeRef> CellPolys;
+	TArray<FVector3f> CellLocations;
+
+	// bit per neighbour reachable by navmesh raycast, only set for neighbours ahead, see IsLinked
+	TArray<uint8> CellLinks;
+	TArray<NavNodeRef> TileRefs;
+	TArray<float> Integration;
+	TArray<FVector2f> Directions;
+
+	// Dijkstra open list, kept between slices
+	TArray<TPair<float, int32>> OpenHeap;
+
+	EBuildStage Stage = EBuildStage::Projecting;
+	int32 NextCell = 0;
+};
+
+/** Flow field of current move order, 0 when entity has no order */
+USTRUCT()
+struct ENTITYTOTALWAR_API FETW_MassFlowFieldFragment : public FMassFragment
+{
+	GENERATED_BODY()
+
+	uint32 FieldId = 0;
+
+	// own destination of the entity, shared field leads to the area around it
+	FVector Destination = FVector::ZeroVector;
+};
+
+/**
+ * Entity moves by flow field of its move order, see UETW_MassNavigationSubsystem::EntitySetFlowFieldDestination.
+ * Added to squad unit template it makes squad move orders go by flow field, see UETW_MassSquadFormationMoveProcessor.
+ */
+UCLASS(meta = (DisplayName = "ETW Flow Field Follow"))
+class ENTITYTOTALWAR_API UETW_MassFlowFieldFollowTrait : public UMassEntityTraitBase
+{
+	GENERATED_BODY()
+
+public:
+	virtual void BuildTemplate(FMassEntityTemplateBuildContext& BuildContext, const UWorld& World) const override;
+
+	UPROPERTY(EditAnywhere, Category = "Mass|Movement")
+	FMassPathFollowParams Params;
+};
+
+/**
+ * Samples flow field of entity move order into FMassMoveTargetFragment.
+ * Entities move straight to destination while their field is built, stand and release field on arrival.
+ */
+UCLASS()
+class ENTITYTOTALWAR_API UETW_MassFlowFieldFollowProcessor : public UMassProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UETW_MassFlowFieldFollowProcessor();
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+
+	FMassEntityQuery EntityQuery;
+
+	TArray<uint32> ArrivedFieldIds;
+	FCriticalSection ArrivedFieldIdsCS;
+};
+
+/**
+ * Releases flow field of removed entities.
+ */
+UCLASS()
+class ENTITYTOTALWAR_API UETW_MassFlowFieldReleaseObserver : public UMassObserverProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UETW_MassFlowFieldReleaseObserver();
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+
+	FMassEntityQuery EntityQuery;
+};
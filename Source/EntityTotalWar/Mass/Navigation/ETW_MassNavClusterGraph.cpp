@@ -0,0 +1,272 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "ETW_MassNavClusterGraph.h"
+#include "ETW_MassTypes.h"
+#include "NavigationSystem.h"
+#include "NavigationData.h"
+#include "Async/ParallelFor.h"
+#include "Algo/Reverse.h"
+#include "VisualLogger/VisualLogger.h"
+
+namespace UE::Mass::Navigation::ClusterGraph
+{
+	struct FOpenHeapPredicate
+	{
+		bool operator()(const TPair<float, int32>& A, const TPair<float, int32>& B) const { return A.Key < B.Key; }
+	};
+
+	// A* state of node reached by current query, unreached nodes have no entry
+	struct FSearchNode
+	{
+		float Cost = MAX_flt;
+		int32 Parent = INDEX_NONE;
+		bool bClosed = false;
+	};
+
+	struct FBuildEdge
+	{
+		int32 FromNode = INDEX_NONE;
+		int32 ToNode = INDEX_NONE;
+		float Cost = 0.f;
+	};
+}
+
+AETW_MassNavClusterGraph::AETW_MassNavClusterGraph()
+{
+	RootComponent = CreateDefaultSubobject<USceneComponent>(TEXT("SceneComp"));
+	RootComponent->SetMobility(EComponentMobility::Static);
+
+	PrimaryActorTick.bCanEverTick = false;
+}
+
+void AETW_MassNavClusterGraph::BeginPlay()
+{
+	Super::BeginPlay();
+
+	if (!IsBuilt() && bBuildAtBeginPlayIfEmpty)
+	{
+		UE_VLOG_UELOG(this, ETW_Mass, Warning, TEXT("%s wasn't built in editor, building at BeginPlay"), *GetName());
+		Build();
+	}
+}
+
+int32 AETW_MassNavClusterGraph::GetCluster(const FVector& Location) const
+{
+	const int32 X = FMath::FloorToInt((Location.X - GridOrigin.X) / ClusterSize);
+	const int32 Y = FMath::FloorToInt((Location.Y - GridOrigin.Y) / ClusterSize);
+	return X >= 0 && Y >= 0 && X < GridSizeX && Y < GridSizeY ? Y * GridSizeX + X : INDEX_NONE;
+}
+
+void AETW_MassNavClusterGraph::Build()
+{
+	using namespace UE::Mass::Navigation::ClusterGraph;
+	QUICK_SCOPE_CYCLE_COUNTER(AETW_MassNavClusterGraph_Build);
+
+	Modify();
+	Nodes.Reset();
+	Edges.Reset();
+	ClusterFirstNode.Reset();
+	ClusterNodes.Reset();
+	GridSizeX = 0;
+	GridSizeY = 0;
+
+	const UNavigationSystemV1* NavigationSystem = FNavigationSystem::GetCurrent<UNavigationSystemV1>(GetWorld());
+	const ANavigationData* NavData = NavigationSystem ? NavigationSystem->GetNavDataForProps(NavAgentProps) : nullptr;
+	const FBox Bounds = NavData ? NavData->GetBounds() : FBox(ForceInit);
+	if (NavData == nullptr || !Bounds.IsValid)
+	{
+		UE_VLOG_UELOG(this, ETW_Mass, Warning, TEXT("%s: no navmesh for agent, cluster graph isn't built"), *GetName());
+		return;
+	}
+
+	GridOrigin = Bounds.Min;
+	GridSizeX = FMath::Max(FMath::CeilToInt(Bounds.GetSize().X / ClusterSize), 1);
+	GridSizeY = FMath::Max(FMath::CeilToInt(Bounds.GetSize().Y / ClusterSize), 1);
+	const int32 NumClusters = GridSizeX * GridSizeY;
+	const float HalfHeight = Bounds.GetExtent().Z;
+	const float CenterZ = Bounds.GetCenter().Z;
+
+	TArray<TArray<int32, TInlineAllocator<5>>> Members;
+	Members.SetNum(NumClusters);
+
+	const auto AddNode = [this, NavData, &Members](const FVector& Point, const FVector& Extent, const int32 ClusterA, const int32 ClusterB)
+	{
+		FNavLocation NavLocation;
+		if (NavData->ProjectPoint(Point, NavLocation, Extent))
+		{
+			const int32 NodeIdx = Nodes.AddDefaulted();
+			Nodes[NodeIdx].Location = NavLocation.Location;
+			Members[ClusterA].Add(NodeIdx);
+			if (ClusterB != INDEX_NONE)
+			{
+				Members[ClusterB].Add(NodeIdx);
+			}
+		}
+	};
+
+	// region center per cluster, one entrance per shared border, nearest navmesh point to border middle
+	const float BorderDepth = FMath::Min(NavData->GetDefaultQueryExtent().X, ClusterSize * 0.1f);
+	for (int32 Y = 0; Y < GridSizeY; Y++)
+	{
+		for (int32 X = 0; X < GridSizeX; X++)
+		{
+			const int32 Cluster = Y * GridSizeX + X;
+			const FVector ClusterMin = GridOrigin + FVector(X * ClusterSize, Y * ClusterSize, 0.f);
+			const FVector ClusterCenter(ClusterMin.X + ClusterSize * 0.5f, ClusterMin.Y + ClusterSize * 0.5f, CenterZ);
+
+			AddNode(ClusterCenter, FVector(ClusterSize * 0.5f, ClusterSize * 0.5f, HalfHeight), Cluster, INDEX_NONE);
+			if (X + 1 < GridSizeX)
+			{
+				AddNode(FVector(ClusterMin.X + ClusterSize, ClusterCenter.Y, CenterZ), FVector(BorderDepth, ClusterSize * 0.5f, HalfHeight), Cluster, Cluster + 1);
+			}
+			if (Y + 1 < GridSizeY)
+			{
+				AddNode(FVector(ClusterCenter.X, ClusterMin.Y + ClusterSize, CenterZ), FVector(ClusterSize * 0.5f, BorderDepth, HalfHeight), Cluster, Cluster + GridSizeX);
+			}
+		}
+	}
+
+	// intra cluster edges, pathfinding is read only on navmesh like nav system async queries
+	TArray<TArray<FBuildEdge>> ClusterEdges;
+	ClusterEdges.SetNum(NumClusters);
+	ParallelFor(NumClusters, [this, NavData, &Members, &ClusterEdges](const int32 Cluster)
+	{
+		const TArray<int32, TInlineAllocator<5>>& ClusterMembers = Members[Cluster];
+		for (int32 IdxA = 0; IdxA < ClusterMembers.Num(); IdxA++)
+		{
+			for (int32 IdxB = IdxA + 1; IdxB < ClusterMembers.Num(); IdxB++)
+			{
+				const FVector& From = Nodes[ClusterMembers[IdxA]].Location;
+				const FVector& To = Nodes[ClusterMembers[IdxB]].Location;
+
+				const FPathFindingQuery Query(this, *NavData, From, To);
+				const FPathFindingResult Result = NavData->FindPath(NavAgentProps, Query);
+				if (!Result.IsSuccessful() || Result.IsPartial())
+				{
+					continue;
+				}
+
+				const float Length = Result.Path->GetLength();
+				if (Length <= FVector::Dist(From, To) * MaxDetourFactor)
+				{
+					ClusterEdges[Cluster].Add({ ClusterMembers[IdxA], ClusterMembers[IdxB], Length });
+				}
+			}
+		}
+	});
+
+	// undirected edges to adjacency ranges
+	TArray<FBuildEdge> AllEdges;
+	for (const TArray<FBuildEdge>& LocalEdges : ClusterEdges)
+	{
+		AllEdges.Append(LocalEdges);
+	}
+	for (const FBuildEdge& Edge : AllEdges)
+	{
+		Nodes[Edge.FromNode].NumEdges++;
+		Nodes[Edge.ToNode].NumEdges++;
+	}
+	int32 NextEdge = 0;
+	for (FETW_MassNavClusterNode& Node : Nodes)
+	{
+		Node.FirstEdge = NextEdge;
+		NextEdge += Node.NumEdges;
+		Node.NumEdges = 0;
+	}
+	Edges.SetNum(NextEdge);
+	for (const FBuildEdge& Edge : AllEdges)
+	{
+		FETW_MassNavClusterNode& FromNode = Nodes[Edge.FromNode];
+		Edges[FromNode.FirstEdge + FromNode.NumEdges++] = { Edge.ToNode, Edge.Cost };
+		FETW_MassNavClusterNode& ToNode = Nodes[Edge.ToNode];
+		Edges[ToNode.FirstEdge + ToNode.NumEdges++] = { Edge.FromNode, Edge.Cost };
+	}
+
+	ClusterFirstNode.Reserve(NumClusters + 1);
+	for (const TArray<int32, TInlineAllocator<5>>& ClusterMembers : Members)
+	{
+		ClusterFirstNode.Add(ClusterNodes.Num());
+		ClusterNodes.Append(ClusterMembers);
+	}
+	ClusterFirstNode.Add(ClusterNodes.Num());
+
+	UE_VLOG_UELOG(this, ETW_Mass, Log, TEXT("%s built: %d clusters, %d nodes, %d edges"), *GetName(), NumClusters, Nodes.Num(), Edges.Num());
+}
+
+bool AETW_MassNavClusterGraph::FindAbstractPath(const FVector& From, const FVector& To, TArray<FVector>& OutWaypoints) const
+{
+	using namespace UE::Mass::Navigation::ClusterGraph;
+	QUICK_SCOPE_CYCLE_COUNTER(AETW_MassNavClusterGraph_FindAbstractPath);
+
+	OutWaypoints.Reset();
+
+	const int32 StartCluster = GetCluster(From);
+	const int32 GoalCluster = GetCluster(To);
+	if (StartCluster == INDEX_NONE || GoalCluster == INDEX_NONE || ClusterFirstNode.Num() != GridSizeX * GridSizeY + 1)
+	{
+		return false;
+	}
+
+	// virtual goal node after the graph nodes, linked from nodes of goal cluster
+	const int32 GoalNode = Nodes.Num();
+	const TConstArrayView<int32> GoalClusterNodes(ClusterNodes.GetData() + ClusterFirstNode[GoalCluster], ClusterFirstNode[GoalCluster + 1] - ClusterFirstNode[GoalCluster]);
+
+	// state only of nodes the query reaches, graph of a big map is not touched as a whole on every request
+	TMap<int32, FSearchNode> SearchNodes;
+	TArray<TPair<float, int32>> OpenHeap;
+	const auto Relax = [&SearchNodes, &OpenHeap](const int32 Node, const int32 Parent, const float Cost, const float Heuristic)
+	{
+		FSearchNode& SearchNode = SearchNodes.FindOrAdd(Node);
+		if (Cost < SearchNode.Cost)
+		{
+			SearchNode.Cost = Cost;
+			SearchNode.Parent = Parent;
+			OpenHeap.HeapPush(TPair<float, int32>(Cost + Heuristic, Node), FOpenHeapPredicate());
+		}
+	};
+
+	// straight distance is admissible heuristic, edge costs are navmesh path lengths
+	for (int32 Idx = ClusterFirstNode[StartCluster]; Idx < ClusterFirstNode[StartCluster + 1]; Idx++)
+	{
+		const int32 Node = ClusterNodes[Idx];
+		Relax(Node, INDEX_NONE, FVector::Dist(From, Nodes[Node].Location), FVector::Dist(Nodes[Node].Location, To));
+	}
+
+	while (!OpenHeap.IsEmpty())
+	{
+		TPair<float, int32> Open;
+		OpenHeap.HeapPop(Open, FOpenHeapPredicate(), false);
+		const int32 Node = Open.Value;
+		FSearchNode& SearchNode = SearchNodes.FindChecked(Node);
+		if (SearchNode.bClosed)
+		{
+			continue;
+		}
+		SearchNode.bClosed = true;
+
+		if (Node == GoalNode)
+		{
+			for (int32 PathNode = SearchNode.Parent; PathNode != INDEX_NONE; PathNode = SearchNodes.FindChecked(PathNode).Parent)
+			{
+				OutWaypoints.Add(Nodes[PathNode].Location);
+			}
+			Algo::Reverse(OutWaypoints);
+			return true;
+		}
+
+		// Relax may grow the map, SearchNode reference isn't used past this point
+		const float NodeCost = SearchNode.Cost;
+		const FETW_MassNavClusterNode& GraphNode = Nodes[Node];
+		for (int32 EdgeIdx = GraphNode.FirstEdge; EdgeIdx < GraphNode.FirstEdge + GraphNode.NumEdges; EdgeIdx++)
+		{
+			const FETW_MassNavClusterEdge& Edge = Edges[EdgeIdx];
+			Relax(Edge.ToNode, Node, NodeCost + Edge.Cost, FVector::Dist(Nodes[Edge.ToNode].Location, To));
+		}
+		if (GoalClusterNodes.Contains(Node))
+		{
+			Relax(GoalNode, Node, NodeCost + FVector::Dist(GraphNode.Location, To), 0.f);
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,111 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+#include "AI/Navigation/NavigationTypes.h"
+#include "ETW_MassNavClusterGraph.generated.h"
+
+class ANavigationData;
+
+/** Abstract graph node: cluster region center or entrance on border of two clusters */
+USTRUCT()
+struct FETW_MassNavClusterNode
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	FVector Location = FVector::ZeroVector;
+
+	// range in Edges
+	UPROPERTY()
+	int32 FirstEdge = 0;
+
+	UPROPERTY()
+	int32 NumEdges = 0;
+};
+
+USTRUCT()
+struct FETW_MassNavClusterEdge
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	int32 ToNode = INDEX_NONE;
+
+	// navmesh path length inside the cluster
+	UPROPERTY()
+	float Cost = 0.f;
+};
+
+/**
+ * HPA* style abstract graph over navmesh. Navmesh bounds are split into square clusters, nodes are cluster centers
+ * and entrances between neighbour clusters, edges connect nodes of one cluster by navmesh path length.
+ * Graph is built in editor and saved with the level, long path requests are planned on it first and only
+ * the segment ahead of the agent is refined on navmesh, see UETW_MassNavigationSubsystem.
+ */
+UCLASS(hidecategories = (Input, Rendering, Replication, Collision, HLOD, Physics, LOD, Cooking))
+class ENTITYTOTALWAR_API AETW_MassNavClusterGraph : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	AETW_MassNavClusterGraph();
+
+	/** Rebuilds graph from current navmesh, navmesh should be built */
+	UFUNCTION(CallInEditor, Category = "Navigation")
+	void Build();
+
+	bool IsBuilt() const { return !Nodes.IsEmpty(); }
+
+	/**
+	 * A* over abstract graph, From and To are linked to nodes of their clusters by straight distance.
+	 * @param OutWaypoints node locations between From and To, To itself isn't added
+	 * @return false when From or To is outside of graph or they aren't connected
+	 */
+	bool FindAbstractPath(const FVector& From, const FVector& To, TArray<FVector>& OutWaypoints) const;
+
+	float GetClusterSize() const { return ClusterSize; }
+
+	UPROPERTY(EditAnywhere, Category = "Navigation", meta = (ClampMin = "500", ForceUnits = "cm"))
+	float ClusterSize = 5000.f;
+
+	/** Intra cluster edge is dropped when its navmesh path is longer than straight distance times this, path leaves the cluster then */
+	UPROPERTY(EditAnywhere, Category = "Navigation", meta = (ClampMin = "1"))
+	float MaxDetourFactor = 3.f;
+
+	UPROPERTY(EditAnywhere, Category = "Navigation")
+	FNavAgentProperties NavAgentProps = FNavAgentProperties::DefaultProperties;
+
+	/** Build at BeginPlay when graph wasn't built in editor, blocks loading */
+	UPROPERTY(EditAnywhere, Category = "Navigation")
+	bool bBuildAtBeginPlayIfEmpty = true;
+
+protected:
+	virtual void BeginPlay() override;
+
+	int32 GetCluster(const FVector& Location) const;
+
+	UPROPERTY()
+	FVector GridOrigin = FVector::ZeroVector;
+
+	UPROPERTY()
+	int32 GridSizeX = 0;
+
+	UPROPERTY()
+	int32 GridSizeY = 0;
+
+	UPROPERTY()
+	TArray<FETW_MassNavClusterNode> Nodes;
+
+	UPROPERTY()
+	TArray<FETW_MassNavClusterEdge> Edges;
+
+	// nodes of cluster are ClusterNodes[ClusterFirstNode[Cluster] .. ClusterFirstNode[Cluster + 1]]
+	UPROPERTY()
+	TArray<int32> ClusterFirstNode;
+
+	UPROPERTY()
+	TArray<int32> ClusterNodes;
+};
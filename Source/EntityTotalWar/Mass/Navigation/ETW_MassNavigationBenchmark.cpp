@@ -0,0 +1,480 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "ETW_MassNavigationBenchmark.h"
+#include "ETW_MassTypes.h"
+#include "ETW_MassNavigationSubsystem.h"
+#include "ETW_MassFlowField.h"
+#include "MassEntitySubsystem.h"
+#include "MassEntityUtils.h"
+#include "NavigationSystem.h"
+#include "NavigationData.h"
+#include "NavMesh/NavMeshPath.h"
+#include "GameFramework/PlayerController.h"
+#include "GameFramework/Pawn.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+
+namespace UE::Mass::Navigation
+{
+	FAutoConsoleCommandWithWorldAndArgs BenchmarkCmd(
+		TEXT("etw.nav.Benchmark"),
+		TEXT("Measures path requests in sync, async, cached and flow field modes. Args: [NumRequests=1000] [random|clustered] [SquadSize=1] [Radius=20000]"),
+		FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+		{
+			if (World == nullptr)
+			{
+				return;
+			}
+
+			FETW_MassNavigationBenchmarkParams Params;
+			if (Args.IsValidIndex(0))
+			{
+				Params.NumRequests = FMath::Max(FCString::Atoi(*Args[0]), 1);
+			}
+			if (Args.IsValidIndex(1))
+			{
+				Params.bClustered = Args[1].Equals(TEXT("clustered"), ESearchCase::IgnoreCase);
+			}
+			if (Args.IsValidIndex(2))
+			{
+				Params.SquadSize = FMath::Max(FCString::Atoi(*Args[2]), 1);
+			}
+			if (Args.IsValidIndex(3))
+			{
+				Params.Radius = FMath::Max(FCString::Atof(*Args[3]), 100.f);
+			}
+			FETW_MassNavigationBenchmark::Run(*World, Params);
+		}));
+}
+
+TSharedPtr<FETW_MassNavigationBenchmark> FETW_MassNavigationBenchmark::Active;
+
+void FETW_MassNavigationBenchmark::Run(UWorld& World, const FETW_MassNavigationBenchmarkParams& Params)
+{
+	if (Active.IsValid())
+	{
+		UE_LOG(ETW_Mass, Warning, TEXT("Navigation benchmark is already running"));
+		return;
+	}
+
+	TSharedRef<FETW_MassNavigationBenchmark> Benchmark = MakeShared<FETW_MassNavigationBenchmark>();
+	Benchmark->World = &World;
+	Benchmark->NavigationSystem = FNavigationSystem::GetCurrent<UNavigationSystemV1>(&World);
+	Benchmark->NavigationSubsystem = World.GetSubsystem<UETW_MassNavigationSubsystem>();
+	Benchmark->Params = Params;
+	if (!Benchmark->NavigationSystem.IsValid() || !Benchmark->NavigationSubsystem.IsValid())
+	{
+		UE_LOG(ETW_Mass, Warning, TEXT("Navigation benchmark needs navigation system and mass navigation subsystem"));
+		return;
+	}
+
+	if (!Benchmark->GenerateRequests())
+	{
+		UE_LOG(ETW_Mass, Warning, TEXT("Navigation benchmark: no navigable points in %.0f around player"), Params.Radius);
+		return;
+	}
+
+	UE_LOG(ETW_Mass, Display, TEXT("Navigation benchmark: %d requests, %s, squad size %d, radius %.0f"),
+		Benchmark->Requests.Num(), Params.bClustered ? TEXT("clustered") : TEXT("random"), Params.SquadSize, Params.Radius);
+
+	Active = Benchmark;
+	Benchmark->RunSync();
+	Benchmark->StartStage(EStage::Async);
+	Benchmark->TickerHandle = FTSTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateSP(Benchmark, &FETW_MassNavigationBenchmark::Tick));
+}
+
+bool FETW_MassNavigationBenchmark::GenerateRequests()
+{
+	UNavigationSystemV1* NavSys = NavigationSystem.Get();
+	const APlayerController* PlayerController = World->GetFirstPlayerController();
+	const FVector Origin = PlayerController && PlayerController->GetPawn() ? PlayerController->GetPawn()->GetActorLocation() : FVector::ZeroVector;
+
+	// reachable from origin, so pairs are connected on any navmesh island layout
+	const auto RandomPoint = [NavSys](const FVector& Center, const float Radius, FVector& OutPoint)
+	{
+		FNavLocation NavLocation;
+		if (NavSys->GetRandomReachablePointInRadius(Center, Radius, NavLocation))
+		{
+			OutPoint = NavLocation.Location;
+			return true;
+		}
+		return false;
+	};
+
+	FVector StartCenter = Origin;
+	FVector GoalCenter = Origin;
+	const float ClusterRadius = Params.Radius * 0.05f;
+	if (Params.bClustered && (!RandomPoint(Origin, Params.Radius, StartCenter) || !RandomPoint(Origin, Params.Radius, GoalCenter)))
+	{
+		return false;
+	}
+
+	static constexpr float SquadSpread = 300.f;
+	Requests.Reserve(Params.NumRequests);
+	while (Requests.Num() < Params.NumRequests)
+	{
+		FVector SquadStart;
+		FVector SquadGoal;
+		const bool bFound = Params.bClustered
+			? RandomPoint(StartCenter, ClusterRadius, SquadStart) && RandomPoint(GoalCenter, ClusterRadius, SquadGoal)
+			: RandomPoint(Origin, Params.Radius, SquadStart) && RandomPoint(Origin, Params.Radius, SquadGoal);
+		if (!bFound)
+		{
+			return false;
+		}
+
+		for (int32 MemberIdx = 0; MemberIdx < Params.SquadSize && Requests.Num() < Params.NumRequests; MemberIdx++)
+		{
+			FRequest& Request = Requests.AddDefaulted_GetRef();
+			Request.Goal = SquadGoal;
+			if (MemberIdx == 0 || !RandomPoint(SquadStart, SquadSpread, Request.Start))
+			{
+				Request.Start = SquadStart;
+			}
+		}
+	}
+	return true;
+}
+
+SIZE_T FETW_MassNavigationBenchmark::GetPathAllocatedSize(const FNavigationPath& Path)
+{
+	SIZE_T Size = Path.GetPathPoints().GetAllocatedSize();
+	if (const FNavMeshPath* NavMeshPath = Path.CastPath<FNavMeshPath>())
+	{
+		Size += sizeof(FNavMeshPath) + NavMeshPath->PathCorridor.GetAllocatedSize() + NavMeshPath->PathCorridorCost.GetAllocatedSize();
+	}
+	else
+	{
+		Size += sizeof(FNavigationPath);
+	}
+	return Size;
+}
+
+void FETW_MassNavigationBenchmark::RunSync()
+{
+	QUICK_SCOPE_CYCLE_COUNTER(FETW_MassNavigationBenchmark_RunSync);
+
+	UNavigationSystemV1* NavSys = NavigationSystem.Get();
+	const ANavigationData* NavData = NavSys->GetNavDataForProps(NavAgentProps);
+	if (NavData == nullptr)
+	{
+		return;
+	}
+
+	TArray<double> Latencies;
+	Latencies.Reserve(Requests.Num());
+	SIZE_T Memory = 0;
+	int32 NumPaths = 0;
+
+	const double StartTime = FPlatformTime::Seconds();
+	for (const FRequest& Request : Requests)
+	{
+		const double QueryStartTime = FPlatformTime::Seconds();
+		const FPathFindingQuery Query(nullptr, *NavData, Request.Start, Request.Goal);
+		const FPathFindingResult Result = NavSys->FindPathSync(NavAgentProps, Query);
+		Latencies.Add(FPlatformTime::Seconds() - QueryStartTime);
+
+		if (Result.IsSuccessful())
+		{
+			Memory += GetPathAllocatedSize(*Result.Path);
+			NumPaths++;
+		}
+	}
+
+	Report(TEXT("sync"), Latencies, FPlatformTime::Seconds() - StartTime, Memory, NumPaths);
+}
+
+void FETW_MassNavigationBenchmark::FinishRequest(const int32 RequestIdx, const double Now)
+{
+	if (FinishTimes.IsValidIndex(RequestIdx) && FinishTimes[RequestIdx] == 0.)
+	{
+		FinishTimes[RequestIdx] = Now;
+		NumFinished++;
+	}
+}
+
+void FETW_MassNavigationBenchmark::OnAsyncPathFound(uint32 QueryId, ENavigationQueryResult::Type Result, FNavPathSharedPtr Path, const int32 RequestIdx)
+{
+	if (Stage != EStage::Async || FinishTimes[RequestIdx] > 0.)
+	{
+		return;
+	}
+
+	FinishRequest(RequestIdx, FPlatformTime::Seconds());
+	if (Result == ENavigationQueryResult::Success && Path.IsValid())
+	{
+		StageMemory += GetPathAllocatedSize(*Path);
+		StageNumPaths++;
+	}
+}
+
+void FETW_MassNavigationBenchmark::OnPathsCommitted(TConstArrayView<FMassEntityHandle> ReadyEntities, TConstArrayView<FMassEntityHandle> FailedEntities)
+{
+	// timed at commit, path is usable by the entity from here
+	const double Now = FPlatformTime::Seconds();
+	for (const TConstArrayView<FMassEntityHandle>& CommittedEntities : { ReadyEntities, FailedEntities })
+	{
+		for (const FMassEntityHandle Entity : CommittedEntities)
+		{
+			if (const int32* RequestIdx = EntityRequestIndices.Find(Entity))
+			{
+				FinishRequest(*RequestIdx, Now);
+			}
+		}
+	}
+}
+
+void FETW_MassNavigationBenchmark::OnFlowFieldsReady(TConstArrayView<uint32> ReadyFieldIds)
+{
+	const double Now = FPlatformTime::Seconds();
+	TArray<int32, TInlineAllocator<16>> RequestIndices;
+	for (const uint32 FieldId : ReadyFieldIds)
+	{
+		RequestIndices.Reset();
+		FieldRequestIndices.MultiFind(FieldId, RequestIndices);
+		for (const int32 RequestIdx : RequestIndices)
+		{
+			FinishRequest(RequestIdx, Now);
+		}
+	}
+}
+
+void FETW_MassNavigationBenchmark::StartStage(const EStage NewStage)
+{
+	Stage = NewStage;
+	StageStartTime = FPlatformTime::Seconds();
+	StartTimes.Init(StageStartTime, Requests.Num());
+	FinishTimes.Init(0., Requests.Num());
+	NumFinished = 0;
+	StageMemory = 0;
+	StageNumPaths = 0;
+
+	UNavigationSystemV1* NavSys = NavigationSystem.Get();
+	UETW_MassNavigationSubsystem* NavSubsystem = NavigationSubsystem.Get();
+	if (NavSys == nullptr || NavSubsystem == nullptr)
+	{
+		Stage = EStage::Done;
+		return;
+	}
+
+	switch (Stage)
+	{
+	case EStage::Async:
+	{
+		const ANavigationData* NavData = NavSys->GetNavDataForProps(NavAgentProps);
+		if (NavData == nullptr)
+		{
+			Stage = EStage::Done;
+			return;
+		}
+		for (int32 RequestIdx = 0; RequestIdx < Requests.Num(); RequestIdx++)
+		{
+			const FPathFindingQuery Query(nullptr, *NavData, Requests[RequestIdx].Start, Requests[RequestIdx].Goal);
+			StartTimes[RequestIdx] = FPlatformTime::Seconds();
+			NavSys->FindPathAsync(NavAgentProps, Query, FNavPathQueryDelegate::CreateSP(this, &FETW_MassNavigationBenchmark::OnAsyncPathFound, RequestIdx));
+		}
+		break;
+	}
+	case EStage::Cached:
+	{
+		// temporary entities with just path fragment, subsystem commits paths into them
+		FMassEntityManager& EntityManager = UE::Mass::Utils::GetEntityManagerChecked(*World);
+		const TArray<const UScriptStruct*> Fragments = { FMassPathFragment::StaticStruct() };
+		const FMassArchetypeHandle Archetype = EntityManager.CreateArchetype(Fragments);
+
+		int32 BaselineNumPaths = 0;
+		StageMemory = NavSubsystem->GetPathBufferAllocatedSize(BaselineNumPaths);
+		StageNumPaths = BaselineNumPaths;
+
+		// all requests are dispatched in the first frame like in async mode, otherwise latency is set by dispatch budget
+		if (IConsoleVariable* MaxRequestsCVar = IConsoleManager::Get().FindConsoleVariable(TEXT("etw.nav.MaxPathRequestsPerFrame")))
+		{
+			SavedMaxPathRequestsPerFrame = MaxRequestsCVar->GetInt();
+			MaxRequestsCVar->Set(FMath::Max(SavedMaxPathRequestsPerFrame, Requests.Num()), ECVF_SetByCode);
+		}
+		StageDelegateHandle = NavSubsystem->GetOnPathsCommitted().AddSP(this, &FETW_MassNavigationBenchmark::OnPathsCommitted);
+
+		FMassPathFollowParams PathFollowParams;
+		PathFollowParams.NavAgentProps = NavAgentProps;
+		Entities.Reserve(Requests.Num());
+		EntityRequestIndices.Reserve(Requests.Num());
+		for (int32 RequestIdx = 0; RequestIdx < Requests.Num(); RequestIdx++)
+		{
+			const FMassEntityHandle Entity = EntityManager.CreateEntity(Archetype);
+			Entities.Add(Entity);
+			EntityRequestIndices.Add(Entity, RequestIdx);
+			StartTimes[RequestIdx] = FPlatformTime::Seconds();
+			NavSubsystem->EntityRequestNewPathAsync(Entity, PathFollowParams, Requests[RequestIdx].Start, Requests[RequestIdx].Goal);
+		}
+		break;
+	}
+	case EStage::FlowField:
+	{
+		StageDelegateHandle = NavSubsystem->GetOnFlowFieldsReady().AddSP(this, &FETW_MassNavigationBenchmark::OnFlowFieldsReady);
+
+		// field already built for earlier request to the same area serves the request right away
+		FieldIds.Reserve(Requests.Num());
+		for (int32 RequestIdx = 0; RequestIdx < Requests.Num(); RequestIdx++)
+		{
+			StartTimes[RequestIdx] = FPlatformTime::Seconds();
+			const uint32 FieldId = NavSubsystem->AcquireFlowField(NavAgentProps, Requests[RequestIdx].Goal);
+			FieldIds.Add(FieldId);
+			const FETW_MassFlowField* FlowField = NavSubsystem->FindFlowField(FieldId);
+			if (FlowField == nullptr || FlowField->IsReady())
+			{
+				FinishRequest(RequestIdx, FPlatformTime::Seconds());
+			}
+			else
+			{
+				FieldRequestIndices.Add(FieldId, RequestIdx);
+			}
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+bool FETW_MassNavigationBenchmark::Tick(float DeltaTime)
+{
+	UETW_MassNavigationSubsystem* NavSubsystem = NavigationSubsystem.Get();
+	if (!World.IsValid() || NavSubsystem == nullptr)
+	{
+		UE_LOG(ETW_Mass, Warning, TEXT("Navigation benchmark aborted, world was torn down"));
+		Stage = EStage::Done;
+	}
+
+	// requests are finished by nav system and subsystem callbacks, ticker only moves between stages
+	const double Now = FPlatformTime::Seconds();
+	if (Stage != EStage::Done && (NumFinished == Requests.Num() || Now - StageStartTime > Params.TimeoutSeconds))
+	{
+		FinishStage();
+		StartStage(static_cast<EStage>(static_cast<uint8>(Stage) + 1));
+	}
+
+	if (Stage == EStage::Done)
+	{
+		Cleanup();
+		UE_LOG(ETW_Mass, Display, TEXT("Navigation benchmark finished"));
+		TickerHandle.Reset();
+		Active.Reset();
+		return false;
+	}
+	return true;
+}
+
+void FETW_MassNavigationBenchmark::FinishStage()
+{
+	TArray<double> Latencies;
+	Latencies.Reserve(NumFinished);
+	double LastFinishTime = StageStartTime;
+	for (int32 RequestIdx = 0; RequestIdx < FinishTimes.Num(); RequestIdx++)
+	{
+		if (FinishTimes[RequestIdx] > 0.)
+		{
+			Latencies.Add(FinishTimes[RequestIdx] - StartTimes[RequestIdx]);
+			LastFinishTime = FMath::Max(LastFinishTime, FinishTimes[RequestIdx]);
+		}
+	}
+	if (NumFinished < Requests.Num())
+	{
+		UE_LOG(ETW_Mass, Warning, TEXT("Navigation benchmark: %d requests didn't finish in %.0fs"), Requests.Num() - NumFinished, Params.TimeoutSeconds);
+	}
+
+	UETW_MassNavigationSubsystem* NavSubsystem = NavigationSubsystem.Get();
+	switch (Stage)
+	{
+	case EStage::Async:
+		Report(TEXT("async"), Latencies, LastFinishTime - StageStartTime, StageMemory, StageNumPaths);
+		break;
+	case EStage::Cached:
+	{
+		// paths are pooled, growth of the buffer over baseline is what the requests cost
+		int32 NumPaths = 0;
+		const SIZE_T Memory = NavSubsystem->GetPathBufferAllocatedSize(NumPaths);
+		Report(TEXT("cached"), Latencies, LastFinishTime - StageStartTime, Memory - FMath::Min(Memory, StageMemory), NumPaths - StageNumPaths);
+		break;
+	}
+	case EStage::FlowField:
+	{
+		// fields are shared by requests to the same area, memory is per field
+		TSet<uint32> UniqueFieldIds(FieldIds);
+		SIZE_T Memory = 0;
+		int32 NumFields = 0;
+		for (const uint32 FieldId : UniqueFieldIds)
+		{
+			if (const FETW_MassFlowField* FlowField = NavSubsystem->FindFlowField(FieldId))
+			{
+				Memory += FlowField->GetAllocatedSize();
+				NumFields++;
+			}
+		}
+		Report(TEXT("flow field"), Latencies, LastFinishTime - StageStartTime, Memory, NumFields);
+		break;
+	}
+	default:
+		break;
+	}
+
+	Cleanup();
+}
+
+void FETW_MassNavigationBenchmark::Cleanup()
+{
+	UETW_MassNavigationSubsystem* NavSubsystem = NavigationSubsystem.Get();
+	if (NavSubsystem && StageDelegateHandle.IsValid())
+	{
+		NavSubsystem->GetOnPathsCommitted().Remove(StageDelegateHandle);
+		NavSubsystem->GetOnFlowFieldsReady().Remove(StageDelegateHandle);
+	}
+	StageDelegateHandle.Reset();
+
+	if (SavedMaxPathRequestsPerFrame > 0)
+	{
+		if (IConsoleVariable* MaxRequestsCVar = IConsoleManager::Get().FindConsoleVariable(TEXT("etw.nav.MaxPathRequestsPerFrame")))
+		{
+			MaxRequestsCVar->Set(SavedMaxPathRequestsPerFrame, ECVF_SetByCode);
+		}
+		SavedMaxPathRequestsPerFrame = 0;
+	}
+
+	if (World.IsValid() && NavSubsystem)
+	{
+		// path release observer returns slots of destroyed entities to the pool
+		FMassEntityManager& EntityManager = UE::Mass::Utils::GetEntityManagerChecked(*World);
+		for (const FMassEntityHandle Entity : Entities)
+		{
+			if (EntityManager.IsEntityValid(Entity))
+			{
+				EntityManager.DestroyEntity(Entity);
+			}
+		}
+		for (const uint32 FieldId : FieldIds)
+		{
+			NavSubsystem->ReleaseFlowField(FieldId);
+		}
+	}
+	Entities.Reset();
+	FieldIds.Reset();
+	EntityRequestIndices.Reset();
+	FieldRequestIndices.Reset();
+}
+
+void FETW_MassNavigationBenchmark::Report(const TCHAR* Mode, TArray<double>& LatenciesSeconds, const double TotalSeconds, const SIZE_T Memory, const int32 NumPaths) const
+{
+	if (LatenciesSeconds.IsEmpty())
+	{
+		UE_LOG(ETW_Mass, Display, TEXT("  %-10s no finished requests"), Mode);
+		return;
+	}
+
+	LatenciesSeconds.Sort();
+	const double P50 = LatenciesSeconds[LatenciesSeconds.Num() / 2];
+	const double P99 = LatenciesSeconds[FMath::Min(FMath::FloorToInt(LatenciesSeconds.Num() * 0.99), LatenciesSeconds.Num() - 1)];
+	const double RequestsPerSecond = TotalSeconds > 0. ? LatenciesSeconds.Num() / TotalSeconds : 0.;
+	const double KBPerPath = NumPaths > 0 ? Memory / 1024. / NumPaths : 0.;
+
+	UE_LOG(ETW_Mass, Display, TEXT("  %-10s p50 %.3fms p99 %.3fms, %.0f requests/s, %d paths %.2fKB each"),
+		Mode, P50 * 1000., P99 * 1000., RequestsPerSecond, NumPaths, KBPerPath);
+}
@@ -0,0 +1,102 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "MassEntityTypes.h"
+#include "Containers/Ticker.h"
+#include "AI/Navigation/NavigationTypes.h"
+
+class UWorld;
+class UNavigationSystemV1;
+class UETW_MassNavigationSubsystem;
+
+struct FETW_MassNavigationBenchmarkParams
+{
+	int32 NumRequests = 1000;
+
+	// starts and goals are picked around two points instead of whole radius, mostly shared start and goal polys
+	bool bClustered = false;
+
+	// requests of one squad start next to each other and share the goal
+	int32 SquadSize = 1;
+
+	float Radius = 20000.f;
+
+	// unfinished requests of a mode are reported as lost after this
+	double TimeoutSeconds = 60.;
+};
+
+/**
+ * Navigation stress test of running world, started by etw.nav.Benchmark console command.
+ * Same start and goal pairs are run by every mode one after another: sync nav system query, async nav system query,
+ * subsystem async request with path cache on temporary entities and flow field acquire. Each mode logs p50/p99 latency,
+ * requests per second and memory per path. Latency of a request ends when its path is usable: query returns, nav system
+ * calls back, subsystem commits the path to the entity or builds the field. Subsystem dispatch budget is lifted for the
+ * cached mode, so all modes start all their requests at once. Async modes span several frames.
+ */
+class ENTITYTOTALWAR_API FETW_MassNavigationBenchmark : public TSharedFromThis<FETW_MassNavigationBenchmark>
+{
+public:
+	static void Run(UWorld& World, const FETW_MassNavigationBenchmarkParams& Params);
+
+private:
+	enum class EStage : uint8
+	{
+		Async,
+		Cached,
+		FlowField,
+		Done,
+	};
+
+	struct FRequest
+	{
+		FVector Start = FVector::ZeroVector;
+		FVector Goal = FVector::ZeroVector;
+	};
+
+	bool GenerateRequests();
+	void RunSync();
+	void OnAsyncPathFound(uint32 QueryId, ENavigationQueryResult::Type Result, FNavPathSharedPtr Path, const int32 RequestIdx);
+	void OnPathsCommitted(TConstArrayView<FMassEntityHandle> ReadyEntities, TConstArrayView<FMassEntityHandle> FailedEntities);
+	void OnFlowFieldsReady(TConstArrayView<uint32> ReadyFieldIds);
+	void FinishRequest(const int32 RequestIdx, const double Now);
+	void StartStage(const EStage NewStage);
+	bool Tick(float DeltaTime);
+	void FinishStage();
+	void Cleanup();
+
+	void Report(const TCHAR* Mode, TArray<double>& LatenciesSeconds, const double TotalSeconds, const SIZE_T Memory, const int32 NumPaths) const;
+
+	static SIZE_T GetPathAllocatedSize(const FNavigationPath& Path);
+
+	static TSharedPtr<FETW_MassNavigationBenchmark> Active;
+
+	TWeakObjectPtr<UWorld> World;
+	TWeakObjectPtr<UNavigationSystemV1> NavigationSystem;
+	TWeakObjectPtr<UETW_MassNavigationSubsystem> NavigationSubsystem;
+	FETW_MassNavigationBenchmarkParams Params;
+	FNavAgentProperties NavAgentProps = FNavAgentProperties::DefaultProperties;
+
+	TArray<FRequest> Requests;
+
+	EStage Stage = EStage::Done;
+	FTSTicker::FDelegateHandle TickerHandle;
+	double StageStartTime = 0.;
+
+	// per request of current stage, finish time stays 0 until request is done
+	TArray<double> StartTimes;
+	TArray<double> FinishTimes;
+	int32 NumFinished = 0;
+	SIZE_T StageMemory = 0;
+	int32 StageNumPaths = 0;
+
+	TArray<FMassEntityHandle> Entities;
+	TArray<uint32> FieldIds;
+
+	// requests of current stage finished by subsystem callbacks
+	TMap<FMassEntityHandle, int32> EntityRequestIndices;
+	TMultiMap<uint32, int32> FieldRequestIndices;
+	FDelegateHandle StageDelegateHandle;
+	int32 SavedMaxPathRequestsPerFrame = 0;
+};
@@ -3,74 +3,850 @@
 
 #include "ETW_MassNavigationSubsystem.h"
 
-#include "MassCommandBuffer.h"
 #include "MassCommands.h"
 #include "NavigationSystem.h"
+#include "NavMesh/NavMeshPath.h"
 #include "MassSignalSubsystem.h"
 #include "MassSimulationSubsystem.h"
+#include "MassCommonFragments.h"
+#include "Async/ParallelFor.h"
+#include "ETW_MassTypes.h"
+#include "ETW_MassNavClusterGraph.h"
+#include "EngineUtils.h"
+#include "VisualLogger/VisualLogger.h"
+#if WITH_RECAST
+#include "NavMesh/RecastNavMesh.h"
+#include "Detour/DetourNavMesh.h"
+#endif
 
-void UETW_MassNavigationSubsystem::EntityRequestNewPath(const FMassEntityHandle Entity, const FMassPathFollowParams& PathFollowParams, const FVector& MoveFrom, const FVector& MoveTo, FMassPathFragment& OutPathFragment)
+void UE::Mass::Navigation::GetTileRefs(const ANavigationData& NavData, TConstArrayView<NavNodeRef> Polys, TArray<NavNodeRef>& OutTileRefs)
 {
-	ensure(NavigationSystem);
+	OutTileRefs.Reset();
+#if WITH_RECAST
+	const ARecastNavMesh* RecastNavMesh = Cast<const ARecastNavMesh>(&NavData);
+	const dtNavMesh* DetourMesh = RecastNavMesh ? RecastNavMesh->GetRecastMesh() : nullptr;
+	if (DetourMesh == nullptr)
+	{
+		return;
+	}
 
-	// create finding query
-	const FNavAgentProperties& NavAgentProps = PathFollowParams.NavAgentProps;
-	const ANavigationData* NavData = NavigationSystem->GetNavDataForProps(NavAgentProps);
-	FPathFindingQuery Query = FPathFindingQuery(this, *NavData, MoveFrom, MoveTo);
-	Query.SetAllowPartialPaths(PathFollowParams.bAllowPartialPath);
-				
-	// request path from nav system:
-	const FPathFindingResult PathResult = NavigationSystem->FindPathSync(NavAgentProps, Query, EPathFindingMode::Hierarchical);  // todo: async
-	if (PathResult.Result != ENavigationQueryResult::Error)
+	TSet<uint32, DefaultKeyFuncs<uint32>, TInlineSetAllocator<32>> Tiles;
+	for (const NavNodeRef Poly : Polys)
 	{
-		EntityNavigationPathMap.Emplace(Entity, *PathResult.Path.Get());
-		OutPathFragment.NextPathVertIdx = 0;
+		bool bIsAlreadyInSet = false;
+		if (Poly != INVALID_NAVNODEREF)
+		{
+			Tiles.Add(DetourMesh->decodePolyIdTile(Poly), &bIsAlreadyInSet);
+			if (!bIsAlreadyInSet)
+			{
+				OutTileRefs.Add(Poly);
+			}
+		}
 	}
-	else
+#endif
+}
+
+bool UE::Mass::Navigation::AreTileRefsValid(const ANavigationData& NavData, TConstArrayView<NavNodeRef> TileRefs)
+{
+#if WITH_RECAST
+	const ARecastNavMesh* RecastNavMesh = Cast<const ARecastNavMesh>(&NavData);
+	const dtNavMesh* DetourMesh = RecastNavMesh ? RecastNavMesh->GetRecastMesh() : nullptr;
+	if (DetourMesh == nullptr)
 	{
-		// todo
+		return TileRefs.IsEmpty();
 	}
+
+	for (const NavNodeRef TileRef : TileRefs)
+	{
+		if (!DetourMesh->isValidPolyRef(TileRef))
+		{
+			return false;
+		}
+	}
+#endif
+	return true;
 }
 
-void UETW_MassNavigationSubsystem::EntityRequestNewPathDeferred(FMassExecutionContext& Context,
-	const FMassEntityHandle Entity, const FMassPathFollowParams& PathFollowParams, const FVector& MoveFrom,
-	const FVector& MoveTo, FMassPathFragment& OutPathFragment)
+bool UETW_MassNavigationSubsystem::ExtractNextPathPoint(FMassPathFragment& OutPathFragment) const
 {
-	Context.Defer().PushCommand<FMassDeferredSetCommand>([&](const FMassEntityManager& Manager){
-		UETW_MassNavigationSubsystem* NavSubsystem = UWorld::GetSubsystem<UETW_MassNavigationSubsystem>(Manager.GetWorld());
-		NavSubsystem->EntityRequestNewPath(Entity, PathFollowParams, MoveFrom, MoveTo, OutPathFragment);
-	});
+	const FETW_MassPathBufferSlot* PathSlot = GetPathSlot(OutPathFragment.PathHandle);
+	if (PathSlot && PathSlot->Points.IsValidIndex(OutPathFragment.NextPathVertIdx))
+	{
+		OutPathFragment.PathPoint = PathSlot->Points[OutPathFragment.NextPathVertIdx++];
+		return true;
+	}
+	return false;
+}
+
+TArray<FVector>& UETW_MassNavigationSubsystem::AllocatePath(FMassPathFragment& PathFragment)
+{
+	FreePath(PathFragment);
+
+	const int32 SlotIndex = FreePathSlots.IsEmpty() ? PathSlots.AddDefaulted() : FreePathSlots.Pop(false);
+	FETW_MassPathBufferSlot& PathSlot = PathSlots[SlotIndex];
+	PathFragment.PathHandle.Index = SlotIndex;
+	PathFragment.PathHandle.Serial = PathSlot.Serial;
+	PathFragment.NextPathVertIdx = 0;
+	PathFragment.NextPortalIdx = 0;
+	return PathSlot.Points;
+}
+
+void UETW_MassNavigationSubsystem::FreePath(FMassPathFragment& PathFragment)
+{
+	if (GetPathSlot(PathFragment.PathHandle))
+	{
+		// serial bump invalidates handles still pointing to the slot
+		FETW_MassPathBufferSlot& PathSlot = PathSlots[PathFragment.PathHandle.Index];
+		PathSlot.Points.Reset();
+		PathSlot.Portals.Reset();
+		PathSlot.TileRefs.Reset();
+		PathSlot.NavData.Reset();
+		PathSlot.Serial++;
+		FreePathSlots.Add(PathFragment.PathHandle.Index);
+	}
+	PathFragment.PathHandle = FETW_MassPathHandle();
+	PathFragment.NextPathVertIdx = 0;
+	PathFragment.NextPortalIdx = 0;
+}
+
+namespace UE::Mass::Navigation
+{
+	int32 MaxPathRequestsPerFrame = 32;
+	FAutoConsoleVariableRef CVarMaxPathRequestsPerFrame(TEXT("etw.nav.MaxPathRequestsPerFrame"), MaxPathRequestsPerFrame, TEXT("Max async path queries dispatched to navigation system per frame"), ECVF_Default);
+
+	float PathCacheLifetime = 2.f;
+	FAutoConsoleVariableRef CVarPathCacheLifetime(TEXT("etw.nav.PathCacheLifetime"), PathCacheLifetime, TEXT("Seconds computed path is reused for requests from the same start to the same goal navmesh polygon, 0 disables cache"), ECVF_Default);
+
+	int32 PathValidationsPerFrame = 4096;
+	FAutoConsoleVariableRef CVarPathValidationsPerFrame(TEXT("etw.nav.PathValidationsPerFrame"), PathValidationsPerFrame, TEXT("Paths checked per frame for rebuilt navmesh tiles along their corridor"), ECVF_Default);
+
+	float HierarchicalRefineDistance = 10000.f;
+	FAutoConsoleVariableRef CVarHierarchicalRefineDistance(TEXT("etw.nav.HierarchicalRefineDistance"), HierarchicalRefineDistance, TEXT("Longer requests are planned on cluster graph and refined on navmesh up to graph waypoint this far ahead, 0 disables"), ECVF_Default);
+
+	float FlowFieldCellSize = 200.f;
+	FAutoConsoleVariableRef CVarFlowFieldCellSize(TEXT("etw.nav.FlowFieldCellSize"), FlowFieldCellSize, TEXT("Flow field cell size, orders closer than a cell share one field"), ECVF_Default);
+
+	float FlowFieldHalfExtent = 10000.f;
+	FAutoConsoleVariableRef CVarFlowFieldHalfExtent(TEXT("etw.nav.FlowFieldHalfExtent"), FlowFieldHalfExtent, TEXT("Flow field covers square of this half extent around destination"), ECVF_Default);
+
+	float FlowFieldVerticalExtent = 500.f;
+	FAutoConsoleVariableRef CVarFlowFieldVerticalExtent(TEXT("etw.nav.FlowFieldVerticalExtent"), FlowFieldVerticalExtent, TEXT("Vertical extent of flow field cell projection to navmesh"), ECVF_Default);
+
+	int32 FlowFieldCellsPerFrame = 16384;
+	FAutoConsoleVariableRef CVarFlowFieldCellsPerFrame(TEXT("etw.nav.FlowFieldCellsPerFrame"), FlowFieldCellsPerFrame, TEXT("Flow field cells projected, linked or integrated per frame over all fields"), ECVF_Default);
+
+	float FlowFieldLifetime = 10.f;
+	FAutoConsoleVariableRef CVarFlowFieldLifetime(TEXT("etw.nav.FlowFieldLifetime"), FlowFieldLifetime, TEXT("Seconds unused flow field is kept for next orders to the same area"), ECVF_Default);
+
+	int32 ProjectionBatchSize = 32;
+	FAutoConsoleVariableRef CVarProjectionBatchSize(TEXT("etw.nav.ProjectionBatchSize"), ProjectionBatchSize, TEXT("Points projected to navmesh per worker task, smaller batches run on calling thread"), ECVF_Default);
+}
+
+bool UETW_MassNavigationSubsystem::ProjectPointsToNavigation(const FNavAgentProperties& NavAgentProps, TArrayView<FVector> InOutPoints, TArray<bool>& OutProjected, const FVector& Extent) const
+{
+	QUICK_SCOPE_CYCLE_COUNTER(UETW_MassNavigationSubsystem_ProjectPointsToNavigation);
+
+	OutProjected.Init(false, InOutPoints.Num());
+
+	// nav data is registered on game thread outside of processing, lookup and projection are read only
+	const ANavigationData* NavData = NavigationSystem ? NavigationSystem->GetNavDataForProps(NavAgentProps) : nullptr;
+	if (NavData == nullptr)
+	{
+		return false;
+	}
+
+	const FVector QueryExtent = Extent.IsZero() ? NavData->GetDefaultQueryExtent() : Extent;
+	const int32 BatchSize = FMath::Max(UE::Mass::Navigation::ProjectionBatchSize, 1);
+	const int32 NumBatches = FMath::DivideAndRoundUp(InOutPoints.Num(), BatchSize);
+
+	// each batch writes own points only
+	ParallelFor(NumBatches, [NavData, &QueryExtent, BatchSize, InOutPoints, &OutProjected](const int32 BatchIdx)
+	{
+		const int32 BatchEnd = FMath::Min((BatchIdx + 1) * BatchSize, InOutPoints.Num());
+		for (int32 PointIdx = BatchIdx * BatchSize; PointIdx < BatchEnd; PointIdx++)
+		{
+			FNavLocation NavLocation;
+			if (NavData->ProjectPoint(InOutPoints[PointIdx], NavLocation, QueryExtent))
+			{
+				InOutPoints[PointIdx] = NavLocation.Location;
+				OutProjected[PointIdx] = true;
+			}
+		}
+	}, NumBatches > 1 ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
+
+	return true;
+}
+
+void UETW_MassNavigationSubsystem::EntityRequestNewPathAsync(const FMassEntityHandle Entity, const FMassPathFollowParams& PathFollowParams, const FVector& MoveFrom, const FVector& MoveTo)
+{
+	FETW_MassPathRequest Request;
+	Request.Entity = Entity;
+	Request.NavAgentProps = PathFollowParams.NavAgentProps;
+	Request.bAllowPartialPath = PathFollowParams.bAllowPartialPath;
+	Request.bSteerAlongCorridor = PathFollowParams.bSteerAlongCorridor;
+	Request.SmoothingSegments = PathFollowParams.SmoothingSegments;
+	Request.MoveFrom = MoveFrom;
+	Request.MoveTo = MoveTo;
+	QueuePathRequest(Request);
+}
+
+void UETW_MassNavigationSubsystem::QueuePathRequest(const FETW_MassPathRequest& Request)
+{
+	FScopeLock Lock(&PathRequestsCS);
+
+	const uint32 Serial = ++NextPathRequestSerial;
+	LatestPathRequestSerials.Add(Request.Entity, Serial);
+
+	// still queued request of the entity is just updated, no point to query stale target
+	const FMassEntityHandle Entity = Request.Entity;
+	FETW_MassPathRequest* Queued = QueuedPathRequests.FindByPredicate([Entity](const FETW_MassPathRequest& Other) { return Other.Entity == Entity; });
+	if (Queued == nullptr)
+	{
+		Queued = &QueuedPathRequests.AddDefaulted_GetRef();
+	}
+	*Queued = Request;
+	Queued->Serial = Serial;
+}
+
+bool UETW_MassNavigationSubsystem::IsPathRequestPending(const FMassEntityHandle Entity) const
+{
+	FScopeLock Lock(&PathRequestsCS);
+	return LatestPathRequestSerials.Contains(Entity);
+}
+
+void UETW_MassNavigationSubsystem::ProcessPathRequests(FMassEntityManager& EntityManager)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(UETW_MassNavigationSubsystem_ProcessPathRequests);
+
+	ReplanInvalidatedPaths(EntityManager);
+
+	TArray<FETW_MassPathQueryResult> QueryResults;
+	TArray<FETW_MassPathRequest> Requests;
+	{
+		FScopeLock Lock(&PathRequestsCS);
+		QueryResults = MoveTemp(FinishedPathQueries);
+		Requests = MoveTemp(QueuedPathRequests);
+	}
+
+	const double Now = GetWorld()->GetTimeSeconds();
+	const double CacheLifetime = UE::Mass::Navigation::PathCacheLifetime;
+	for (TMap<FETW_MassPathCacheKey, FETW_MassCachedPath>::TIterator It = PathCache.CreateIterator(); It; ++It)
+	{
+		const FNavPathSharedPtr& CachedPath = It.Value().Path;
+		const ANavigationData* NavData = CachedPath->GetNavigationDataUsed();
+		const FNavMeshPath* NavMeshPath = CachedPath->CastPath<FNavMeshPath>();
+		const bool bCorridorRebuilt = NavData == nullptr || (NavMeshPath && !UE::Mass::Navigation::AreTileRefsValid(*NavData, NavMeshPath->PathCorridor));
+		if (Now - It.Value().Time > CacheLifetime || bCorridorRebuilt)
+		{
+			It.RemoveCurrent();
+		}
+	}
+
+	// waiters of finished queries, requests served from cache or joined to in flight query
+	TArray<TPair<FETW_MassPathRequest, FNavPathSharedPtr>> Ready;
+	for (FETW_MassPathQueryResult& QueryResult : QueryResults)
+	{
+		TArray<FETW_MassPathRequest> Waiters;
+		InFlightPathQueries.RemoveAndCopyValue(QueryResult.Key, Waiters);
+		const FNavPathSharedPtr Path = QueryResult.bSuccess ? QueryResult.Path : nullptr;
+
+		// unique keys of unshareable requests are never looked up again
+		if (Path.IsValid() && CacheLifetime > 0. && QueryResult.Key.StartPoly != INVALID_NAVNODEREF)
+		{
+			PathCache.Add(QueryResult.Key, { Path, Now });
+		}
+		for (const FETW_MassPathRequest& Waiter : Waiters)
+		{
+			Ready.Emplace(Waiter, Path);
+		}
+	}
+
+	// group requests by start and goal polygons, only first request of a group costs a query
+	TArray<FETW_MassPathCacheKey> NewQueries;
+	TArray<FETW_MassPathRequest> NewQueryRequests;
+	int32 NumProcessed = 0;
+	for (; NumProcessed < Requests.Num(); NumProcessed++)
+	{
+		FETW_MassPathRequest& Request = Requests[NumProcessed];
+		const ANavigationData* NavData = NavigationSystem ? NavigationSystem->GetNavDataForProps(Request.NavAgentProps) : nullptr;
+		if (NavData == nullptr)
+		{
+			Ready.Emplace(Request, nullptr);
+			continue;
+		}
+
+		PlanPathSegment(Request);
+		const FVector& QueryGoal = Request.bSegment ? Request.SegmentGoal : Request.MoveTo;
+
+		FNavLocation StartLocation;
+		FNavLocation GoalLocation;
+		FETW_MassPathCacheKey Key;
+		Key.NavData = reinterpret_cast<UPTRINT>(NavData);
+		Key.StartPoly = NavData->ProjectPoint(Request.MoveFrom, StartLocation, NavData->GetDefaultQueryExtent()) ? StartLocation.NodeRef : INVALID_NAVNODEREF;
+		Key.GoalPoly = NavData->ProjectPoint(QueryGoal, GoalLocation, NavData->GetDefaultQueryExtent()) ? GoalLocation.NodeRef : INVALID_NAVNODEREF;
+		Key.bAllowPartialPath = Request.bAllowPartialPath;
+
+		// off navmesh ends can't be shared, each such request gets own query
+		const bool bShareable = !Request.bOwnQuery && Key.StartPoly != INVALID_NAVNODEREF && Key.GoalPoly != INVALID_NAVNODEREF;
+		if (bShareable)
+		{
+			if (const FETW_MassCachedPath* CachedPath = PathCache.Find(Key))
+			{
+				Ready.Emplace(Request, CachedPath->Path);
+				continue;
+			}
+			if (TArray<FETW_MassPathRequest>* Waiters = InFlightPathQueries.Find(Key))
+			{
+				Waiters->Add(Request);
+				continue;
+			}
+		}
+
+		if (NewQueries.Num() >= FMath::Max(UE::Mass::Navigation::MaxPathRequestsPerFrame, 1))
+		{
+			break;
+		}
+
+		if (!bShareable)
+		{
+			// unique key per request
+			Key.StartPoly = INVALID_NAVNODEREF;
+			Key.GoalPoly = static_cast<NavNodeRef>(Request.Serial);
+		}
+		InFlightPathQueries.Add(Key).Add(Request);
+		NewQueries.Add(Key);
+		NewQueryRequests.Add(Request);
+	}
+
+	// over budget requests wait for next frame, ahead of requests queued meanwhile
+	if (NumProcessed < Requests.Num())
+	{
+		FScopeLock Lock(&PathRequestsCS);
+		QueuedPathRequests.Insert(Requests.GetData() + NumProcessed, Requests.Num() - NumProcessed, 0);
+	}
+
+	// commit, paths become visible to processors only here
+	TArray<FMassEntityHandle> ReadyEntities;
+	TArray<FMassEntityHandle> FailedEntities;
+	for (const TPair<FETW_MassPathRequest, FNavPathSharedPtr>& ReadyPair : Ready)
+	{
+		CommitEntityPath(EntityManager, ReadyPair.Key, ReadyPair.Value, ReadyEntities, FailedEntities);
+	}
+
+	if (!ReadyEntities.IsEmpty() || !FailedEntities.IsEmpty())
+	{
+		OnPathsCommitted.Broadcast(ReadyEntities, FailedEntities);
+	}
+
+	if (SignalSubsystem)
+	{
+		if (!ReadyEntities.IsEmpty())
+		{
+			SignalSubsystem->SignalEntities(UE::Mass::Signals::RequestNewPath, ReadyEntities);
+		}
+		if (!FailedEntities.IsEmpty())
+		{
+			SignalSubsystem->SignalEntities(UE::Mass::Signals::ReachedPathEnd, FailedEntities);
+		}
+	}
+
+	// dispatch, query runs on nav system worker, its delegate is called back on game thread
+	for (int32 QueryIdx = 0; QueryIdx < NewQueries.Num(); QueryIdx++)
+	{
+		const FETW_MassPathRequest& Request = NewQueryRequests[QueryIdx];
+		const ANavigationData* NavData = NavigationSystem->GetNavDataForProps(Request.NavAgentProps);
+
+		FPathFindingQuery Query(this, *NavData, Request.MoveFrom, Request.bSegment ? Request.SegmentGoal : Request.MoveTo);
+		Query.SetAllowPartialPaths(Request.bAllowPartialPath);
+		NavigationSystem->FindPathAsync(Request.NavAgentProps, Query,
+			FNavPathQueryDelegate::CreateUObject(this, &UETW_MassNavigationSubsystem::OnPathQueryFinished, NewQueries[QueryIdx]),
+			EPathFindingMode::Hierarchical);
+	}
+}
+
+namespace UE::Mass::Navigation::Corridor
+{
+	// > 0 when B is to the right of A in top view
+	FORCEINLINE float Cross2D(const FVector& A, const FVector& B)
+	{
+		return A.X * B.Y - A.Y * B.X;
+	}
+
+	// uniform Catmull-Rom, ends are duplicated so spline passes through all path points
+	void SmoothPath(TArray<FVector>& Points, const int32 Segments)
+	{
+		if (Points.Num() < 3 || Segments < 2)
+		{
+			return;
+		}
+
+		TArray<FVector> Smoothed;
+		Smoothed.Reserve((Points.Num() - 1) * Segments + 1);
+		for (int32 PointIdx = 0; PointIdx < Points.Num() - 1; PointIdx++)
+		{
+			const FVector& P0 = Points[FMath::Max(PointIdx - 1, 0)];
+			const FVector& P1 = Points[PointIdx];
+			const FVector& P2 = Points[PointIdx + 1];
+			const FVector& P3 = Points[FMath::Min(PointIdx + 2, Points.Num() - 1)];
+
+			Smoothed.Add(P1);
+			for (int32 SegmentIdx = 1; SegmentIdx < Segments; SegmentIdx++)
+			{
+				const float T = static_cast<float>(SegmentIdx) / Segments;
+				const float T2 = T * T;
+				const float T3 = T2 * T;
+				Smoothed.Add(0.5f * (2.f * P1 + (P2 - P0) * T + (2.f * P0 - 5.f * P1 + 4.f * P2 - P3) * T2 + (3.f * P1 - P0 - 3.f * P2 + P3) * T3));
+			}
+		}
+		Smoothed.Add(Points.Last());
+		Points = MoveTemp(Smoothed);
+	}
+
+	// portals are oriented so right end is on the right side of travel direction
+	void BuildPortals(const FNavMeshPath& NavMeshPath, const FVector& MoveFrom, TArray<FETW_MassPathPortal>& OutPortals)
+	{
+		const TArray<FNavigationPortalEdge>& Edges = NavMeshPath.GetPathCorridorEdges();
+		OutPortals.Reserve(Edges.Num());
+
+		FVector PrevMiddle = MoveFrom;
+		for (const FNavigationPortalEdge& Edge : Edges)
+		{
+			FETW_MassPathPortal& Portal = OutPortals.Add_GetRef({ Edge.Left, Edge.Right });
+			const FVector Middle = (Portal.Left + Portal.Right) * 0.5f;
+			if (Cross2D(Middle - PrevMiddle, Portal.Right - Portal.Left) < 0.f)
+			{
+				Swap(Portal.Left, Portal.Right);
+			}
+			PrevMiddle = Middle;
+		}
+	}
 }
 
-bool UETW_MassNavigationSubsystem::EntityExtractNextPathPoint(const FMassEntityHandle Entity, FMassPathFragment& OutPathFragment)
+bool UETW_MassNavigationSubsystem::UpdateCorridorPathPoint(const FVector& Location, FMassPathFragment& PathFragment) const
 {
-	bool bSuccess = false;
+	using namespace UE::Mass::Navigation::Corridor;
+
+	const FETW_MassPathBufferSlot* PathSlot = GetPathSlot(PathFragment.PathHandle);
+	if (PathSlot == nullptr || PathSlot->Portals.IsEmpty())
+	{
+		return false;
+	}
+
+	const TArray<FETW_MassPathPortal>& Portals = PathSlot->Portals;
+	const FVector& Goal = PathSlot->Points.Last();
 
-	if (const FNavigationPath* const NavPath = EntityNavigationPathMap.Find(Entity))
+	// skip portals already behind the entity
+	while (PathFragment.NextPortalIdx < Portals.Num())
 	{
-		const TArray<FNavPathPoint>& PathPoints = NavPath->GetPathPoints();
-		if (PathPoints.IsValidIndex(OutPathFragment.NextPathVertIdx))
+		const FETW_MassPathPortal& Portal = Portals[PathFragment.NextPortalIdx];
+		if (Cross2D(Portal.Right - Portal.Left, Location - Portal.Left) >= 0.f)
 		{
-			OutPathFragment.PathPoint = PathPoints[OutPathFragment.NextPathVertIdx++].Location;
-			bSuccess = true;
+			break;
 		}
+		PathFragment.NextPortalIdx++;
 	}
 
-	if (!bSuccess)
+	// simple stupid funnel from entity location, first corner where funnel collapses is the farthest visible point
+	FVector Left = Location;
+	FVector Right = Location;
+	for (int32 PortalIdx = PathFragment.NextPortalIdx; PortalIdx <= Portals.Num(); PortalIdx++)
 	{
-		// todo
+		// goal closes the funnel as degenerated portal
+		const FVector& PortalLeft = PortalIdx < Portals.Num() ? Portals[PortalIdx].Left : Goal;
+		const FVector& PortalRight = PortalIdx < Portals.Num() ? Portals[PortalIdx].Right : Goal;
+
+		// tighten right side, corner at left side when it crosses over
+		if (Cross2D(Right - Location, PortalRight - Location) <= 0.f)
+		{
+			if (Right.Equals(Location) || Cross2D(Left - Location, PortalRight - Location) >= 0.f)
+			{
+				Right = PortalRight;
+			}
+			else
+			{
+				PathFragment.PathPoint = Left;
+				PathFragment.NextPathVertIdx = PathSlot->Points.Num() - 1;
+				return true;
+			}
+		}
+
+		// tighten left side, corner at right side when it crosses over
+		if (Cross2D(Left - Location, PortalLeft - Location) >= 0.f)
+		{
+			if (Left.Equals(Location) || Cross2D(Right - Location, PortalLeft - Location) <= 0.f)
+			{
+				Left = PortalLeft;
+			}
+			else
+			{
+				PathFragment.PathPoint = Right;
+				PathFragment.NextPathVertIdx = PathSlot->Points.Num() - 1;
+				return true;
+			}
+		}
 	}
 
-	return bSuccess;
+	// goal is visible
+	PathFragment.PathPoint = Goal;
+	PathFragment.NextPathVertIdx = PathSlot->Points.Num();
+	return true;
 }
 
-void UETW_MassNavigationSubsystem::EntityExtractNextPathPointDeferred(FMassExecutionContext& Context,
-	const FMassEntityHandle Entity, FMassPathFragment& OutPathFragment)
+void UETW_MassNavigationSubsystem::PlanPathSegment(FETW_MassPathRequest& Request) const
 {
-	Context.Defer().PushCommand<FMassDeferredSetCommand>([&](const FMassEntityManager& Manager){
-		UETW_MassNavigationSubsystem* NavSubsystem = UWorld::GetSubsystem<UETW_MassNavigationSubsystem>(Manager.GetWorld());
-		NavSubsystem->EntityExtractNextPathPoint(Entity, OutPathFragment);
+	Request.bSegment = false;
+
+	// graph edge costs hold only for agent it was built for
+	const float RefineDistance = UE::Mass::Navigation::HierarchicalRefineDistance;
+	if (Request.bNoHierarchy || ClusterGraph == nullptr || !ClusterGraph->IsBuilt() || !Request.NavAgentProps.IsEquivalent(ClusterGraph->NavAgentProps)
+		|| RefineDistance <= 0.f || FVector::DistSquared2D(Request.MoveFrom, Request.MoveTo) <= FMath::Square(RefineDistance))
+	{
+		return;
+	}
+
+	// first graph waypoint past refine distance ends the segment, rest of the graph path is planned again from there
+	TArray<FVector> Waypoints;
+	if (ClusterGraph->FindAbstractPath(Request.MoveFrom, Request.MoveTo, Waypoints))
+	{
+		for (const FVector& Waypoint : Waypoints)
+		{
+			if (FVector::DistSquared2D(Request.MoveFrom, Waypoint) >= FMath::Square(RefineDistance))
+			{
+				Request.bSegment = true;
+				Request.SegmentGoal = Waypoint;
+				return;
+			}
+		}
+	}
+}
+
+bool UETW_MassNavigationSubsystem::RequestPathContinuation(const FMassEntityHandle Entity, const FMassPathFragment& PathFragment)
+{
+	const FETW_MassPathBufferSlot* PathSlot = GetPathSlot(PathFragment.PathHandle);
+	if (PathSlot == nullptr || !PathSlot->Request.bSegment || IsPathRequestPending(Entity))
+	{
+		return false;
+	}
+
+	// next segment starts where current one ends, so it's joined seamlessly when committed before entity gets there
+	FETW_MassPathRequest Request = PathSlot->Request;
+	Request.MoveFrom = PathSlot->Points.Last();
+	Request.bOwnQuery = false;
+	QueuePathRequest(Request);
+	return true;
+}
+
+void UETW_MassNavigationSubsystem::ReplanInvalidatedPaths(FMassEntityManager& EntityManager)
+{
+	QUICK_SCOPE_CYCLE_COUNTER(UETW_MassNavigationSubsystem_ReplanInvalidatedPaths);
+
+	const int32 NumSlots = FMath::Min(PathSlots.Num(), FMath::Max(UE::Mass::Navigation::PathValidationsPerFrame, 1));
+	if (NumSlots == 0)
+	{
+		return;
+	}
+
+	// round robin window, tile rebuilds are noticed within PathSlots / PathValidationsPerFrame frames
+	const int32 FirstSlot = NextPathValidationSlot % PathSlots.Num();
+	NextPathValidationSlot = (FirstSlot + NumSlots) % PathSlots.Num();
+
+	// tiles are attached on game thread, which waits here, so navmesh is safe to read from workers
+	TArray<uint8> Invalidated;
+	Invalidated.SetNumZeroed(NumSlots);
+	ParallelFor(NumSlots, [this, FirstSlot, &Invalidated](const int32 WindowIdx)
+	{
+		const FETW_MassPathBufferSlot& PathSlot = PathSlots[(FirstSlot + WindowIdx) % PathSlots.Num()];
+		if (!PathSlot.TileRefs.IsEmpty())
+		{
+			const ANavigationData* NavData = PathSlot.NavData.Get();
+			Invalidated[WindowIdx] = NavData == nullptr || !UE::Mass::Navigation::AreTileRefsValid(*NavData, PathSlot.TileRefs);
+		}
 	});
+
+	int32 NumReplanned = 0;
+	for (int32 WindowIdx = 0; WindowIdx < NumSlots; WindowIdx++)
+	{
+		if (!Invalidated[WindowIdx])
+		{
+			continue;
+		}
+
+		// entity keeps following old path until the new one is committed
+		FETW_MassPathBufferSlot& PathSlot = PathSlots[(FirstSlot + WindowIdx) % PathSlots.Num()];
+		PathSlot.TileRefs.Reset();
+
+		const FMassEntityHandle Entity = PathSlot.Request.Entity;
+		const FTransformFragment* Transform = EntityManager.IsEntityValid(Entity) ? EntityManager.GetFragmentDataPtr<FTransformFragment>(Entity) : nullptr;
+		if (Transform && !IsPathRequestPending(Entity))
+		{
+			FETW_MassPathRequest Request = PathSlot.Request;
+			Request.MoveFrom = Transform->GetTransform().GetLocation();
+			Request.bOwnQuery = false;
+			QueuePathRequest(Request);
+			NumReplanned++;
+		}
+	}
+
+	if (NumReplanned > 0)
+	{
+		UE_VLOG_UELOG(this, ETW_Mass, Verbose, TEXT("Replanning %d paths crossing rebuilt navmesh tiles"), NumReplanned);
+	}
+}
+
+bool UETW_MassNavigationSubsystem::CanJoinSharedPath(const FETW_MassPathRequest& Waiter, const FNavigationPath& Path) const
+{
+	QUICK_SCOPE_CYCLE_COUNTER(UETW_MassNavigationSubsystem_CanJoinSharedPath);
+
+	const TArray<FNavPathPoint>& SharedPoints = Path.GetPathPoints();
+	const ANavigationData* NavData = Path.GetNavigationDataUsed();
+	if (NavData == nullptr || SharedPoints.Num() < 2)
+	{
+		return false;
+	}
+
+	// same start and goal polygons don't make next path corner visible, it can be several polygons away
+	const FSharedConstNavQueryFilter Filter = Path.GetFilter().IsValid() ? Path.GetFilter() : NavData->GetDefaultQueryFilter();
+	FVector HitLocation;
+
+	// query owner starts on shared path start, no need to check it
+	const bool bOwnStart = FVector::DistSquared2D(Waiter.MoveFrom, SharedPoints[0].Location) <= FMath::Square(KINDA_SMALL_NUMBER);
+	if (!bOwnStart && NavData->Raycast(Waiter.MoveFrom, SharedPoints[1].Location, HitLocation, Filter, this))
+	{
+		return false;
+	}
+
+	// segment and partial paths keep shared end
+	const bool bOwnGoal = Path.IsPartial() || Waiter.bSegment || FVector::DistSquared2D(Waiter.MoveTo, SharedPoints.Last().Location) <= FMath::Square(KINDA_SMALL_NUMBER);
+	if (!bOwnGoal)
+	{
+		const FVector& LastLegStart = SharedPoints.Num() > 2 ? SharedPoints[SharedPoints.Num() - 2].Location : Waiter.MoveFrom;
+		if (NavData->Raycast(LastLegStart, Waiter.MoveTo, HitLocation, Filter, this))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void UETW_MassNavigationSubsystem::CommitEntityPath(FMassEntityManager& EntityManager, const FETW_MassPathRequest& Waiter, const FNavPathSharedPtr& Path, TArray<FMassEntityHandle>& OutReadyEntities, TArray<FMassEntityHandle>& OutFailedEntities)
+{
+	{
+		// result of replaced request is dropped, entity waits for its latest one
+		FScopeLock Lock(&PathRequestsCS);
+		const uint32* LatestSerial = LatestPathRequestSerials.Find(Waiter.Entity);
+		if (LatestSerial == nullptr || *LatestSerial != Waiter.Serial)
+		{
+			return;
+		}
+	}
+
+	// graph waypoint isn't reachable, continuing from partial segment end would make no progress
+	if (Waiter.bSegment && (!Path.IsValid() || Path->IsPartial()))
+	{
+		FETW_MassPathRequest DirectRequest = Waiter;
+		DirectRequest.bSegment = false;
+		DirectRequest.bNoHierarchy = true;
+		QueuePathRequest(DirectRequest);
+		return;
+	}
+
+	// shared path leads through walls from here, entity pays for its own query. Own query result is always joinable
+	if (!Waiter.bOwnQuery && Path.IsValid() && Path->GetPathPoints().Num() >= 2 && !CanJoinSharedPath(Waiter, *Path))
+	{
+		FETW_MassPathRequest OwnRequest = Waiter;
+		OwnRequest.bOwnQuery = true;
+		QueuePathRequest(OwnRequest);
+		return;
+	}
+
+	{
+		FScopeLock Lock(&PathRequestsCS);
+		LatestPathRequestSerials.Remove(Waiter.Entity);
+	}
+
+	FMassPathFragment* PathFragment = EntityManager.IsEntityValid(Waiter.Entity) ? EntityManager.GetFragmentDataPtr<FMassPathFragment>(Waiter.Entity) : nullptr;
+	if (PathFragment == nullptr)
+	{
+		return;
+	}
+
+	if (!Path.IsValid() || Path->GetPathPoints().Num() < 2)
+	{
+		FreePath(*PathFragment);
+		OutFailedEntities.Add(Waiter.Entity);
+		return;
+	}
+
+	// only point locations are kept, own start and goal were checked to see the shared path points next to them
+	const TArray<FNavPathPoint>& SharedPoints = Path->GetPathPoints();
+	TArray<FVector>& Points = AllocatePath(*PathFragment);
+	Points.Reserve(SharedPoints.Num());
+	for (const FNavPathPoint& SharedPoint : SharedPoints)
+	{
+		Points.Add(SharedPoint.Location);
+	}
+	Points[0] = Waiter.MoveFrom;
+	if (!Path->IsPartial() && !Waiter.bSegment)
+	{
+		Points.Last() = Waiter.MoveTo;
+	}
+
+	FETW_MassPathBufferSlot& PathSlot = PathSlots[PathFragment->PathHandle.Index];
+	PathSlot.Request = Waiter;
+	PathSlot.NavData = Path->GetNavigationDataUsed();
+
+	const FNavMeshPath* NavMeshPath = Path->CastPath<FNavMeshPath>();
+	if (NavMeshPath && PathSlot.NavData.IsValid())
+	{
+		UE::Mass::Navigation::GetTileRefs(*PathSlot.NavData, NavMeshPath->PathCorridor, PathSlot.TileRefs);
+	}
+
+	// corridor edges are generated once per shared path and cached in it
+	if (Waiter.bSteerAlongCorridor && NavMeshPath && NavMeshPath->PathCorridor.Num() > 1)
+	{
+		UE::Mass::Navigation::Corridor::BuildPortals(*NavMeshPath, Waiter.MoveFrom, PathSlot.Portals);
+	}
+	else
+	{
+		UE::Mass::Navigation::Corridor::SmoothPath(Points, Waiter.SmoothingSegments);
+	}
+
+	ExtractNextPathPoint(*PathFragment);
+	OutReadyEntities.Add(Waiter.Entity);
+}
+
+void UETW_MassNavigationSubsystem::EntitySetFlowFieldDestination(FMassEntityManager& EntityManager, const FMassEntityHandle Entity, const FNavAgentProperties& NavAgentProps, const FVector& Destination)
+{
+	FETW_MassFlowFieldFragment* FlowFieldFragment = EntityManager.IsEntityValid(Entity) ? EntityManager.GetFragmentDataPtr<FETW_MassFlowFieldFragment>(Entity) : nullptr;
+	if (FlowFieldFragment == nullptr)
+	{
+		return;
+	}
+
+	// acquire first, so order to the same area doesn't drop the field
+	const uint32 FieldId = AcquireFlowField(NavAgentProps, Destination);
+	ReleaseFlowField(FlowFieldFragment->FieldId);
+	FlowFieldFragment->FieldId = FieldId;
+	FlowFieldFragment->Destination = Destination;
+}
+
+uint32 UETW_MassNavigationSubsystem::AcquireFlowField(const FNavAgentProperties& NavAgentProps, const FVector& Destination)
+{
+	const ANavigationData* NavData = NavigationSystem ? NavigationSystem->GetNavDataForProps(NavAgentProps) : nullptr;
+	if (NavData == nullptr)
+	{
+		return 0;
+	}
+
+	const float CellSize = FMath::Max(UE::Mass::Navigation::FlowFieldCellSize, 1.f);
+	FETW_MassFlowFieldKey Key;
+	Key.NavData = reinterpret_cast<UPTRINT>(NavData);
+	Key.GoalCell = FIntVector(FMath::FloorToInt(Destination.X / CellSize), FMath::FloorToInt(Destination.Y / CellSize), FMath::FloorToInt(Destination.Z / CellSize));
+
+	if (const uint32* FieldId = FlowFieldIds.Find(Key))
+	{
+		FlowFields.FindChecked(*FieldId)->RefCount++;
+		return *FieldId;
+	}
+
+	// 0 is no field
+	const uint32 FieldId = ++NextFlowFieldId != 0 ? NextFlowFieldId : ++NextFlowFieldId;
+	TUniquePtr<FETW_MassFlowField>& FlowField = FlowFields.Add(FieldId, MakeUnique<FETW_MassFlowField>());
+	FlowField->Init(*NavData, Destination, CellSize, UE::Mass::Navigation::FlowFieldHalfExtent, UE::Mass::Navigation::FlowFieldVerticalExtent);
+	FlowField->RefCount = 1;
+	FlowFieldIds.Add(Key, FieldId);
+	return FieldId;
+}
+
+SIZE_T UETW_MassNavigationSubsystem::GetPathBufferAllocatedSize(int32& OutNumPaths) const
+{
+	OutNumPaths = PathSlots.Num() - FreePathSlots.Num();
+
+	SIZE_T Size = PathSlots.GetAllocatedSize() + FreePathSlots.GetAllocatedSize();
+	for (const FETW_MassPathBufferSlot& PathSlot : PathSlots)
+	{
+		Size += PathSlot.Points.GetAllocatedSize() + PathSlot.Portals.GetAllocatedSize() + PathSlot.TileRefs.GetAllocatedSize();
+	}
+	return Size;
+}
+
+void UETW_MassNavigationSubsystem::ReleaseFlowField(const uint32 FieldId)
+{
+	if (TUniquePtr<FETW_MassFlowField>* FlowField = FlowFields.Find(FieldId))
+	{
+		if (--(*FlowField)->RefCount <= 0)
+		{
+			(*FlowField)->ReleaseTime = GetWorld()->GetTimeSeconds();
+		}
+	}
+}
+
+void UETW_MassNavigationSubsystem::QueueFlowFieldReleases(TConstArrayView<uint32> FieldIds)
+{
+	FScopeLock Lock(&FlowFieldReleasesCS);
+	QueuedFlowFieldReleases.Append(FieldIds.GetData(), FieldIds.Num());
+}
+
+void UETW_MassNavigationSubsystem::ProcessFlowFields()
+{
+	QUICK_SCOPE_CYCLE_COUNTER(UETW_MassNavigationSubsystem_ProcessFlowFields);
+
+	TArray<uint32> FieldIdsToRelease;
+	{
+		FScopeLock Lock(&FlowFieldReleasesCS);
+		FieldIdsToRelease = MoveTemp(QueuedFlowFieldReleases);
+	}
+	for (const uint32 FieldId : FieldIdsToRelease)
+	{
+		ReleaseFlowField(FieldId);
+	}
+
+	const double Now = GetWorld()->GetTimeSeconds();
+	int32 CellBudget = FMath::Max(UE::Mass::Navigation::FlowFieldCellsPerFrame, 1);
+	TArray<uint32> ReadyFieldIds;
+	for (TMap<FETW_MassFlowFieldKey, uint32>::TIterator It = FlowFieldIds.CreateIterator(); It; ++It)
+	{
+		FETW_MassFlowField& FlowField = *FlowFields.FindChecked(It.Value());
+		if (FlowField.RefCount <= 0)
+		{
+			if (Now - FlowField.ReleaseTime > UE::Mass::Navigation::FlowFieldLifetime)
+			{
+				FlowFields.Remove(It.Value());
+				It.RemoveCurrent();
+			}
+			continue;
+		}
+
+		// rebuilt navmesh tile under the field, field is built again and agents go straight meanwhile
+		if (FlowField.IsReady() && !FlowField.AreTilesValid())
+		{
+			FlowField.Invalidate();
+		}
+
+		if (!FlowField.IsReady() && CellBudget > 0)
+		{
+			FlowField.Build(CellBudget);
+			if (FlowField.IsReady())
+			{
+				ReadyFieldIds.Add(It.Value());
+			}
+		}
+	}
+
+	if (!ReadyFieldIds.IsEmpty())
+	{
+		OnFlowFieldsReady.Broadcast(ReadyFieldIds);
+	}
+}
+
+void UETW_MassNavigationSubsystem::OnPathQueryFinished(uint32 QueryId, ENavigationQueryResult::Type Result, FNavPathSharedPtr Path, FETW_MassPathCacheKey Key)
+{
+	FScopeLock Lock(&PathRequestsCS);
+	FETW_MassPathQueryResult& QueryResult = FinishedPathQueries.AddDefaulted_GetRef();
+	QueryResult.Key = Key;
+	QueryResult.Path = Path;
+	QueryResult.bSuccess = Result != ENavigationQueryResult::Error && Result != ENavigationQueryResult::Fail;
 }
 
 void UETW_MassNavigationSubsystem::Initialize(FSubsystemCollectionBase& Collection)
@@ -84,7 +860,20 @@ void UETW_MassNavigationSubsystem::Initialize(FSubsystemCollectionBase& Collecti
 
 void UETW_MassNavigationSubsystem::Deinitialize()
 {
-	
+	{
+		FScopeLock Lock(&PathRequestsCS);
+		QueuedPathRequests.Reset();
+		FinishedPathQueries.Reset();
+		LatestPathRequestSerials.Reset();
+	}
+	InFlightPathQueries.Reset();
+	PathCache.Reset();
+	PathSlots.Reset();
+	FreePathSlots.Reset();
+	FlowFieldIds.Reset();
+	FlowFields.Reset();
+	ClusterGraph = nullptr;
+
 	Super::Deinitialize(); 	// should called at the end
 }
 
@@ -98,4 +887,10 @@ void UETW_MassNavigationSubsystem::OnWorldBeginPlay(UWorld& InWorld)
 void UETW_MassNavigationSubsystem::InitializeRuntime()
 {
 	NavigationSystem = FNavigationSystem::GetCurrent<UNavigationSystemV1>(GetWorld());
+
+	for (TActorIterator<AETW_MassNavClusterGraph> It(GetWorld()); It; ++It)
+	{
+		ClusterGraph = *It;
+		break;
+	}
 }
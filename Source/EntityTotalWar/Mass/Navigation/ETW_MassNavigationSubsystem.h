@@ -6,11 +6,113 @@
 #include "Subsystems/WorldSubsystem.h"
 #include "NavigationSystem/Public/NavigationData.h"
 #include "ETW_MassNavigationTypes.h"
+#include "ETW_MassFlowField.h"
 #include "MassExecutionContext.h"
 #include "ETW_MassNavigationSubsystem.generated.h"
 
 class UMassSignalSubsystem;
 class UNavigationSystemV1;
+class AETW_MassNavClusterGraph;
+
+namespace UE::Mass::Navigation
+{
+	/**
+	 * One poly ref per distinct navmesh tile of Polys. Poly refs carry salt of their tile, rebuilt tile gets new salt,
+	 * so the refs tell whether any of the tiles was rebuilt since. Empty for non recast navigation data.
+	 */
+	ENTITYTOTALWAR_API void GetTileRefs(const ANavigationData& NavData, TConstArrayView<NavNodeRef> Polys, TArray<NavNodeRef>& OutTileRefs);
+
+	// false when any of the tiles was rebuilt or removed
+	ENTITYTOTALWAR_API bool AreTileRefsValid(const ANavigationData& NavData, TConstArrayView<NavNodeRef> TileRefs);
+}
+
+/** Edge between two consecutive corridor polygons, left and right as seen along the path */
+struct FETW_MassPathPortal
+{
+	FVector Left = FVector::ZeroVector;
+	FVector Right = FVector::ZeroVector;
+};
+
+/**
+ * Queued async path request, only the latest request of an entity is kept.
+ * Requests sharing one path query wait for it, their own start and goal are joined to the shared path.
+ */
+struct FETW_MassPathRequest
+{
+	FMassEntityHandle Entity;
+	FNavAgentProperties NavAgentProps;
+	FVector MoveFrom = FVector::ZeroVector;
+	FVector MoveTo = FVector::ZeroVector;
+	uint32 Serial = 0;
+	int32 SmoothingSegments = 0;
+	bool bAllowPartialPath = true;
+	bool bSteerAlongCorridor = true;
+
+	// long request planned on cluster graph, navmesh query goes to SegmentGoal only
+	bool bSegment = false;
+	FVector SegmentGoal = FVector::ZeroVector;
+
+	// shared path wasn't reachable straight from entity start or goal, request runs its own query
+	bool bOwnQuery = false;
+
+	// segment query ended partial, request goes straight to MoveTo on navmesh
+	bool bNoHierarchy = false;
+};
+
+/** Path points in pooled buffer, freed slot keeps its allocation for next path */
+struct FETW_MassPathBufferSlot
+{
+	TArray<FVector> Points;
+
+	// empty when path isn't followed along corridor
+	TArray<FETW_MassPathPortal> Portals;
+
+	// corridor tiles, path is replanned by its request from entity location when any of them is rebuilt
+	TArray<NavNodeRef> TileRefs;
+	TWeakObjectPtr<const ANavigationData> NavData;
+	FETW_MassPathRequest Request;
+
+	uint32 Serial = 0;
+};
+
+/** Requests with the same key share one path query, start and goal are quantized to navmesh polygons */
+struct FETW_MassPathCacheKey
+{
+	UPTRINT NavData = 0;
+	NavNodeRef StartPoly = INVALID_NAVNODEREF;
+	NavNodeRef GoalPoly = INVALID_NAVNODEREF;
+	bool bAllowPartialPath = true;
+
+	bool operator==(const FETW_MassPathCacheKey& Other) const
+	{
+		return NavData == Other.NavData && StartPoly == Other.StartPoly && GoalPoly == Other.GoalPoly && bAllowPartialPath == Other.bAllowPartialPath;
+	}
+
+	friend uint32 GetTypeHash(const FETW_MassPathCacheKey& Key)
+	{
+		uint32 Hash = HashCombine(GetTypeHash(Key.NavData), GetTypeHash(Key.StartPoly));
+		Hash = HashCombine(Hash, GetTypeHash(Key.GoalPoly));
+		return HashCombine(Hash, GetTypeHash(Key.bAllowPartialPath));
+	}
+};
+
+/** Finished async path query waiting to be committed at the sync point */
+struct FETW_MassPathQueryResult
+{
+	FETW_MassPathCacheKey Key;
+	FNavPathSharedPtr Path;
+	bool bSuccess = false;
+};
+
+/** Computed path kept for requests of following frames */
+struct FETW_MassCachedPath
+{
+	FNavPathSharedPtr Path;
+	double Time = 0.;
+};
+
+DECLARE_MULTICAST_DELEGATE_TwoParams(FETW_MassOnPathsCommitted, TConstArrayView<FMassEntityHandle> /*ReadyEntities*/, TConstArrayView<FMassEntityHandle> /*FailedEntities*/);
+DECLARE_MULTICAST_DELEGATE_OneParam(FETW_MassOnFlowFieldsReady, TConstArrayView<uint32> /*FieldIds*/);
 
 /**
  * 
@@ -21,16 +123,95 @@ class ENTITYTOTALWAR_API UETW_MassNavigationSubsystem : public UWorldSubsystem
 	GENERATED_BODY()
 
 public:
-	void EntityRequestNewPath(const FMassEntityHandle Entity, const FMassPathFollowParams& PathFollowParams, const FVector& MoveFrom, const FVector& MoveTo, FMassPathFragment& OutPathFragment);
-	void EntityRequestNewPathDeferred(FMassExecutionContext& Context, const FMassEntityHandle Entity, const FMassPathFollowParams& PathFollowParams, const FVector& MoveFrom, const FVector& MoveTo, FMassPathFragment& OutPathFragment);
-	bool EntityExtractNextPathPoint(const FMassEntityHandle Entity, FMassPathFragment& OutPathFragment);
-	void EntityExtractNextPathPointDeferred(FMassExecutionContext& Context, const FMassEntityHandle Entity, FMassPathFragment& OutPathFragment);
+	/**
+	 * Reads next point of fragment's path into PathPoint, safe from workers outside of path commit sync point.
+	 * @return false when path has no more points
+	 */
+	bool ExtractNextPathPoint(FMassPathFragment& OutPathFragment) const;
+
+	/**
+	 * Corridor steering, safe from workers like ExtractNextPathPoint. Funnel from location over corridor portals ahead
+	 * gives the farthest visible path point, it's set to PathPoint. Crossed portals are skipped for next calls.
+	 * @return false when path has no corridor, point by point following is used then
+	 */
+	bool UpdateCorridorPathPoint(const FVector& Location, FMassPathFragment& PathFragment) const;
 
-	const FNavigationPath* const EntityGetNavPath(const FMassEntityHandle Entity) const
+	bool HasPath(const FMassPathFragment& PathFragment) const
 	{
-		return EntityNavigationPathMap.Find(Entity);
+		return GetPathSlot(PathFragment.PathHandle) != nullptr;
 	}
 
+	/**
+	 * Path is a refined segment of hierarchical path: requests next segment from the end of this one, thread safe.
+	 * Entity keeps following current segment until the next one is committed.
+	 * @return true when next segment was requested
+	 */
+	bool RequestPathContinuation(const FMassEntityHandle Entity, const FMassPathFragment& PathFragment);
+
+	// all points extracted, or goal is visible along corridor
+	bool IsPathFinished(const FMassPathFragment& PathFragment) const
+	{
+		const FETW_MassPathBufferSlot* PathSlot = GetPathSlot(PathFragment.PathHandle);
+		return PathSlot == nullptr || PathFragment.NextPathVertIdx >= PathSlot->Points.Num();
+	}
+
+	// returns path slot of removed entity fragment to the pool
+	void FreePath(FMassPathFragment& PathFragment);
+
+	/**
+	 * Queues path request, thread safe. Newer request of the same entity replaces the queued or in flight one.
+	 * Path is committed by ProcessPathRequests with first path point already extracted to FMassPathFragment,
+	 * entity is signaled with RequestNewPath when path is ready or ReachedPathEnd when query failed.
+	 */
+	void EntityRequestNewPathAsync(const FMassEntityHandle Entity, const FMassPathFollowParams& PathFollowParams, const FVector& MoveFrom, const FVector& MoveTo);
+
+	// true from request until its path is committed
+	bool IsPathRequestPending(const FMassEntityHandle Entity) const;
+
+	/** Sync point: commits finished paths and dispatches queued requests to nav system workers within frame budget */
+	void ProcessPathRequests(FMassEntityManager& EntityManager);
+
+	// broadcast on game thread by ProcessPathRequests with entities whose path was committed or failed this frame
+	FETW_MassOnPathsCommitted& GetOnPathsCommitted() { return OnPathsCommitted; }
+
+	/**
+	 * Projects chunk of candidate move targets to navmesh of agent, thread safe. Points are split in batches over
+	 * worker threads, caller keeps only projected ones so no path query is wasted on off navmesh target.
+	 * @param InOutPoints candidates, replaced by their navmesh location when projected
+	 * @param OutProjected per point, false when there is no navmesh within extent
+	 * @param Extent query extent, navmesh default query extent when zero
+	 * @return false when there is no navmesh for agent, points are left as they are
+	 */
+	bool ProjectPointsToNavigation(const FNavAgentProperties& NavAgentProps, TArrayView<FVector> InOutPoints, TArray<bool>& OutProjected, const FVector& Extent = FVector::ZeroVector) const;
+
+	/**
+	 * Flow field move order, game thread only. Entity releases field of its previous order and acquires the field
+	 * shared by orders to the same area, field is built by ProcessFlowFields over next frames.
+	 */
+	void EntitySetFlowFieldDestination(FMassEntityManager& EntityManager, const FMassEntityHandle Entity, const FNavAgentProperties& NavAgentProps, const FVector& Destination);
+
+	// game thread only, returns 0 when there is no navmesh for agent
+	uint32 AcquireFlowField(const FNavAgentProperties& NavAgentProps, const FVector& Destination);
+	void ReleaseFlowField(const uint32 FieldId);
+
+	// any thread, fields are released by ProcessFlowFields at UETW_MassPathRequestProcessor sync point
+	void QueueFlowFieldReleases(TConstArrayView<uint32> FieldIds);
+
+	const FETW_MassFlowField* FindFlowField(const uint32 FieldId) const
+	{
+		const TUniquePtr<FETW_MassFlowField>* FlowField = FlowFields.Find(FieldId);
+		return FlowField ? FlowField->Get() : nullptr;
+	}
+
+	/** Builds acquired flow fields within frame budget, evicts unused ones */
+	void ProcessFlowFields();
+
+	// broadcast on game thread by ProcessFlowFields with fields finished this frame
+	FETW_MassOnFlowFieldsReady& GetOnFlowFieldsReady() { return OnFlowFieldsReady; }
+
+	// memory held by path buffer, for profiling
+	SIZE_T GetPathBufferAllocatedSize(int32& OutNumPaths) const;
+
 protected:
 	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
 	virtual void Deinitialize() override;
@@ -45,7 +226,63 @@ protected:
 	UPROPERTY()
 	TObjectPtr<UNavigationSystemV1> NavigationSystem;
 
-	TMap<FMassEntityHandle, FNavigationPath> EntityNavigationPathMap;
+	// optional, level without graph plans all paths on navmesh
+	UPROPERTY()
+	TObjectPtr<AETW_MassNavClusterGraph> ClusterGraph;
+
+	void OnPathQueryFinished(uint32 QueryId, ENavigationQueryResult::Type Result, FNavPathSharedPtr Path, FETW_MassPathCacheKey Key);
+
+	void QueuePathRequest(const FETW_MassPathRequest& Request);
+
+	// long requests get SegmentGoal from cluster graph path, at refine distance ahead
+	void PlanPathSegment(FETW_MassPathRequest& Request) const;
+
+	// time sliced check of path corridors against rebuilt navmesh tiles, affected paths are requested again
+	void ReplanInvalidatedPaths(FMassEntityManager& EntityManager);
+
+	// navmesh raycasts from entity start to second shared path point and from second to last one to entity goal
+	bool CanJoinSharedPath(const FETW_MassPathRequest& Waiter, const FNavigationPath& Path) const;
+
+	// copies shared path to entity and replaces its ends with entity own start and goal. Entity which can't join the
+	// shared path is queued again for its own query and keeps following its current path meanwhile
+	void CommitEntityPath(FMassEntityManager& EntityManager, const FETW_MassPathRequest& Waiter, const FNavPathSharedPtr& Path, TArray<FMassEntityHandle>& OutReadyEntities, TArray<FMassEntityHandle>& OutFailedEntities);
+
+	// replaces fragment's path with empty pooled one, returns its points to fill
+	TArray<FVector>& AllocatePath(FMassPathFragment& PathFragment);
+
+	const FETW_MassPathBufferSlot* GetPathSlot(const FETW_MassPathHandle& Handle) const
+	{
+		return PathSlots.IsValidIndex(Handle.Index) && PathSlots[Handle.Index].Serial == Handle.Serial ? &PathSlots[Handle.Index] : nullptr;
+	}
+
+	// modified only at sync point, read by processors
+	TArray<FETW_MassPathBufferSlot> PathSlots;
+	TArray<int32> FreePathSlots;
+	int32 NextPathValidationSlot = 0;
+
+	TArray<FETW_MassPathRequest> QueuedPathRequests;
+	TArray<FETW_MassPathQueryResult> FinishedPathQueries;
+	mutable FCriticalSection PathRequestsCS;
+
+	// game thread only, dispatched shared queries and their waiters
+	TMap<FETW_MassPathCacheKey, TArray<FETW_MassPathRequest>> InFlightPathQueries;
+	TMap<FETW_MassPathCacheKey, FETW_MassCachedPath> PathCache;
+
+	// serial of the latest request per entity, stale results are dropped
+	TMap<FMassEntityHandle, uint32> LatestPathRequestSerials;
+	uint32 NextPathRequestSerial = 0;
+
+	// game thread only, read by flow field follow processor
+	TMap<uint32, TUniquePtr<FETW_MassFlowField>> FlowFields;
+	TMap<FETW_MassFlowFieldKey, uint32> FlowFieldIds;
+	uint32 NextFlowFieldId = 0;
+
+	// released from processors and observers, drained on game thread
+	TArray<uint32> QueuedFlowFieldReleases;
+	FCriticalSection FlowFieldReleasesCS;
+
+	FETW_MassOnPathsCommitted OnPathsCommitted;
+	FETW_MassOnFlowFieldsReady OnFlowFieldsReady;
 };
 
 template<>
@@ -30,8 +30,16 @@ struct FMassPathFollowingRespondTag : public FMassTag
 	GENERATED_BODY();
 };
 
+/** Slot of path in UETW_MassNavigationSubsystem path buffer, serial detects reused slots */
+struct FETW_MassPathHandle
+{
+	int32 Index = INDEX_NONE;
+	uint32 Serial = 0;
+
+	bool IsValid() const { return Index != INDEX_NONE; }
+};
+
 // todo: use global squad ai controller for avoiding massive code duplication and bugs
-// todo: move from fragment to subsystem (heavy to store in entity) or make shared non const fragment
 USTRUCT()
 struct FMassPathFragment : public FMassFragment
 {
@@ -42,8 +50,12 @@ struct FMassPathFragment : public FMassFragment
 	const FVector& GetPathPoint() const { return PathPoint; }
 
 protected:
-	FVector PathPoint;
+	FVector PathPoint = FVector::ZeroVector;
+	FETW_MassPathHandle PathHandle;
 	uint16 NextPathVertIdx = 0;
+
+	// first corridor portal not crossed yet, corridor steering only
+	uint16 NextPortalIdx = 0;
 };
 
 USTRUCT()
@@ -66,5 +78,13 @@ struct ENTITYTOTALWAR_API FMassPathFollowParams : public FMassSharedFragment
 	UPROPERTY(EditAnywhere, Category = "Navigation", meta = (ClampMin = "0", ForceUnits="cm"))
 	bool bAllowPartialPath = true;
 
+	/** Keep polygon corridor of path and steer to the farthest visible point of it every tick instead of going point by point */
+	UPROPERTY(EditAnywhere, Category = "Navigation")
+	bool bSteerAlongCorridor = true;
+
+	/** Catmull-Rom segments per path edge, 0 keeps raw path points. Applies to point by point following, may cut corners */
+	UPROPERTY(EditAnywhere, Category = "Navigation", meta = (ClampMin = "0", ClampMax = "8"))
+	int32 SmoothingSegments = 0;
+
 	// todo config NavPoints step
 };
\ No newline at end of file
@@ -10,6 +10,7 @@
 #include "MassSimulationLOD.h"
 #include "../Common/Fragments/ETW_MassFragments.h"
 #include "ETW_MassNavigationSubsystem.h"
+#include "Mass/Commander/ETW_MassSquadFragments.h"
 #include "EnvironmentQuery/EnvQueryGenerator.h"
 #include "Translators/MassCharacterMovementTranslators.h"
 #include "GameFramework/CharacterMovementComponent.h"
@@ -27,6 +28,35 @@ void UETW_PathFollowTrait::BuildTemplate(FMassEntityTemplateBuildContext& BuildC
 	BuildContext.AddConstSharedFragment(ParamsFragment);
 }
 
+UETW_MassPathRequestProcessor::UETW_MassPathRequestProcessor()
+	: EntityQuery(*this)
+{
+	bAutoRegisterWithProcessingPhases = true;
+	ExecutionFlags = (int32)(EProcessorExecutionFlags::Server | EProcessorExecutionFlags::Standalone);
+	ExecutionOrder.ExecuteInGroup = UE::Mass::ProcessorGroupNames::Tasks;
+	ExecutionOrder.ExecuteBefore.Add(UETW_MassPathFollowProcessor::StaticClass()->GetFName());
+
+	// nav system async queries are dispatched from game thread
+	bRequiresGameThreadExecution = true;
+}
+
+void UETW_MassPathRequestProcessor::ConfigureQueries()
+{
+	EntityQuery.AddRequirement<FMassPathFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadOnly);
+
+	EntityQuery.AddSubsystemRequirement<UETW_MassNavigationSubsystem>(EMassFragmentAccess::ReadWrite);
+}
+
+void UETW_MassPathRequestProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	if (UETW_MassNavigationSubsystem* NavigationSubsystem = UWorld::GetSubsystem<UETW_MassNavigationSubsystem>(EntityManager.GetWorld()))
+	{
+		NavigationSubsystem->ProcessPathRequests(EntityManager);
+		NavigationSubsystem->ProcessFlowFields();
+	}
+}
+
 UETW_MassPathFollowProcessor::UETW_MassPathFollowProcessor()
 	: EntityQuery(*this)
 {
@@ -49,27 +79,33 @@ void UETW_MassPathFollowProcessor::ConfigureQueries()
 
 	EntityQuery.AddTagRequirement<FMassPathFollowingProgressTag>(EMassFragmentPresence::All);
 
-	EntityQuery.AddRequirement<FCharacterMovementComponentWrapperFragment>(EMassFragmentAccess::ReadOnly, EMassFragmentPresence::Optional);
-
+	// squad units are driven by UETW_MassSquadFormationMoveProcessor
+	EntityQuery.AddRequirement<FETW_MassFormationFollowFragment>(EMassFragmentAccess::None, EMassFragmentPresence::None);
 }
 
 void UETW_MassPathFollowProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
 {
-	const UWorld* World = EntityManager.GetWorld();
+	QUICK_SCOPE_CYCLE_COUNTER(UETW_MassPathFollowProcessor_Execute);
 
-	// updates FMassMoveTargetFragment with new path point
-	EntityQuery.ForEachEntityChunk(EntityManager, Context, ([World](FMassExecutionContext& Context){
+	const UWorld* World = EntityManager.GetWorld();
+	const uint64 FrameSeed = GFrameCounter;
 
+	// updates FMassMoveTargetFragment with new path point, waypoints are advanced inline, only new paths go to async queue
+	EntityQuery.ParallelForEachEntityChunk(EntityManager, Context, [World, FrameSeed](FMassExecutionContext& Context)
+	{
 		const FMassPathFollowParams& PathFollowParams = Context.GetConstSharedFragment<FMassPathFollowParams>();
 		const TConstArrayView<FTransformFragment> TransformList = Context.GetFragmentView<FTransformFragment>();
 		const TArrayView<FMassPathFragment> PathFragList = Context.GetMutableFragmentView<FMassPathFragment>();
 		const TArrayView<FMassMoveTargetFragment> MoveTargetFragList = Context.GetMutableFragmentView<FMassMoveTargetFragment>();
 		const TArrayView<FMassTargetLocationFragment> TargetLocationList = Context.GetMutableFragmentView<FMassTargetLocationFragment>();
 
+		// path buffer is only modified at UETW_MassPathRequestProcessor sync point, async requests are thread safe
 		UETW_MassNavigationSubsystem* NavigationSubsystem = Context.GetMutableSubsystem<UETW_MassNavigationSubsystem>();
 
-		const TConstArrayView<FCharacterMovementComponentWrapperFragment> MovementComponentList = Context.GetFragmentView<FCharacterMovementComponentWrapperFragment>();
-		bool bHasMovementComponent = MovementComponentList.Num() > 0;
+		// random test targets of the chunk are projected to navmesh in one batch after the loop
+		TArray<FMassEntityHandle, TInlineAllocator<16>> RandomTargetEntities;
+		TArray<FVector, TInlineAllocator<16>> RandomTargetOrigins;
+		TArray<FVector, TInlineAllocator<16>> RandomTargets;
 
 		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
 		{
@@ -78,57 +114,108 @@ void UETW_MassPathFollowProcessor::Execute(FMassEntityManager& EntityManager, FM
 			FVector& TargetLocation = TargetLocationList[EntityIndex].Target;
 			const FVector CurrentLocation = TransformList[EntityIndex].GetTransform().GetLocation();
 
-			const FCharacterMovementComponentWrapperFragment* MovementCompFrag = bHasMovementComponent ? &MovementComponentList[EntityIndex] : nullptr;
+			// corridor paths retarget every tick to the farthest visible point, no waypoint switches on the way
+			const bool bCorridorPath = NavigationSubsystem->UpdateCorridorPathPoint(CurrentLocation, PathFrag);
+			if (bCorridorPath)
+			{
+				TargetLocation = PathFrag.GetPathPoint();
+				if (MoveTargetFrag.GetCurrentAction() == EMassMovementAction::Stand && FVector::DistSquared(TargetLocation, CurrentLocation) > FMath::Square(PathFollowParams.SlackRadius))
+				{
+					MoveTargetFrag.CreateNewAction(EMassMovementAction::Move, *World);
+					MoveTargetFrag.IntentAtGoal = EMassMovementAction::Stand;
+				}
+			}
 
 			// update MoveTargetFragment
 			FVector DirectionToTarget = TargetLocation - CurrentLocation;
 			MoveTargetFrag.Center = CurrentLocation;
-			// FVector DirectionToTarget = MoveTargetFrag.Center - CurrentLocation;
 			MoveTargetFrag.Forward = DirectionToTarget.GetSafeNormal();
 			MoveTargetFrag.DistanceToGoal = DirectionToTarget.Size();
 
-			if (MoveTargetFrag.GetCurrentAction() == EMassMovementAction::Stand || MoveTargetFrag.DistanceToGoal <= PathFollowParams.SlackRadius)
+			const FMassEntityHandle EntityHandle = Context.GetEntity(EntityIndex);
+
+			// last point of hierarchical path segment is targeted, next segment is requested ahead of arrival
+			if (NavigationSubsystem->IsPathFinished(PathFrag))
+			{
+				NavigationSubsystem->RequestPathContinuation(EntityHandle, PathFrag);
+			}
+
+			if (MoveTargetFrag.GetCurrentAction() != EMassMovementAction::Stand && MoveTargetFrag.DistanceToGoal > PathFollowParams.SlackRadius)
+			{
+				continue;
+			}
+
+			if (bCorridorPath && !NavigationSubsystem->IsPathFinished(PathFrag))
 			{
-				FMassEntityHandle EntityHandle = Context.GetEntity(EntityIndex);
-				
-				// deferred:
-				Context.Defer().PushCommand<FMassDeferredChangeCompositionCommand>([MovementCompFrag, NavigationSubsystem, EntityHandle, &PathFrag, &MoveTargetFrag, &TargetLocation, World, CurrentLocation, &PathFollowParams](FMassEntityManager& Manager){
-					
-					if (NavigationSubsystem->EntityExtractNextPathPoint(EntityHandle, PathFrag))
-					{
-						// set new target from path list
-						MoveTargetFrag.CreateNewAction(EMassMovementAction::Move, *World);
-						MoveTargetFrag.IntentAtGoal = EMassMovementAction::Stand;
-						TargetLocation = PathFrag.GetPathPoint();
-					}
-					else
-					{
-						const float DistMax = PathFollowParams.TempTestRandomNavigationRadius;
-						const FVector NewMoveToLocation = FVector(FMath::FRandRange(-DistMax, DistMax), FMath::FRandRange(-DistMax, DistMax), 0) + CurrentLocation;
-						NavigationSubsystem->EntityRequestNewPath(EntityHandle, PathFollowParams, CurrentLocation, NewMoveToLocation, PathFrag);
-
-						// @todo: dbg temp remove
-						if (auto NavPath = NavigationSubsystem->EntityGetNavPath(EntityHandle))
-						{
-							auto Color = FLinearColor::MakeRandomColor().ToFColor(true);
-							for (auto& Point : NavPath->GetPathPoints())
-							{
-								DrawDebugSphere(World, Point.Location, 40.f, 8, Color, false, 5.f);
-							}
-						}
-						
-						if (NavigationSubsystem->EntityExtractNextPathPoint(EntityHandle, PathFrag))
-						{
-							// set new target from path list
-							MoveTargetFrag.CreateNewAction(EMassMovementAction::Move, *World);
-							MoveTargetFrag.IntentAtGoal = EMassMovementAction::Stand;
-							TargetLocation = PathFrag.GetPathPoint();
-						}
-					}
-				});
+				// corner reached, funnel moves past it once its portal is crossed
+				continue;
+			}
+
+			if (!bCorridorPath && NavigationSubsystem->ExtractNextPathPoint(PathFrag))
+			{
+				// set new target from path list
+				MoveTargetFrag.CreateNewAction(EMassMovementAction::Move, *World);
+				MoveTargetFrag.IntentAtGoal = EMassMovementAction::Stand;
+				TargetLocation = PathFrag.GetPathPoint();
+			}
+			else if (!NavigationSubsystem->RequestPathContinuation(EntityHandle, PathFrag))
+			{
+				if (!NavigationSubsystem->IsPathRequestPending(EntityHandle))
+				{
+					// path is committed with its first point, entity picks it up as next path point then
+					FRandomStream RandomStream(static_cast<int32>(HashCombine(GetTypeHash(EntityHandle.Index), GetTypeHash(FrameSeed))));
+					const float DistMax = PathFollowParams.TempTestRandomNavigationRadius;
+					RandomTargetEntities.Add(EntityHandle);
+					RandomTargetOrigins.Add(CurrentLocation);
+					RandomTargets.Add(FVector(RandomStream.FRandRange(-DistMax, DistMax), RandomStream.FRandRange(-DistMax, DistMax), 0) + CurrentLocation);
+				}
+			}
+		}
+
+		if (!RandomTargets.IsEmpty())
+		{
+			// off navmesh candidates would only fail their path query, entity picks another one next tick
+			TArray<bool> Projected;
+			NavigationSubsystem->ProjectPointsToNavigation(PathFollowParams.NavAgentProps, RandomTargets, Projected);
+			for (int32 TargetIdx = 0; TargetIdx < RandomTargets.Num(); TargetIdx++)
+			{
+				if (Projected[TargetIdx])
+				{
+					NavigationSubsystem->EntityRequestNewPathAsync(RandomTargetEntities[TargetIdx], PathFollowParams, RandomTargetOrigins[TargetIdx], RandomTargets[TargetIdx]);
+				}
 			}
 		}
-	}));
+	});
+}
+
+UETW_MassPathReleaseObserver::UETW_MassPathReleaseObserver()
+	: EntityQuery(*this)
+{
+	ObservedType = FMassPathFragment::StaticStruct();
+	Operation = EMassObservedOperation::Remove;
+	ExecutionFlags = (int32)(EProcessorExecutionFlags::Server | EProcessorExecutionFlags::Standalone);
+}
+
+void UETW_MassPathReleaseObserver::ConfigureQueries()
+{
+	EntityQuery.AddRequirement<FMassPathFragment>(EMassFragmentAccess::ReadWrite);
+}
+
+void UETW_MassPathReleaseObserver::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	UETW_MassNavigationSubsystem* NavigationSubsystem = UWorld::GetSubsystem<UETW_MassNavigationSubsystem>(EntityManager.GetWorld());
+	if (NavigationSubsystem == nullptr)
+	{
+		return;
+	}
+
+	EntityQuery.ForEachEntityChunk(EntityManager, Context, [NavigationSubsystem](FMassExecutionContext& Context)
+	{
+		for (FMassPathFragment& PathFragment : Context.GetMutableFragmentView<FMassPathFragment>())
+		{
+			NavigationSubsystem->FreePath(PathFragment);
+		}
+	});
 }
 
 UETW_MassPathFollowInitializer::UETW_MassPathFollowInitializer()
@@ -188,8 +275,6 @@ void UETW_MassPathFollowInitializer::Execute(FMassEntityManager& EntityManager,
 
 			// deferred:
 			Context.Defer().PushCommand<FMassDeferredChangeCompositionCommand>([=](FMassEntityManager& Manager){
-				//NavigationSubsystem->EntityRequestNewPath(EntityHandle, PathFollowParams, InitialLocation, NewMoveToLocation, PathFragment);
-
 				// add tag for able to process path with UETW_MassPathFollowProcessor
 				Manager.AddTagToEntity(EntityHandle, FMassPathFollowingProgressTag::StaticStruct());
 				Manager.RemoveTagFromEntity(EntityHandle, FMassPathFollowingRequestTag::StaticStruct());
@@ -25,6 +25,27 @@ public:
 };
 
 
+/**
+ * Async path requests sync point. Commits paths finished since last frame and dispatches queued requests,
+ * continues flow field builds, runs before any processor reading entity paths or flow fields.
+ */
+UCLASS()
+class ENTITYTOTALWAR_API UETW_MassPathRequestProcessor : public UMassProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UETW_MassPathRequestProcessor();
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+
+	// never iterated, path results are written per entity by navigation subsystem. Declares that access to dependency solver
+	FMassEntityQuery EntityQuery;
+};
+
+
 /**
  * 
  */
@@ -44,6 +65,25 @@ protected:
 };
 
 
+/**
+ * Returns path buffer slot of removed entities to the pool.
+ */
+UCLASS()
+class ENTITYTOTALWAR_API UETW_MassPathReleaseObserver : public UMassObserverProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UETW_MassPathReleaseObserver();
+
+protected:
+	virtual void ConfigureQueries() override;
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+
+	FMassEntityQuery EntityQuery;
+};
+
+
 /**
  * 
  */